@@ -160,4 +160,47 @@ HardwareSerial::operator bool() const
 void HardwareSerial::setUartIrqIdleTrigger(uint8_t nbByte)
 {
     uartSetIrqIdleTrigger(_uart, nbByte);
-}
\ No newline at end of file
+}
+
+void HardwareSerial::setRxTimeout(uint8_t symbols)
+{
+    uartSetRxTimeout(_uart, symbols);
+}
+
+void HardwareSerial::setRxFifoFull(uint8_t threshold)
+{
+    uartSetRxFifoFull(_uart, threshold);
+}
+
+void HardwareSerial::setRxExpectedLength(uint8_t len)
+{
+    uartSetRxExpectedLength(_uart, len);
+}
+
+void HardwareSerial::setInterruptCore(int8_t core)
+{
+    uartSetInterruptCore(_uart_nr, core);
+}
+
+void HardwareSerial::setIsrHook(uart_isr_hook_t hook)
+{
+    uartSetIsrHook(_uart, hook);
+}
+
+uart_stats_t HardwareSerial::stats()
+{
+    uart_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    uartGetStats(_uart, &stats);
+    return stats;
+}
+
+void HardwareSerial::waitTxIdle()
+{
+    uartWaitTxIdle(_uart);
+}
+
+void HardwareSerial::resetStats()
+{
+    uartResetStats(_uart);
+}
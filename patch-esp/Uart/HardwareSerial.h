@@ -97,6 +97,14 @@ public:
 //////////////////////////////////////////////////////////////////////
 
     void setUartIrqIdleTrigger(uint8_t);
+    void setRxTimeout(uint8_t symbols);
+    void setRxFifoFull(uint8_t threshold);
+    void setRxExpectedLength(uint8_t len);
+    void setInterruptCore(int8_t core);
+    void setIsrHook(uart_isr_hook_t hook);
+    uart_stats_t stats();
+    void resetStats();
+    void waitTxIdle();
 
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -14,6 +14,7 @@
 
 #include "esp32-hal-uart.h"
 #include "esp32-hal.h"
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -29,6 +30,8 @@
 #include "soc/dport_reg.h"
 #include "soc/rtc.h"
 #include "esp_intr_alloc.h"
+#include "esp_ipc.h"
+#include "esp_timer.h"
 
 #define UART_REG_BASE(u)    ((u==0)?DR_REG_UART_BASE:(      (u==1)?DR_REG_UART1_BASE:(    (u==2)?DR_REG_UART2_BASE:0)))
 #define UART_RXD_IDX(u)     ((u==0)?U0RXD_IN_IDX:(          (u==1)?U1RXD_IN_IDX:(         (u==2)?U2RXD_IN_IDX:0)))
@@ -45,6 +48,13 @@ struct uart_struct_t {
     uint8_t num;
     xQueueHandle queue;
     intr_handle_t intr_handle;
+    int8_t intr_core;
+    uint8_t rx_fifo_full_thrhd;
+    uint8_t rx_tout_thrhd;
+    uart_stats_t stats;
+    uart_isr_hook_t isr_hook;
+    uint32_t int_ena_apb;       // interrupts enabled before an APB change
+    int8_t intr_alloc_core;     // core the interrupt was allocated on, it must be freed there
 };
 
 #if CONFIG_DISABLE_HAL_LOCKS
@@ -52,62 +62,155 @@ struct uart_struct_t {
 #define UART_MUTEX_UNLOCK()
 
 static uart_t _uart_bus_array[3] = {
-    {(volatile uart_dev_t *)(DR_REG_UART_BASE), 0, NULL, NULL},
-    {(volatile uart_dev_t *)(DR_REG_UART1_BASE), 1, NULL, NULL},
-    {(volatile uart_dev_t *)(DR_REG_UART2_BASE), 2, NULL, NULL}
+    {(volatile uart_dev_t *)(DR_REG_UART_BASE), 0, NULL, NULL, -1, 112, 2},
+    {(volatile uart_dev_t *)(DR_REG_UART1_BASE), 1, NULL, NULL, -1, 112, 2},
+    {(volatile uart_dev_t *)(DR_REG_UART2_BASE), 2, NULL, NULL, -1, 112, 2}
 };
 #else
 #define UART_MUTEX_LOCK()    do {} while (xSemaphoreTake(uart->lock, portMAX_DELAY) != pdPASS)
 #define UART_MUTEX_UNLOCK()  xSemaphoreGive(uart->lock)
 
 static uart_t _uart_bus_array[3] = {
-    {(volatile uart_dev_t *)(DR_REG_UART_BASE), NULL, 0, NULL, NULL},
-    {(volatile uart_dev_t *)(DR_REG_UART1_BASE), NULL, 1, NULL, NULL},
-    {(volatile uart_dev_t *)(DR_REG_UART2_BASE), NULL, 2, NULL, NULL}
+    {(volatile uart_dev_t *)(DR_REG_UART_BASE), NULL, 0, NULL, NULL, -1, 112, 2},
+    {(volatile uart_dev_t *)(DR_REG_UART1_BASE), NULL, 1, NULL, NULL, -1, 112, 2},
+    {(volatile uart_dev_t *)(DR_REG_UART2_BASE), NULL, 2, NULL, NULL, -1, 112, 2}
 };
 #endif
 
 static void uart_on_apb_change(void * arg, apb_change_ev_t ev_type, uint32_t old_apb, uint32_t new_apb);
 
+static inline uint32_t IRAM_ATTR _uart_ccount()
+{
+    uint32_t ccount;
+    __asm__ __volatile__("esync; rsr %0,ccount":"=a" (ccount));
+    return ccount;
+}
+
+/*
+ * Each UART has its own interrupt allocated with its own uart_t as argument,
+ * so the handler only touches the peripheral that raised it.
+ */
 static void IRAM_ATTR _uart_isr(void *arg)
 {
-    uint8_t i, c;
-    BaseType_t xHigherPriorityTaskWoken;
-    uart_t* uart;
+    uint8_t c;
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    uart_t* uart = (uart_t*)arg;
+    uint32_t cycles = _uart_ccount();
+    bool received = false;
 
-    for(i=0;i<3;i++){
-        uart = &_uart_bus_array[i];
-        if(uart->intr_handle == NULL){
-            continue;
-        }
-        uart->dev->int_clr.rxfifo_full = 1;
-        uart->dev->int_clr.frm_err = 1;
-        uart->dev->int_clr.rxfifo_tout = 1;
-        while(uart->dev->status.rxfifo_cnt || (uart->dev->mem_rx_status.wr_addr != uart->dev->mem_rx_status.rd_addr)) {
-            c = uart->dev->fifo.rw_byte;
-            if(uart->queue != NULL && !xQueueIsQueueFullFromISR(uart->queue)) {
-                xQueueSendFromISR(uart->queue, &c, &xHigherPriorityTaskWoken);
-            }
+    if(uart->isr_hook != NULL) {
+        uart->isr_hook(uart->num);
+    }
+
+    if(uart->dev->int_st.frm_err) {
+        uart->stats.frame_errors++;
+    }
+    if(uart->dev->int_st.parity_err) {
+        uart->stats.parity_errors++;
+    }
+    if(uart->dev->int_st.rxfifo_ovf) {
+        uart->stats.fifo_overflows++;
+    }
+
+    uart->dev->int_clr.rxfifo_full = 1;
+    uart->dev->int_clr.frm_err = 1;
+    uart->dev->int_clr.parity_err = 1;
+    uart->dev->int_clr.rxfifo_ovf = 1;
+    uart->dev->int_clr.rxfifo_tout = 1;
+    while(uart->dev->status.rxfifo_cnt || (uart->dev->mem_rx_status.wr_addr != uart->dev->mem_rx_status.rd_addr)) {
+        c = uart->dev->fifo.rw_byte;
+        received = true;
+        uart->stats.rx_bytes++;
+        if(uart->queue != NULL && !xQueueIsQueueFullFromISR(uart->queue)) {
+            xQueueSendFromISR(uart->queue, &c, &xHigherPriorityTaskWoken);
+        } else {
+            uart->stats.queue_drops++;
         }
     }
+    if(received) {
+        uart->stats.rx_time_us = (uint32_t)esp_timer_get_time();
+    }
+
+    cycles = _uart_ccount() - cycles;
+    uart->stats.isr_count++;
+    uart->stats.isr_cycles += cycles;
+    if(cycles > uart->stats.isr_cycles_max) {
+        uart->stats.isr_cycles_max = cycles;
+    }
 
     if (xHigherPriorityTaskWoken) {
         portYIELD_FROM_ISR();
     }
 }
 
+static void _uart_intr_alloc(void *arg)
+{
+    uart_t* uart = (uart_t*)arg;
+    esp_intr_alloc(UART_INTR_SOURCE(uart->num), (int)ESP_INTR_FLAG_IRAM, _uart_isr, uart, &uart->intr_handle);
+    uart->intr_alloc_core = xPortGetCoreID();
+}
+
+/*
+ * Interrupts are serviced by the core they were allocated on : when a core is
+ * requested, the allocation is done from that core.
+ */
+static void _uart_intr_alloc_on_core(uart_t* uart)
+{
+    if(uart->intr_core >= 0 && uart->intr_core != xPortGetCoreID()) {
+        esp_ipc_call_blocking(uart->intr_core, _uart_intr_alloc, uart);
+    } else {
+        _uart_intr_alloc(uart);
+    }
+}
+
+typedef struct {
+    intr_handle_t handle;
+    esp_err_t err;
+} uart_intr_free_t;
+
+static void _uart_intr_free(void *arg)
+{
+    uart_intr_free_t* req = (uart_intr_free_t*)arg;
+    req->err = esp_intr_free(req->handle);
+}
+
+/*
+ * esp_intr_free() fails on another core than the allocating one : the free is
+ * done from that core. The handle is kept if the interrupt is still allocated.
+ */
+static esp_err_t _uart_intr_free_on_core(uart_t* uart)
+{
+    if(uart->intr_handle == NULL) {
+        return ESP_OK;
+    }
+    uart_intr_free_t req = { uart->intr_handle, ESP_OK };
+    if(uart->intr_alloc_core != xPortGetCoreID()) {
+        esp_ipc_call_blocking(uart->intr_alloc_core, _uart_intr_free, &req);
+    } else {
+        _uart_intr_free(&req);
+    }
+    if(req.err != ESP_OK) {
+        log_e("UART%d interrupt not freed on core %d: %d", uart->num, uart->intr_alloc_core, req.err);
+        return req.err;
+    }
+    uart->intr_handle = NULL;
+    return ESP_OK;
+}
+
 void uartEnableInterrupt(uart_t* uart)
 {
     UART_MUTEX_LOCK();
-    uart->dev->conf1.rxfifo_full_thrhd = 112;
-    uart->dev->conf1.rx_tout_thrhd = 2;
-    uart->dev->conf1.rx_tout_en = 1;
+    uart->dev->conf1.rxfifo_full_thrhd = uart->rx_fifo_full_thrhd;
+    uart->dev->conf1.rx_tout_thrhd = uart->rx_tout_thrhd;
+    uart->dev->conf1.rx_tout_en = (uart->rx_tout_thrhd != 0);
     uart->dev->int_ena.rxfifo_full = 1;
     uart->dev->int_ena.frm_err = 1;
+    uart->dev->int_ena.parity_err = 1;
+    uart->dev->int_ena.rxfifo_ovf = 1;
     uart->dev->int_ena.rxfifo_tout = 1;
     uart->dev->int_clr.val = 0xffffffff;
 
-    esp_intr_alloc(UART_INTR_SOURCE(uart->num), (int)ESP_INTR_FLAG_IRAM, _uart_isr, NULL, &uart->intr_handle);
+    _uart_intr_alloc_on_core(uart);
     UART_MUTEX_UNLOCK();
 }
 
@@ -118,8 +221,7 @@ void uartDisableInterrupt(uart_t* uart)
     uart->dev->int_ena.val = 0;
     uart->dev->int_clr.val = 0xffffffff;
 
-    esp_intr_free(uart->intr_handle);
-    uart->intr_handle = NULL;
+    _uart_intr_free_on_core(uart);
 
     UART_MUTEX_UNLOCK();
 }
@@ -244,6 +346,8 @@ void uartSetIrqIdleTrigger(uart_t * uart, uint8_t nbByte)
         uart->dev->idle_conf.tx_brk_num = 0;
         uart->dev->conf1.rxfifo_full_thrhd = 1;
         uart->dev->conf1.rx_tout_thrhd = 1;
+        uart->rx_fifo_full_thrhd = 1;
+        uart->rx_tout_thrhd = 1;
     } else
     {
         uart->dev->idle_conf.rx_idle_thrhd = 1;
@@ -251,6 +355,129 @@ void uartSetIrqIdleTrigger(uart_t * uart, uint8_t nbByte)
     }
 }
 
+/*
+ * RX interrupt triggers : the FIFO full threshold raises the interrupt as soon as
+ * that many bytes are received, the timeout raises it when the line stays idle
+ * for that many symbol (one byte) times after the last received byte.
+ * A timeout of 0 disables it. Unlike uartSetIrqIdleTrigger(), TX is left untouched.
+ */
+void uartSetRxTimeout(uart_t* uart, uint8_t symbols)
+{
+    if(uart == NULL) {
+        return;
+    }
+    if(symbols > 127) {
+        symbols = 127;
+    }
+    uart->rx_tout_thrhd = symbols;
+    uart->dev->conf1.rx_tout_thrhd = symbols;
+    uart->dev->conf1.rx_tout_en = (symbols != 0);
+}
+
+void uartSetRxFifoFull(uart_t* uart, uint8_t threshold)
+{
+    if(uart == NULL) {
+        return;
+    }
+    if(threshold < 1) {
+        threshold = 1;
+    } else if(threshold > 127) {
+        threshold = 127;
+    }
+    uart->rx_fifo_full_thrhd = threshold;
+    uart->dev->conf1.rxfifo_full_thrhd = threshold;
+}
+
+/*
+ * Adaptive mode : the caller sets the length of the reply it waits for before
+ * sending the request, so a complete reply raises a single interrupt on its last
+ * byte. Shorter replies (errors) are still delivered by the timeout.
+ */
+void uartSetRxExpectedLength(uart_t* uart, uint8_t len)
+{
+    if(uart == NULL) {
+        return;
+    }
+    if(len < 1) {
+        len = 1;
+    } else if(len > 127) {
+        len = 127;
+    }
+    uart->dev->conf1.rxfifo_full_thrhd = len;
+}
+
+uint8_t uartGetRxTimeout(uart_t* uart)
+{
+    if(uart == NULL) {
+        return 0;
+    }
+    return uart->rx_tout_thrhd;
+}
+
+uint8_t uartGetRxFifoFull(uart_t* uart)
+{
+    if(uart == NULL) {
+        return 0;
+    }
+    return uart->dev->conf1.rxfifo_full_thrhd;
+}
+
+void uartSetInterruptCore(uint8_t uart_nr, int8_t core)
+{
+    if(uart_nr > 2) {
+        return;
+    }
+    uart_t* uart = &_uart_bus_array[uart_nr];
+
+#if !CONFIG_DISABLE_HAL_LOCKS
+    // not started : no lock nor interrupt yet, uartEnableInterrupt() allocates on this core
+    if(uart->lock == NULL) {
+        uart->intr_core = core;
+        return;
+    }
+#endif
+
+    UART_MUTEX_LOCK();
+    // already running : move the interrupt to the requested core, or keep it where it is
+    if(uart->intr_handle != NULL) {
+        if(_uart_intr_free_on_core(uart) != ESP_OK) {
+            UART_MUTEX_UNLOCK();
+            return;
+        }
+        uart->intr_core = core;
+        _uart_intr_alloc_on_core(uart);
+    } else {
+        uart->intr_core = core;
+    }
+    UART_MUTEX_UNLOCK();
+}
+
+void uartSetIsrHook(uart_t* uart, uart_isr_hook_t hook)
+{
+    if(uart == NULL) {
+        return;
+    }
+    uart->isr_hook = hook;
+}
+
+void uartGetStats(uart_t* uart, uart_stats_t* stats)
+{
+    if(uart == NULL || stats == NULL) {
+        return;
+    }
+    *stats = uart->stats;
+}
+
+void uartResetStats(uart_t* uart)
+{
+    if(uart == NULL) {
+        return;
+    }
+    uint32_t rx_time_us = uart->stats.rx_time_us;
+    memset(&uart->stats, 0, sizeof(uart_stats_t));
+    uart->stats.rx_time_us = rx_time_us;
+}
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
@@ -342,6 +569,7 @@ void uartWrite(uart_t* uart, uint8_t c)
     UART_MUTEX_LOCK();
     while(uart->dev->status.txfifo_cnt == 0x7F);
     uart->dev->fifo.rw_byte = c;
+    uart->stats.tx_bytes++;
     UART_MUTEX_UNLOCK();
 }
 
@@ -351,6 +579,7 @@ void uartWriteBuf(uart_t* uart, const uint8_t * data, size_t len)
         return;
     }
     UART_MUTEX_LOCK();
+    uart->stats.tx_bytes += len;
     while(len) {
         while(uart->dev->status.txfifo_cnt == 0x7F);
         uart->dev->fifo.rw_byte = *data++;
@@ -381,6 +610,15 @@ void uartFlush(uart_t* uart)
     UART_MUTEX_UNLOCK();
 }
 
+// TX FIFO and shift register empty, unlike uartFlush() the RX side is kept
+void uartWaitTxIdle(uart_t* uart)
+{
+    if(uart == NULL) {
+        return;
+    }
+    while(uart->dev->status.txfifo_cnt || uart->dev->status.st_utx_out);
+}
+
 void uartSetBaudRate(uart_t* uart, uint32_t baud_rate)
 {
     if(uart == NULL) {
@@ -396,9 +634,15 @@ void uartSetBaudRate(uart_t* uart, uint32_t baud_rate)
 static void uart_on_apb_change(void * arg, apb_change_ev_t ev_type, uint32_t old_apb, uint32_t new_apb)
 {
     uart_t* uart = (uart_t*)arg;
+    // CPU frequency change keeping the APB clock (240 / 160 / 80 MHz) : the
+    // divider stays valid, keep receiving and sending through the change
+    if(old_apb == new_apb){
+        return;
+    }
     if(ev_type == APB_BEFORE_CHANGE){
         UART_MUTEX_LOCK();
         //disabple interrupt
+        uart->int_ena_apb = uart->dev->int_ena.val;
         uart->dev->int_ena.val = 0;
         uart->dev->int_clr.val = 0xffffffff;
         // read RX fifo
@@ -406,8 +650,12 @@ static void uart_on_apb_change(void * arg, apb_change_ev_t ev_type, uint32_t old
         BaseType_t xHigherPriorityTaskWoken;
         while(uart->dev->status.rxfifo_cnt != 0 || (uart->dev->mem_rx_status.wr_addr != uart->dev->mem_rx_status.rd_addr)) {
             c = uart->dev->fifo.rw_byte;
+            uart->stats.rx_bytes++;
+            uart->stats.rx_time_us = (uint32_t)esp_timer_get_time();
             if(uart->queue != NULL && !xQueueIsQueueFullFromISR(uart->queue)) {
                 xQueueSendFromISR(uart->queue, &c, &xHigherPriorityTaskWoken);
+            } else {
+                uart->stats.queue_drops++;
             }
         }
         // wait TX empty
@@ -421,10 +669,8 @@ static void uart_on_apb_change(void * arg, apb_change_ev_t ev_type, uint32_t old
         uart->dev->clk_div.div_int = clk_div>>4 ;
         uart->dev->clk_div.div_frag = clk_div & 0xf;
         //enable interrupts
-        uart->dev->int_ena.rxfifo_full = 1;
-        uart->dev->int_ena.frm_err = 1;
-        uart->dev->int_ena.rxfifo_tout = 1;
         uart->dev->int_clr.val = 0xffffffff;
+        uart->dev->int_ena.val = uart->int_ena_apb;
         UART_MUTEX_UNLOCK();
     }
 }
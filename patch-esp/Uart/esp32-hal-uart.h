@@ -51,6 +51,22 @@ extern "C" {
 struct uart_struct_t;
 typedef struct uart_struct_t uart_t;
 
+typedef struct {
+    uint32_t isr_count;         // interrupts serviced
+    uint32_t isr_cycles;        // CPU cycles spent in the interrupt handler
+    uint32_t isr_cycles_max;    // longest interrupt handler run, in CPU cycles
+    uint32_t rx_time_us;        // esp_timer time of the last interrupt that received bytes
+    uint32_t rx_bytes;          // bytes read from the RX FIFO
+    uint32_t tx_bytes;          // bytes written to the TX FIFO
+    uint32_t frame_errors;      // framing errors (bad stop bit)
+    uint32_t parity_errors;     // parity errors
+    uint32_t fifo_overflows;    // RX FIFO overflows, bytes lost in hardware
+    uint32_t queue_drops;       // bytes lost because the RX queue was full
+} uart_stats_t;
+
+// called on each interrupt entry, must be in IRAM
+typedef void (*uart_isr_hook_t)(uint8_t uart_nr);
+
 uart_t* uartBegin(uint8_t uart_nr, uint32_t baudrate, uint32_t config, int8_t rxPin, int8_t txPin, uint16_t queueLen, bool inverted);
 void uartEnd(uart_t* uart);
 
@@ -63,6 +79,7 @@ void uartWrite(uart_t* uart, uint8_t c);
 void uartWriteBuf(uart_t* uart, const uint8_t * data, size_t len);
 
 void uartFlush(uart_t* uart);
+void uartWaitTxIdle(uart_t* uart);
 
 void uartSetBaudRate(uart_t* uart, uint32_t baud_rate);
 uint32_t uartGetBaudRate(uart_t* uart);
@@ -83,6 +100,21 @@ bool uartRxActive(uart_t* uart);
 
 void uartSetIrqIdleTrigger(uart_t * uart, uint8_t nbByte);
 
+// RX interrupt triggers, see esp32-hal-uart.c
+void uartSetRxTimeout(uart_t* uart, uint8_t symbols);
+void uartSetRxFifoFull(uart_t* uart, uint8_t threshold);
+void uartSetRxExpectedLength(uart_t* uart, uint8_t len);
+uint8_t uartGetRxTimeout(uart_t* uart);
+uint8_t uartGetRxFifoFull(uart_t* uart);
+
+// core servicing the UART interrupt, -1 for the core calling uartBegin()
+void uartSetInterruptCore(uint8_t uart_nr, int8_t core);
+
+void uartSetIsrHook(uart_t* uart, uart_isr_hook_t hook);
+
+void uartGetStats(uart_t* uart, uart_stats_t* stats);
+void uartResetStats(uart_t* uart);
+
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
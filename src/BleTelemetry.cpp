@@ -0,0 +1,285 @@
+// *******************************************************************
+//  SmartESC BLE telemetry service
+// *******************************************************************
+
+#include "BleTelemetry.h"
+
+#if BLE_TELEMETRY
+
+#include <BLEDevice.h>
+#include <BLEServer.h>
+#include <BLE2902.h>
+#include <BLESecurity.h>
+#include <Preferences.h>
+#include "Telemetry.h"
+#include "TelemetryPacker.h"
+#include "TelemetryStats.h"
+
+BleTelemetry bleTelemetry;
+
+static BLECharacteristic *telemetryCharacteristic = NULL;
+static BLE2902 *telemetryCccd = NULL;
+
+#if TELEMETRY_STATS
+// window summary read on demand, the window is written by the client
+class BleStatsCallbacks : public BLECharacteristicCallbacks
+{
+  void onWrite(BLECharacteristic *characteristic)
+  {
+    std::string value = characteristic->getValue();
+    if (value.length() == 1)
+      window = value[0] < STATS_WINDOWS ? value[0] : STATS_WINDOW_RIDE;
+  }
+
+  void onRead(BLECharacteristic *characteristic)
+  {
+    StatsReport report;
+    telemetryStats.read(window, report);
+    characteristic->setValue((uint8_t *)&report, sizeof(report));
+  }
+
+  uint8_t window = STATS_WINDOW_RIDE;
+};
+#endif
+
+class BleTelemetryServerCallbacks : public BLEServerCallbacks
+{
+  void onConnect(BLEServer *server)
+  {
+    bleTelemetry.connected = true;
+  }
+
+  void onDisconnect(BLEServer *server)
+  {
+    bleTelemetry.connected = false;
+    bleTelemetry.encrypted = false;
+    bleTelemetry.mtu = 23;
+
+    // advertising stops on connection
+    BLEDevice::startAdvertising();
+  }
+};
+
+// static PIN on the first pairing only, a bonded phone just restores encryption
+class BleTelemetrySecurityCallbacks : public BLESecurityCallbacks
+{
+  uint32_t onPassKeyRequest()
+  {
+    return BLE_PIN;
+  }
+
+  void onPassKeyNotify(uint32_t passKey)
+  {
+    bleTelemetry.paired = true;
+  }
+
+  bool onConfirmPIN(uint32_t pin)
+  {
+    bleTelemetry.paired = true;
+    return pin == BLE_PIN;
+  }
+
+  bool onSecurityRequest()
+  {
+    return true;
+  }
+
+  void onAuthenticationComplete(esp_ble_auth_cmpl_t cmpl)
+  {
+    if (!cmpl.success)
+    {
+      Serial.printf("BLE : authentication failed, reason = %02x\n", cmpl.fail_reason);
+      return;
+    }
+
+    bleTelemetry.timeEncryptedMs = millis();
+    bleTelemetry.encrypted = true;
+
+    // a bonded client expects its notifications state to be kept
+    if (!bleTelemetry.paired && bleTelemetry.notifyBonded)
+      telemetryCccd->setNotifications(true);
+  }
+};
+
+// connection time, peer address and negotiated MTU, BLEServer does not report them
+static void gattsHandler(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t *param)
+{
+  if (event == ESP_GATTS_CONNECT_EVT)
+  {
+    bleTelemetry.timeConnectMs = millis();
+    bleTelemetry.timeFirstNotifyMs = 0;
+    bleTelemetry.paired = false;
+    bleTelemetry.connInterval = 0;
+    memcpy(bleTelemetry.peer, param->connect.remote_bda, sizeof(esp_bd_addr_t));
+  }
+  else if (event == ESP_GATTS_MTU_EVT)
+  {
+    bleTelemetry.mtu = param->mtu.mtu;
+  }
+}
+
+static void gapHandler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+  if ((event == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT) && (param->update_conn_params.status == ESP_BT_STATUS_SUCCESS))
+    bleTelemetry.connInterval = param->update_conn_params.conn_int;
+}
+
+void BleTelemetry::begin()
+{
+  Preferences preferences;
+  preferences.begin(NVS_NAMESPACE, true);
+  notifyBonded = preferences.getBool(BLE_NVS_KEY_NOTIFY, false);
+  preferences.end();
+
+  BLEDevice::init(BLE_DEVICE_NAME);
+  BLEDevice::setMTU(BLE_TELEMETRY_MTU);
+  BLEDevice::setCustomGattsHandler(gattsHandler);
+  BLEDevice::setCustomGapHandler(gapHandler);
+
+  // encryption starts on connection : LTK of the bond if any, static PIN pairing otherwise.
+  // Keys are stored in NVS by the BT stack, the IRK resolves the phone private address.
+  BLEDevice::setEncryptionLevel(ESP_BLE_SEC_ENCRYPT_MITM);
+  BLEDevice::setSecurityCallbacks(new BleTelemetrySecurityCallbacks());
+  BLESecurity *security = new BLESecurity();
+  security->setStaticPIN(BLE_PIN);
+  security->setAuthenticationMode(ESP_LE_AUTH_REQ_SC_MITM_BOND);
+  security->setInitEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+  security->setRespEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+
+  BLEServer *server = BLEDevice::createServer();
+  server->setCallbacks(new BleTelemetryServerCallbacks());
+
+  BLEService *service = server->createService(BLE_TELEMETRY_SERVICE_UUID);
+  telemetryCharacteristic = service->createCharacteristic(BLE_TELEMETRY_CHAR_UUID, BLECharacteristic::PROPERTY_NOTIFY);
+  telemetryCharacteristic->setAccessPermissions(ESP_GATT_PERM_READ_ENC_MITM);
+  telemetryCccd = new BLE2902();
+  telemetryCccd->setAccessPermissions(ESP_GATT_PERM_READ_ENC_MITM | ESP_GATT_PERM_WRITE_ENC_MITM);
+  telemetryCharacteristic->addDescriptor(telemetryCccd);
+#if TELEMETRY_STATS
+  BLECharacteristic *statsCharacteristic = service->createCharacteristic(BLE_STATS_CHAR_UUID,
+                                                                         BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
+  statsCharacteristic->setAccessPermissions(ESP_GATT_PERM_READ_ENC_MITM | ESP_GATT_PERM_WRITE_ENC_MITM);
+  statsCharacteristic->setCallbacks(new BleStatsCallbacks());
+#endif
+  service->start();
+
+  BLEAdvertising *advertising = BLEDevice::getAdvertising();
+  advertising->addServiceUUID(BLE_TELEMETRY_SERVICE_UUID);
+  advertising->setScanResponse(true);
+  BLEDevice::startAdvertising();
+
+  xTaskCreatePinnedToCore(task, "bleTelemetry", BLE_TELEMETRY_TASK_STACK, this,
+                          BLE_TELEMETRY_TASK_PRIORITY, &taskHandle, BLE_TELEMETRY_TASK_CORE);
+
+  Serial.printf("BLE telemetry : advertising as %s / %d bonded device(s)\n", BLE_DEVICE_NAME, esp_ble_get_bond_device_num());
+}
+
+// short interval while the dashboard shows the telemetry, long one when idle
+void BleTelemetry::setConnectionSpeed(bool fast)
+{
+  esp_ble_conn_update_params_t params;
+
+  memcpy(params.bda, peer, sizeof(esp_bd_addr_t));
+  params.min_int = fast ? BLE_CONN_FAST_INTERVAL : BLE_CONN_SLOW_INTERVAL;
+  params.max_int = params.min_int;
+  params.latency = fast ? 0 : BLE_CONN_SLOW_LATENCY;
+  params.timeout = BLE_CONN_TIMEOUT;
+  esp_ble_gap_update_conn_params(&params);
+}
+
+// keep the notifications state of the bonded client across reconnections and reboots
+void BleTelemetry::saveNotifyState(bool enabled)
+{
+  if (enabled == notifyBonded)
+    return;
+  notifyBonded = enabled;
+
+  Preferences preferences;
+  preferences.begin(NVS_NAMESPACE, false);
+  preferences.putBool(BLE_NVS_KEY_NOTIFY, enabled);
+  preferences.end();
+}
+
+void BleTelemetry::task(void *arg)
+{
+  BleTelemetry *ble = (BleTelemetry *)arg;
+  TelemetryPacker packer;
+  TelemetrySnapshot snapshot;
+  unsigned long timeBatch = 0;
+  bool subscribed = false;
+  bool wasConnected = false;
+  TickType_t wakeTime = xTaskGetTickCount();
+
+  while (true)
+  {
+    vTaskDelayUntil(&wakeTime, BLE_TELEMETRY_PERIOD / portTICK_PERIOD_MS);
+
+    bool connected = ble->connected && ble->encrypted;
+    bool notify = connected && telemetryCccd->getNotifications();
+
+    if (connected && (notify != subscribed || !wasConnected))
+    {
+      ble->setConnectionSpeed(notify);
+      ble->saveNotifyState(notify);
+    }
+    subscribed = notify;
+    wasConnected = connected;
+
+    // nobody listens : no sampling, next batch starts fresh
+    if (!notify)
+    {
+      packer.reset();
+      continue;
+    }
+
+    packer.setPayloadSize(ble->mtu - 3);
+    telemetry.read(snapshot);
+    ble->samples++;
+
+    bool full = !packer.add(snapshot);
+    if (packer.count() == 1)
+      timeBatch = millis();
+
+    // first notification after a connection : flush at once
+    if (full || (millis() - timeBatch >= BLE_TELEMETRY_FLUSH) || (ble->timeFirstNotifyMs == 0))
+    {
+      telemetryCharacteristic->setValue((uint8_t *)packer.data(), packer.size());
+      telemetryCharacteristic->notify();
+      ble->notifications++;
+      ble->bytes += packer.size();
+
+      if (ble->timeFirstNotifyMs == 0)
+      {
+        ble->timeFirstNotifyMs = millis();
+        Serial.printf("BLE : %s, encrypted after %d ms, first notification after %d ms\n",
+                      ble->paired ? "paired" : "bonded", ble->timeEncryptedMs - ble->timeConnectMs,
+                      ble->timeFirstNotifyMs - ble->timeConnectMs);
+      }
+
+      packer.reset();
+      if (full)
+      {
+        packer.add(snapshot);
+        timeBatch = millis();
+      }
+    }
+  }
+}
+
+void BleTelemetry::printStats(unsigned long period)
+{
+  Serial.printf("BLE : %s / mtu = %d / interval = %d.%02d ms / %d samples/s / %d notifications/s / %d B/s / %d.%02d B per sample\n",
+                connected ? (encrypted ? "encrypted" : "connected") : "advertising", mtu,
+                connInterval * 125 / 100, (connInterval * 125) % 100,
+                samples * 1000 / period, notifications * 1000 / period, bytes * 1000 / period,
+                samples ? bytes / samples : 0, samples ? (bytes * 100 / samples) % 100 : 0);
+  if (timeFirstNotifyMs != 0)
+    Serial.printf("   last connection : %s / encrypted after %d ms / first notification after %d ms\n",
+                  paired ? "paired" : "bonded", timeEncryptedMs - timeConnectMs, timeFirstNotifyMs - timeConnectMs);
+
+  samples = 0;
+  notifications = 0;
+  bytes = 0;
+}
+
+#endif
@@ -0,0 +1,70 @@
+// *******************************************************************
+//  SmartESC BLE telemetry service
+//
+//  GATT service streaming the telemetry snapshot to a phone. Samples
+//  are taken every BLE_TELEMETRY_PERIOD by a low priority task on the
+//  BT core and batched by TelemetryPacker in notifications as large
+//  as the negotiated MTU. Nothing is sampled or sent while no client
+//  has enabled the notifications.
+//
+//  The first connection pairs with the static PIN and bonds, the keys
+//  stay in NVS : a bonded phone reconnects with encryption only, and
+//  finds its notifications still enabled. The connection interval is
+//  short while notifications are enabled, long otherwise.
+//
+//  With TELEMETRY_STATS, a second characteristic reads the StatsReport
+//  of one window : write the window (0 : 1 s, 1 : 10 s, 2 : ride, the
+//  default), then read.
+// *******************************************************************
+
+#ifndef BLE_TELEMETRY_H_
+#define BLE_TELEMETRY_H_
+
+#include <Arduino.h>
+#include "config.h"
+
+#if BLE_TELEMETRY
+
+#define BLE_TELEMETRY_SERVICE_UUID "c9a5b0d5-b9f6-40c9-8605-ce89718aed00"
+#define BLE_TELEMETRY_CHAR_UUID "9ce7b44f-7a88-40f1-9412-476af4b2d20d"
+#define BLE_STATS_CHAR_UUID "b0ab3d44-1349-4138-a010-5fefeda0f7ff" // TELEMETRY_STATS summary, see TelemetryStats.h
+
+class BleTelemetry
+{
+public:
+  void begin();
+
+  void printStats(unsigned long period);
+
+  // updated by the BT stack callbacks
+  volatile uint16_t mtu = 23;
+  volatile uint16_t connInterval = 0; // [1.25 ms]
+  volatile bool connected = false;
+  volatile bool encrypted = false;
+  volatile bool paired = false; // PIN pairing in this connection, bonded reconnect otherwise
+  volatile bool notifyBonded = false;
+  uint8_t peer[6];
+
+  // reconnection to first notification time
+  volatile unsigned long timeConnectMs = 0;
+  volatile unsigned long timeEncryptedMs = 0;
+  volatile unsigned long timeFirstNotifyMs = 0;
+
+  // updated by the BLE task
+  volatile uint32_t samples = 0;
+  volatile uint32_t notifications = 0;
+  volatile uint32_t bytes = 0;
+
+  TaskHandle_t taskHandle = NULL;
+
+private:
+  void setConnectionSpeed(bool fast);
+  void saveNotifyState(bool enabled);
+  static void task(void *arg);
+};
+
+extern BleTelemetry bleTelemetry;
+
+#endif
+
+#endif
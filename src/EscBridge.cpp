@@ -0,0 +1,272 @@
+// *******************************************************************
+//  SmartESC USB bridge
+// *******************************************************************
+
+#include "EscBridge.h"
+#include "LinkCapture.h"
+
+#if ESC_BRIDGE
+
+EscBridge escBridge;
+
+void EscBridge::start(HardwareSerial &hostSerial, EscLink &escLink, uint32_t timeUs)
+{
+  if (active)
+    return;
+
+  host = &hostSerial;
+  link = &escLink;
+
+  // the session stops here, its last reply is dropped
+  link->restartSession(millis());
+  delay(BRIDGE_REPLY_TIMEOUT);
+  while (link->serial.available())
+    link->serial.read();
+
+  hostBytes = 0;
+  batchUsed = 0;
+  escBytes = 0;
+  inFlight = 0;
+  ownMask = 0;
+  braking = false;
+  hostFrames = 0;
+  hostErrors = 0;
+  escFrames = 0;
+  escErrors = 0;
+  escTimeouts = 0;
+  overrides = 0;
+  zeroTorques = 0;
+  batches = 0;
+
+  Serial.printf("bridge : M%d at %d bauds, send 0x%02x to leave\n", link->id, link->baudRate, BRIDGE_EXIT);
+  Serial.flush();
+
+  active = true;
+  timeStartUs = timeUs;
+  timeHostUs = timeUs;
+  zeroTorque(timeUs);
+}
+
+void EscBridge::stop(uint32_t timeUs)
+{
+  flush(timeUs);
+  active = false;
+
+  Serial.printf("bridge : left after %d ms / host %d frames, %d errors / ESC %d frames, %d errors, %d timeouts / %d batches / %d overrides / %d zero torques\n",
+                (timeUs - timeStartUs) / 1000, hostFrames, hostErrors, escFrames, escErrors, escTimeouts,
+                batches, overrides, zeroTorques);
+
+  // the host left the ESC in an unknown state
+  link->restartSession(millis());
+}
+
+void EscBridge::update(uint32_t timeUs, bool brake)
+{
+  if (!active)
+    return;
+
+  readHost(timeUs, brake);
+  if (!active)
+    return;
+
+  readEsc(timeUs);
+
+  // no reply : the requests in flight are lost, so is a partial reply
+  if ((inFlight > 0) && (timeUs - timeEscUs > BRIDGE_REPLY_TIMEOUT * 1000UL))
+  {
+    escTimeouts += inFlight;
+    inFlight = 0;
+    ownMask = 0;
+    escBytes = 0;
+  }
+
+  // every forwarded request answered, or the oldest record waited long enough
+  if ((batchUsed > 0) && ((inFlight == 0) || (timeUs - timeBatchUs >= BRIDGE_FLUSH * 1000UL)))
+    flush(timeUs);
+
+  // safety : torque 0 when the brake is pressed, and while the host is quiet
+  if (brake && !braking)
+    zeroTorque(timeUs);
+  braking = brake;
+
+  if ((timeUs - timeHostUs > BRIDGE_HOST_TIMEOUT * 1000UL) && (timeUs - timeZeroUs > BRIDGE_HOST_TIMEOUT * 1000UL))
+    zeroTorque(timeUs);
+}
+
+void EscBridge::readHost(uint32_t timeUs, bool brake)
+{
+  while (host->available())
+  {
+    if (hostBytes == 0)
+    {
+      int c = host->peek();
+      if (c == BRIDGE_EXIT)
+      {
+        host->read();
+        stop(timeUs);
+        return;
+      }
+      if ((c != SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET) && (c != SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET) &&
+          (c != SERIAL_START_FRAME_DISPLAY_TO_ESC_CMD))
+      {
+        host->read();
+        hostErrors++;
+        continue;
+      }
+    }
+
+    // header, then the rest of the frame, as much as is already there
+    size_t need = (hostBytes < 2) ? 2 - hostBytes : hostFrame[1] + 3 - hostBytes;
+    size_t available = host->available();
+    hostBytes += host->readBytes(hostFrame + hostBytes, need < available ? need : available);
+
+    if ((hostBytes == 2) && ((hostFrame[1] == 0) || (hostFrame[1] + 3 > ESC_FRAME_MAX_SIZE)))
+    {
+      hostErrors++;
+      hostBytes = 0;
+      continue;
+    }
+    if ((hostBytes < 2) || (hostBytes < hostFrame[1] + 3))
+      continue;
+
+    uint8_t size = hostBytes;
+    hostBytes = 0;
+    timeHostUs = timeUs;
+
+    if (getCrc(hostFrame, size) != hostFrame[size - 1])
+    {
+      hostErrors++;
+      continue;
+    }
+    hostFrames++;
+
+    // brake pressed : the host torque is replaced by 0, the host still gets its reply
+    if (brake && (hostFrame[0] == SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET) && (hostFrame[2] == FRAME_REG_TORQUE))
+    {
+      for (uint8_t i = 3; i < size - 1; i++)
+        hostFrame[i] = 0;
+      hostFrame[size - 1] = getCrc(hostFrame, size);
+      overrides++;
+    }
+
+    sendEsc(hostFrame, size, false, timeUs);
+  }
+}
+
+void EscBridge::readEsc(uint32_t timeUs)
+{
+  while (link->serial.available())
+  {
+    // room for one more record, the reply is read in place
+    if ((escBytes == 0) && (batchUsed + BRIDGE_RECORD_HEADER + ESC_FRAME_MAX_SIZE > BRIDGE_BATCH_SIZE))
+      flush(timeUs);
+
+    // start byte alone, so that a bad one costs a single byte
+    uint8_t *frame = batch + batchUsed + BRIDGE_RECORD_HEADER;
+    size_t need = (escBytes < 2) ? 1 : frame[1] + 3 - escBytes;
+    size_t available = link->serial.available();
+    escBytes += link->serial.readBytes(frame + escBytes, need < available ? need : available);
+
+    if ((frame[0] != SERIAL_START_FRAME_ESC_TO_DISPLAY_OK) && (frame[0] != SERIAL_START_FRAME_ESC_TO_DISPLAY_ERR))
+    {
+      escErrors++;
+      escBytes = 0;
+      continue;
+    }
+    if ((escBytes == 2) && (frame[1] + 3 > ESC_FRAME_MAX_SIZE))
+    {
+      escErrors++;
+      escBytes = 0;
+      continue;
+    }
+    if ((escBytes < 2) || (escBytes < frame[1] + 3))
+      continue;
+
+    uint8_t size = escBytes;
+    escBytes = 0;
+    timeEscUs = timeUs;
+
+    // replies come in request order
+    bool own = (inFlight > 0) && (ownMask & 1);
+    if (inFlight > 0)
+    {
+      inFlight--;
+      ownMask >>= 1;
+    }
+
+    if (getCrc(frame, size) != frame[size - 1])
+    {
+      escErrors++;
+      continue;
+    }
+
+    // time of the RX interrupt that brought the last byte
+#if PATCHED_ESP32_FWK
+    uint32_t timeRxUs = link->serial.stats().rx_time_us;
+#else
+    uint32_t timeRxUs = timeUs;
+#endif
+
+#if LINK_CAPTURE
+    linkCapture.record(timeRxUs, link->id, LINK_CAPTURE_RX, frame, size);
+#endif
+
+    if (own)
+      continue;
+
+    uint8_t *record = batch + batchUsed;
+    record[0] = BRIDGE_SYNC;
+    record[1] = timeRxUs & 0xff;
+    record[2] = (timeRxUs >> 8) & 0xff;
+    record[3] = (timeRxUs >> 16) & 0xff;
+    record[4] = (timeRxUs >> 24) & 0xff;
+    if (batchUsed == 0)
+      timeBatchUs = timeUs;
+    batchUsed += BRIDGE_RECORD_HEADER + size;
+    escFrames++;
+  }
+}
+
+void EscBridge::sendEsc(uint8_t *frame, uint8_t size, bool own, uint32_t timeUs)
+{
+  link->serial.write(frame, size);
+
+#if LINK_CAPTURE
+  linkCapture.record(timeUs, link->id, LINK_CAPTURE_TX, frame, size);
+#endif
+
+  if (inFlight == 0)
+    timeEscUs = timeUs;
+  if (own && (inFlight < 32))
+    ownMask |= 1UL << inFlight;
+  if (inFlight < 255)
+    inFlight++;
+}
+
+void EscBridge::zeroTorque(uint32_t timeUs)
+{
+  uint8_t frame[ESC_FRAME_MAX_SIZE];
+  uint8_t size = escEncodeSetReg(frame, escRegisterFind(FRAME_REG_TORQUE), 0);
+
+  sendEsc(frame, size, true, timeUs);
+  zeroTorques++;
+  timeZeroUs = timeUs;
+}
+
+// one write for every record of the batch
+void EscBridge::flush(uint32_t timeUs)
+{
+  if (batchUsed == 0)
+    return;
+
+  host->write(batch, batchUsed);
+  batches++;
+
+  // partial reply read after the last record
+  if (escBytes > 0)
+    memmove(batch + BRIDGE_RECORD_HEADER, batch + batchUsed + BRIDGE_RECORD_HEADER, escBytes);
+  batchUsed = 0;
+  timeBatchUs = timeUs;
+}
+
+#endif
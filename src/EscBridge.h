@@ -0,0 +1,95 @@
+// *******************************************************************
+//  SmartESC USB bridge
+//
+//  Development mode : a PC drives the first ESC through the console
+//  UART ('b' on the console). The session of the link is suspended and
+//  the bridge forwards whole frames :
+//
+//    host -> ESC : raw display frames (start, size, datas, checksum),
+//                  checked and written to the ESC UART as received.
+//                  BRIDGE_EXIT at a frame boundary leaves the bridge.
+//    ESC -> host : one record per reply, BRIDGE_SYNC, RX time [us]
+//                  (4 bytes, little endian), then the reply frame.
+//                  Replies are read straight into the batch buffer,
+//                  which goes out in one write once every forwarded
+//                  request is answered, when it is full, or after
+//                  BRIDGE_FLUSH.
+//
+//  Bad frames are dropped and counted on both sides. The control loop
+//  keeps the last word : after BRIDGE_HOST_TIMEOUT without a frame
+//  from the host, or while the brake is pressed, the ESC gets torque 0
+//  (host torque writes are rewritten, their reply still goes back).
+//  Console output other than the records may still interleave, the
+//  sync byte and the checksum let the host skip it.
+// *******************************************************************
+
+#ifndef ESC_BRIDGE_H_
+#define ESC_BRIDGE_H_
+
+#include <Arduino.h>
+#include "config.h"
+#include "EscLink.h"
+
+#if ESC_BRIDGE
+
+#define BRIDGE_SYNC 0xB5 // record header, not a start byte of the ESC frames
+#define BRIDGE_EXIT 0x04 // EOT from the host
+#define BRIDGE_RECORD_HEADER 5
+
+class EscBridge
+{
+public:
+  // takes the link over from its session
+  void start(HardwareSerial &host, EscLink &link, uint32_t timeUs);
+
+  // forwards the pending frames of both sides, zero torque on host silence or brake
+  void update(uint32_t timeUs, bool brake);
+
+  bool isActive() const { return active; }
+
+private:
+  void readHost(uint32_t timeUs, bool brake);
+  void readEsc(uint32_t timeUs);
+  void sendEsc(uint8_t *frame, uint8_t size, bool own, uint32_t timeUs);
+  void zeroTorque(uint32_t timeUs);
+  void flush(uint32_t timeUs);
+  void stop(uint32_t timeUs);
+
+  bool active = false;
+  HardwareSerial *host = NULL;
+  EscLink *link = NULL;
+
+  // frame from the host being received
+  uint8_t hostFrame[ESC_FRAME_MAX_SIZE];
+  uint8_t hostBytes = 0;
+  uint32_t timeHostUs = 0;
+  uint32_t timeZeroUs = 0;
+  bool braking = false;
+
+  // records for the host, the reply being received is written after the last one
+  uint8_t batch[BRIDGE_BATCH_SIZE];
+  uint16_t batchUsed = 0;
+  uint8_t escBytes = 0;
+  uint32_t timeBatchUs = 0;
+
+  // requests without reply, the bridge's own ones are not forwarded
+  uint8_t inFlight = 0;
+  uint32_t ownMask = 0; // bit i : i-th request in flight sent by the bridge
+  uint32_t timeEscUs = 0;
+
+  uint32_t timeStartUs = 0;
+  uint32_t hostFrames = 0;
+  uint32_t hostErrors = 0;
+  uint32_t escFrames = 0;
+  uint32_t escErrors = 0;
+  uint32_t escTimeouts = 0;
+  uint32_t overrides = 0;
+  uint32_t zeroTorques = 0;
+  uint32_t batches = 0;
+};
+
+extern EscBridge escBridge;
+
+#endif
+
+#endif
@@ -0,0 +1,970 @@
+// *******************************************************************
+//  SmartESC serial link
+// *******************************************************************
+
+#include <Preferences.h>
+#include "EscLink.h"
+#include "LinkCapture.h"
+#include "TraceRing.h"
+
+// ascending, negotiation stops at the first rate with errors
+const uint32_t escBaudRates[] = {BAUD_RATE_SMARTESC, 230400, 460800, 921600};
+const uint8_t escBaudRatesCount = sizeof(escBaudRates) / sizeof(escBaudRates[0]);
+
+// console line of every order and reply : printf from the hot path, off by default
+#if DEBUG_SERIAL_ORDERS
+#define LINK_LOG(...) Serial.printf(__VA_ARGS__)
+#else
+#define LINK_LOG(...)
+#endif
+
+#if DEBUG_SERIAL_ORDERS
+static void displayBuffer(uint8_t *buffer, uint8_t size)
+{
+  for (int i = 0; i < size; i++)
+  {
+    Serial.printf("%02x ", buffer[i]);
+  }
+  Serial.printf("\n");
+}
+#endif
+
+EscLink::EscLink(uint8_t id, HardwareSerial &serial) : id(id), serial(serial)
+{
+}
+
+void EscLink::begin(uint32_t baud, int8_t rxPin, int8_t txPin)
+{
+#if PATCHED_ESP32_FWK
+  serial.setInterruptCore(ESC_UART_ISR_CORE);
+#endif
+  serial.begin(baud, SERIAL_8N1, rxPin, txPin);
+  baudRate = baud;
+#if PATCHED_ESP32_FWK
+  serial.setUartIrqIdleTrigger(1);
+  serial.setRxTimeout(ESC_RX_TIMEOUT);
+#if TRACE_EVENTS
+  serial.setIsrHook(traceUartIsr);
+#endif
+#endif
+}
+
+// ########################## SEND ##########################
+
+void HOT_PATH_ATTR EscLink::sendFrame(uint8_t *frame, uint8_t size, uint32_t orderType, uint32_t orderValue)
+{
+#if DEBUG_SERIAL_ORDERS
+  displayBuffer(frame, size);
+#endif
+
+#if PATCHED_ESP32_FWK && ESC_RX_ADAPTIVE
+  // wake up once the whole reply is received
+  serial.setRxExpectedLength(escReplySize(orderType, orderValue));
+#endif
+
+  // Write to Serial
+  TRACE(TRACE_TX_START, id, orderValue);
+  timeSendUs = micros();
+  serial.write(frame, size);
+  TRACE(TRACE_TX_END, id, size);
+#if LINK_CAPTURE
+  linkCapture.record(timeSendUs, id, LINK_CAPTURE_TX, frame, size);
+#endif
+
+  // store last command
+  lastOrderType = orderType;
+  lastOrderValue = orderValue;
+  expectedAnswers++;
+
+  framesTx++;
+  bytesTx += size;
+}
+
+void HOT_PATH_ATTR EscLink::SendCmd(uint8_t cmd)
+{
+  uint8_t frame[ESC_FRAME_MAX_SIZE];
+  uint8_t size = escEncodeCmd(frame, cmd);
+
+  sendFrame(frame, size, SERIAL_START_FRAME_DISPLAY_TO_ESC_CMD, cmd);
+}
+
+void HOT_PATH_ATTR EscLink::GetReg(uint8_t reg)
+{
+  uint8_t frame[ESC_FRAME_MAX_SIZE];
+  uint8_t size = escEncodeGetReg(frame, reg);
+
+  sendFrame(frame, size, SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET, reg);
+}
+
+void HOT_PATH_ATTR EscLink::SetReg(uint8_t reg, int32_t val)
+{
+  const EscRegister *entry = escRegisterFind(reg);
+  if (entry == NULL)
+  {
+    unknownRegister(reg);
+    return;
+  }
+
+  uint8_t frame[ESC_FRAME_MAX_SIZE];
+  uint8_t size = escEncodeSetReg(frame, entry, val);
+
+  sendFrame(frame, size, SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET, reg);
+}
+
+void EscLink::unknownRegister(uint8_t reg)
+{
+  Serial.printf("   M%d SET REG %02x : unknown register\n", id, reg);
+}
+
+// ########################## RECEIVE ##########################
+
+void HOT_PATH_ATTR EscLink::Receive()
+{
+  uint16_t nbBytes = 0;
+
+  // Check for new data availability in the Serial buffer
+  while (serial.available() && (nbBytes < sizeof(receiveBuffer)))
+  {
+    receiveBuffer[nbBytes] = serial.read();
+    nbBytes++;
+  }
+  if (nbBytes > 0)
+  {
+
+    timeLastReply = millis();
+
+    // time of the last received byte
+#if PATCHED_ESP32_FWK
+    timeRxUs = serial.stats().rx_time_us;
+#else
+    timeRxUs = micros();
+#endif
+
+#if LINK_CAPTURE
+    linkCapture.record(timeRxUs, id, LINK_CAPTURE_RX, receiveBuffer, nbBytes);
+#endif
+
+    uint32_t rtt = micros() - timeSendUs;
+    rttCount++;
+    rttSumUs += rtt;
+    if (rtt > rttMaxUs)
+      rttMaxUs = rtt;
+    rttLastUs = rtt;
+    rttPending = true;
+    bytesRx += nbBytes;
+
+#if PATCHED_ESP32_FWK
+    // time between the RX interrupt and the bytes being read here
+    uint32_t wake = micros() - timeRxUs;
+    wakeCount++;
+    wakeSumUs += wake;
+    if (wake > wakeMaxUs)
+      wakeMaxUs = wake;
+#endif
+
+#if DEBUG_SERIAL
+    // display frame
+    Serial.printf("   M%d received : ", id);
+    for (int i = 0; i < nbBytes; i++)
+    {
+      Serial.printf("%02x ", receiveBuffer[i]);
+    }
+    Serial.println();
+#endif
+
+    int iFrame = 0;
+    bool continueReading = true;
+    uint16_t msgSize = 0;
+    bool isErrorFrame = false;
+    while (continueReading)
+    {
+      msgSize = receiveBuffer[iFrame + 1];
+#if DEBUG_SERIAL
+      Serial.printf("   size = %02x\n", msgSize);
+#endif
+      if (receiveBuffer[iFrame] == SERIAL_START_FRAME_ESC_TO_DISPLAY_OK)
+      {
+        LINK_LOG("   M%d ==> ok", id);
+      }
+      else if (receiveBuffer[iFrame] == SERIAL_START_FRAME_ESC_TO_DISPLAY_ERR)
+      {
+        replyError("KO !!!!!!!!!");
+      }
+
+      const EscRegister *reg = NULL;
+      if (lastOrderType == SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET)
+        reg = escRegisterFind(lastOrderValue);
+
+      if (msgSize == 0)
+      {
+        LINK_LOG("   ===> CMD or REG_SET\n");
+      }
+      else if (msgSize > 4)
+      {
+        replyError("ko (unknonw data) ----------------------------------------");
+        isErrorFrame = true;
+        errorFrames++;
+      }
+      else if ((reg != NULL) && (receiveBuffer[iFrame] == SERIAL_START_FRAME_ESC_TO_DISPLAY_OK))
+      {
+        int32_t value = escDecodeValue(reg, &(receiveBuffer[iFrame + 2]), msgSize);
+        regs.*(reg->storage) = value;
+        LINK_LOG("   ===> %s = %d %s\n", reg->name, value / reg->scale, reg->unit);
+        onRegister(reg->id, value);
+      }
+      else
+      {
+        LINK_LOG("   ===> value = ");
+        for (uint8_t i = 0; i < msgSize; i++)
+          LINK_LOG("%02x ", receiveBuffer[iFrame + 2 + i]);
+        LINK_LOG("\n");
+      }
+
+#if DEBUG_SERIAL
+      Serial.printf("   nbBytes = %d / iFrame = %d / nextIFrame = %d\n", nbBytes, iFrame, msgSize + 3);
+#endif
+      iFrame += msgSize + 3;
+
+#if DEBUG_SERIAL
+      Serial.printf("   next msg : iFrame = %d / msgSize = %02x\n", iFrame, msgSize);
+#endif
+
+      // protection against unexpected datas
+      if ((expectedAnswers > 0) && (!isErrorFrame))
+      {
+        expectedAnswers--;
+        framesRx++;
+        TRACE(TRACE_RX_FRAME, id, lastOrderValue);
+      }
+      else
+      {
+        replyError("unexpected datas !!!");
+      }
+
+      isErrorFrame = false;
+
+      if (iFrame < nbBytes)
+      {
+        continueReading = true;
+#if DEBUG_SERIAL
+        Serial.println("      continue");
+#endif
+      }
+      else
+      {
+        continueReading = false;
+#if DEBUG_SERIAL
+        Serial.println("      stop");
+#endif
+      }
+    }
+
+    LINK_LOG("\n");
+  }
+}
+
+// registers with side effects on the session, value already in regs
+void HOT_PATH_ATTR EscLink::onRegister(uint8_t reg, int32_t value)
+{
+  if (reg == FRAME_REG_STATUS)
+  {
+    if (((value == FAULT_NOW) || (value == FAULT_OVER)) && (state >= 8))
+      statusFault();
+  }
+  else if (reg == FRAME_REG_SPEED_MEASURED)
+  {
+    speedEstimator.update(value, timeRxUs, torque);
+  }
+  else if (reg == FRAME_REG_FLAGS)
+  {
+    // try current and last faults
+    flags = value;
+    if (flags >> 16 == 0)
+      flags = flags & 0xffff;
+    else
+      flags = flags >> 16;
+
+    // decode faults
+    if (flags != 0)
+      flagsFault();
+  }
+}
+
+// rare paths of onRegister(), out of the hot path with their console output
+void EscLink::statusFault()
+{
+  restart(-1);
+  Serial.printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! ERROR !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
+#if LINK_CAPTURE
+  linkCapture.dumpOnFault("fault");
+#endif
+}
+
+void EscLink::flagsFault()
+{
+  Serial.printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! FLASG ERROR !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
+#if LINK_CAPTURE
+  linkCapture.dumpOnFault("flags");
+#endif
+  escPrintFaults(flags);
+}
+
+// rare paths of Receive() and session(), with their console output
+void EscLink::replyError(const char *reason)
+{
+  Serial.printf("   M%d ===> %s\n", id, reason);
+}
+
+void EscLink::motorStopped()
+{
+  Serial.printf("//!\\\\ M%d motor in RUN state in state>9 => error ==> restart at step 0\n", id);
+  restart(-1);
+}
+
+void EscLink::runCycleStart(bool started)
+{
+  if (started)
+    Serial.printf("//!\\\\ M%d motor already started => go to step 8\n", id);
+  Serial.printf("M%d run cycle\n", id);
+}
+
+// ########################## STATE MACHINE ##########################
+
+void HOT_PATH_ATTR EscLink::update(unsigned long timeNow)
+{
+  // no reply received for a long time... restart the session
+  if ((expectedAnswers > 0) && (timeNow > timeLastReply + DELAY_SEND_ERROR))
+    replyTimeout(timeNow);
+
+#if DEBUG_SERIAL_EXPECTED_ANSWERS
+  if (expectedAnswers > 0)
+    Serial.printf("M%d expectedAnswers = %d => wait\n", id, expectedAnswers);
+#endif
+
+#if LINK_STATS
+  uint32_t cycles = xthal_get_ccount();
+  session(timeNow);
+  cycles = xthal_get_ccount() - cycles;
+  resumeCount++;
+  resumeCyclesSum += cycles;
+  if (cycles > resumeCyclesMax)
+    resumeCyclesMax = cycles;
+#else
+  session(timeNow);
+#endif
+}
+
+// rare path of update(), out of the hot path with its console output
+void EscLink::replyTimeout(unsigned long timeNow)
+{
+  Serial.printf("//!\\\\ M%d no reply for %d ms, restart at state 0\n", id, DELAY_SEND_ERROR);
+  restart(-2);
+  expectedAnswers = 0;
+  timeLastReply = timeNow;
+  timeouts++;
+
+#if LINK_CAPTURE
+  linkCapture.dumpOnFault("timeout");
+#endif
+
+#if BAUD_NEGOTIATION
+  // negotiated rate is no longer answered, fall back to the default one
+  if (baudRate != BAUD_RATE_SMARTESC)
+  {
+    Serial.printf("//!\\\\ M%d fallback to %d bauds\n", id, BAUD_RATE_SMARTESC);
+    setBaudRate(BAUD_RATE_SMARTESC);
+    saveBaudRate(BAUD_RATE_SMARTESC);
+  }
+#endif
+}
+
+// the session restarts from its beginning at the next update
+void HOT_PATH_ATTR EscLink::restart(int8_t fromState)
+{
+  state = fromState;
+  torquePending = false;
+#if CRUISE
+  // the ESC may still be in speed mode if the start sequence is skipped
+  if (cruiseActive)
+    controlModePending = true;
+  cruiseActive = false;
+  cruiseWritten = 0;
+#endif
+  PT_INIT(pt);
+  TRACE(TRACE_STATE, id, state);
+}
+
+void EscLink::restartSession(unsigned long timeNow)
+{
+  restart(-1);
+  expectedAnswers = 0;
+  timeLastReply = timeNow;
+  timeNextStep = timeNow;
+}
+
+// previous step answered and its holdoff elapsed, 200 Hz orders max
+bool HOT_PATH_ATTR EscLink::stepReady(unsigned long timeNow)
+{
+  return (expectedAnswers == 0) && ((long)(timeNow - timeNextStep) >= 0);
+}
+
+// a torque write preempts the diagnostic polls of the run cycle
+bool HOT_PATH_ATTR EscLink::preemptReady()
+{
+  return torqueRequested && isRunning() && (expectedAnswers == 0);
+}
+
+uint32_t EscLink::idleTime(unsigned long timeNow)
+{
+  // a silent ESC (powered off) only holds the CPU for POWER_REPLY_WAIT, then until the timeout
+  if (expectedAnswers > 0)
+  {
+    if (micros() - timeSendUs < POWER_REPLY_WAIT * 1000UL)
+      return 0;
+    long timeout = (long)(timeLastReply + DELAY_SEND_ERROR - timeNow);
+    return timeout > 0 ? timeout : 0;
+  }
+
+  long next = (long)(timeNextStep - timeNow);
+  return next > 0 ? next : 0;
+}
+
+bool EscLink::takeRtt(uint32_t &rttUs)
+{
+  if (!rttPending)
+    return false;
+  rttPending = false;
+  rttUs = rttLastUs;
+  return true;
+}
+
+void HOT_PATH_ATTR EscLink::enterState(int8_t newState, unsigned long timeNow)
+{
+  state = newState;
+  timeNextStep = timeNow + stepDelay;
+#if DEBUG_SERIAL_EXPECTED_ANSWERS
+  Serial.printf("M%d next state = %d\n", id, state);
+#endif
+  TRACE(TRACE_STATE, id, state);
+}
+
+// wait for the previous step, then enter the next one
+#define SESSION_STEP(n)                 \
+  PT_WAIT_UNTIL(pt, stepReady(timeNow)); \
+  enterState(n, timeNow)
+
+// wait between two orders of the same step, replies are not awaited
+#define SESSION_HOLDOFF(ms)                                        \
+  timeNextStep = timeNow + (ms);                                   \
+  PT_WAIT_UNTIL(pt, (long)(timeNow - timeNextStep) >= 0)
+
+// wait for the previous step of the run cycle, torque writes may preempt it
+#define SESSION_RUN_WAIT() PT_SPAWN(pt, ptRunWait, runWait(timeNow))
+
+// the motor stopped while in the run cycle : restart at state 0 now
+#define SESSION_CHECK_RUN()                                                                 \
+  if (regs.status != RUN)                                                                   \
+  {                                                                                         \
+    motorStopped();                                                                         \
+    return session(timeNow);                                                                \
+  }
+
+int8_t HOT_PATH_ATTR EscLink::runWait(unsigned long timeNow)
+{
+  PT_BEGIN(ptRunWait);
+
+  PT_WAIT_UNTIL(ptRunWait, stepReady(timeNow) || preemptReady());
+
+  // one torque step inserted between two polls, the scheduler sends it
+  if (preemptReady())
+  {
+    preemptedState = state;
+    enterState(10, timeNow);
+    torquePending = true;
+    PT_WAIT_WHILE(ptRunWait, torquePending);
+    PT_WAIT_UNTIL(ptRunWait, stepReady(timeNow));
+    state = preemptedState;
+  }
+
+  PT_END(ptRunWait);
+}
+
+// run cycle states : polls 8-9, torque 10, polls 11-13, slow polls 14, cruise 15-18
+static_assert((ESC_POLL_CYCLE_COUNT <= 2) && (ESC_POLL_SLOW_COUNT <= 1), "run cycle states to renumber for more polls");
+
+void HOT_PATH_ATTR EscLink::pollRegister(const EscRegister *reg)
+{
+  LINK_LOG("M%d %d / send : GET REG %s : ", id, state, reg->name);
+  GetReg(reg->id);
+}
+
+int8_t HOT_PATH_ATTR EscLink::session(unsigned long timeNow)
+{
+  PT_BEGIN(pt);
+
+  // restarted after a timeout : read the speed first
+  if (state == -2)
+  {
+    SESSION_STEP(-1);
+    LINK_LOG("M%d %d / send : GET REG FRAME_REG_SPEED_MEASURED : ", id, state);
+    GetReg(FRAME_REG_SPEED_MEASURED);
+  }
+
+  // restarted after a fault : read the motor status first
+  if (state == -1)
+  {
+    SESSION_STEP(0);
+    LINK_LOG("M%d %d / send : GET REG FRAME_REG_STATUS : ", id, state);
+    GetReg(FRAME_REG_STATUS);
+  }
+
+  PT_WAIT_UNTIL(pt, stepReady(timeNow));
+
+  if (regs.status == RUN) // skip restart if motor is already spining
+  {
+    runCycleStart(true);
+  }
+  else
+  {
+    // -------------------------------------
+    // START SEQUENCE
+    // -------------------------------------
+    enterState(1, timeNow);
+    LINK_LOG("M%d %d / send : CMD STOP : ", id, state);
+    SendCmd(SERIAL_FRAME_CMD_STOP);
+
+    // reset values
+    torque = 0;
+    speedEstimator.reset();
+
+    timeNextStep += DELAY_CMD;
+
+    SESSION_STEP(2);
+    LINK_LOG("M%d %d / send : GET REG FRAME_REG_FLAGS : ", id, state);
+    GetReg(FRAME_REG_FLAGS);
+
+    SESSION_STEP(3);
+    LINK_LOG("M%d %d / send : GET REG FRAME_REG_STATUS : ", id, state);
+    GetReg(FRAME_REG_STATUS);
+
+    SESSION_STEP(4);
+    LINK_LOG("M%d %d / send : CMD FAULT_ACK : ", id, state);
+    SendCmd(SERIAL_FRAME_CMD_FAULT_ACK);
+
+    SESSION_STEP(5);
+    LINK_LOG("M%d %d / send : SET REG CONTROL_MODE : ", id, state);
+    SetReg(FRAME_REG_CONTROL_MODE, 0x00);
+
+    SESSION_HOLDOFF(5);
+    LINK_LOG("M%d %d / send : REG_TORQUE_KI : ", id, state);
+    SetReg(FRAME_REG_TORQUE_KI, TORQUE_KI);
+
+    SESSION_HOLDOFF(5);
+    LINK_LOG("M%d %d / send : REG_TORQUE_KP : ", id, state);
+    SetReg(FRAME_REG_TORQUE_KP, TORQUE_KP);
+
+#if FLUX_MAP
+    SESSION_HOLDOFF(5);
+    LINK_LOG("M%d %d / send : REG_FLUX_KI : ", id, state);
+    SetReg(FRAME_REG_FLUX_KI, FLUX_KI);
+
+    SESSION_HOLDOFF(5);
+    LINK_LOG("M%d %d / send : REG_FLUX_KP : ", id, state);
+    SetReg(FRAME_REG_FLUX_KP, FLUX_KP);
+
+    SESSION_HOLDOFF(5);
+    LINK_LOG("M%d %d / send : REG_FLUX_REF : ", id, state);
+    SetReg(FRAME_REG_FLUX_REF, STARUP_FLUX_REFERENCE);
+    fluxMap.reset(STARUP_FLUX_REFERENCE);
+#endif
+
+    SESSION_STEP(6);
+    LINK_LOG("M%d %d / send : GET REG FRAME_REG_FLAGS : ", id, state);
+    GetReg(FRAME_REG_FLAGS);
+
+    SESSION_STEP(7);
+    LINK_LOG("M%d %d / send : CMD START : ", id, state);
+    SendCmd(SERIAL_FRAME_CMD_START);
+
+    timeNextStep += DELAY_CMD;
+
+    PT_WAIT_UNTIL(pt, stepReady(timeNow));
+    runCycleStart(false);
+  }
+
+  // -------------------------------------
+  // RUN CYCLE
+  // -------------------------------------
+  while (true)
+  {
+    // ESC_POLL_CYCLE registers of the table, states 8-9
+    for (pollIndex = 0; pollIndex < ESC_POLL_CYCLE_COUNT; pollIndex++)
+    {
+      enterState(8 + pollIndex, timeNow);
+      pollRegister(escPollRegister(ESC_POLL_CYCLE, pollIndex));
+      SESSION_RUN_WAIT();
+    }
+
+#if CRUISE
+    if (cruiseTarget != 0)
+    {
+      // -------------------------------------
+      // CRUISE : the ESC closes the speed loop, the link only watches it
+      // -------------------------------------
+      cruiseActive = true;
+      enterState(15, timeNow);
+      LINK_LOG("M%d %d / send : SET REG FRAME_REG_SPEED : ", id, state);
+      SetReg(FRAME_REG_SPEED, cruiseTarget);
+
+      SESSION_HOLDOFF(5);
+      LINK_LOG("M%d %d / send : SET REG CONTROL_MODE : ", id, state);
+      SetReg(FRAME_REG_CONTROL_MODE, 0x01);
+
+      SESSION_HOLDOFF(5);
+      LINK_LOG("M%d %d / send : SET REG FRAME_REG_RAMP_FINAL_SPEED : ", id, state);
+      SetReg(FRAME_REG_RAMP_FINAL_SPEED, cruiseTarget);
+      cruiseWritten = cruiseTarget;
+      timeCruisePoll = timeNow + CRUISE_POLL_PERIOD;
+
+      while (true)
+      {
+        PT_WAIT_UNTIL(pt, (cruiseTarget == 0) || (stepReady(timeNow) && ((cruiseTarget != cruiseWritten) || ((long)(timeNow - timeCruisePoll) >= 0))));
+        if (cruiseTarget == 0)
+          break;
+        SESSION_CHECK_RUN();
+
+        if (cruiseTarget != cruiseWritten)
+        {
+          // new setpoint from the rider
+          enterState(16, timeNow);
+          LINK_LOG("M%d %d / send : SET REG FRAME_REG_RAMP_FINAL_SPEED : ", id, state);
+          SetReg(FRAME_REG_RAMP_FINAL_SPEED, cruiseTarget);
+          cruiseWritten = cruiseTarget;
+        }
+        else
+        {
+          enterState(17, timeNow);
+          LINK_LOG("M%d %d / send : GET REG FRAME_REG_STATUS : ", id, state);
+          GetReg(FRAME_REG_STATUS);
+
+          SESSION_STEP(18);
+          LINK_LOG("M%d %d / send : GET REG SPEED : ", id, state);
+          GetReg(FRAME_REG_SPEED_MEASURED);
+          timeCruisePoll = timeNow + CRUISE_POLL_PERIOD;
+        }
+      }
+
+      // back to torque mode with the torque of the inputs, see sendTorque()
+      cruiseActive = false;
+      cruiseWritten = 0;
+      controlModePending = true;
+      PT_WAIT_UNTIL(pt, expectedAnswers == 0);
+    }
+#endif
+
+    enterState(10, timeNow);
+    // torque is computed and sent by the scheduler, see sendTorque()
+    torquePending = true;
+    PT_WAIT_WHILE(pt, torquePending);
+
+    PT_WAIT_UNTIL(pt, stepReady(timeNow));
+
+    // ESC_POLL_CYCLE registers again, states 11-13
+    for (pollIndex = 0; pollIndex < ESC_POLL_CYCLE_COUNT; pollIndex++)
+    {
+      SESSION_CHECK_RUN();
+      enterState(11 + pollIndex, timeNow);
+      pollRegister(escPollRegister(ESC_POLL_CYCLE, pollIndex));
+      SESSION_RUN_WAIT();
+    }
+    SESSION_CHECK_RUN();
+
+    // ESC_POLL_SLOW registers, state 14 : the speed is extrapolated between two polls, see estimateSpeed()
+    if ((++speedPollCycle >= speedPollCycles) || (speedEstimator.age(micros()) > SPEED_EST_MAX_AGE * 1000UL))
+    {
+      speedPollCycle = 0;
+      for (pollIndex = 0; pollIndex < ESC_POLL_SLOW_COUNT; pollIndex++)
+      {
+        enterState(14 + pollIndex, timeNow);
+        pollRegister(escPollRegister(ESC_POLL_SLOW, pollIndex));
+        SESSION_RUN_WAIT();
+      }
+    }
+  }
+
+  PT_END(pt);
+}
+
+void HOT_PATH_ATTR EscLink::sendTorque(int16_t value, uint32_t sampleTimeUs)
+{
+  torque = value;
+  torquePending = false;
+  torqueRequested = false;
+
+  LINK_LOG("M%d %d / send torque = %d / speed = %d : SET REG FRAME_REG_TORQUE : ", id, state, torque, regs.speed);
+  SetReg(FRAME_REG_TORQUE, torque);
+
+#if CRUISE
+  // the torque write already selects the torque mode in the ESC, the
+  // speed loop output is replaced by the torque of the inputs at once
+  if (controlModePending)
+  {
+    LINK_LOG("M%d %d / send : SET REG CONTROL_MODE : ", id, state);
+    SetReg(FRAME_REG_CONTROL_MODE, 0x00);
+    controlModePending = false;
+  }
+#endif
+
+#if FLUX_MAP
+  // flux weakening follows the speed on the torque tick, in the same step
+  int16_t flux;
+  if (fluxMap.update(estimateSpeed(micros()), torque, millis(), flux))
+  {
+    LINK_LOG("M%d %d / send flux = %d : SET REG FRAME_REG_FLUX_REF : ", id, state, flux);
+    SetReg(FRAME_REG_FLUX_REF, flux);
+  }
+#endif
+
+  // the frame is in the TX FIFO, add its time on the wire
+  if (sampleTimeUs != 0)
+  {
+    uint32_t wireUs = sizeof(SerialRegSet16) * 10 * 1000000 / baudRate;
+    inputLatency.add(micros() + wireUs - sampleTimeUs);
+  }
+}
+
+// ########################## LINK STATS ##########################
+
+#if PATCHED_ESP32_FWK
+void printUartStats(uint8_t uartNr, HardwareSerial &serial, unsigned long period)
+{
+  uart_stats_t stats = serial.stats();
+  uint32_t cpuMhz = getCpuFrequencyMhz();
+
+  Serial.printf("   UART%d isr : %d irq/s / avg = %d cycles (%d us) / max = %d cycles (%d us)\n",
+                uartNr, stats.isr_count * 1000 / period,
+                stats.isr_count ? stats.isr_cycles / stats.isr_count : 0,
+                stats.isr_count ? stats.isr_cycles / stats.isr_count / cpuMhz : 0,
+                stats.isr_cycles_max, stats.isr_cycles_max / cpuMhz);
+  Serial.printf("   UART%d : rx %d B / tx %d B / frame err = %d / parity err = %d / fifo ovf = %d / queue drops = %d\n",
+                uartNr, stats.rx_bytes, stats.tx_bytes,
+                stats.frame_errors, stats.parity_errors, stats.fifo_overflows, stats.queue_drops);
+
+  serial.resetStats();
+}
+#endif
+
+void EscLink::printStats(unsigned long timeNow)
+{
+  unsigned long period = timeNow - timeLastStats;
+  if (period == 0)
+    return;
+
+  Serial.printf("M%d link : %d bauds / tx %d frames/s (%d B/s) / rx %d frames/s (%d B/s) / rtt avg = %d us / max = %d us / errors = %d / timeouts = %d\n",
+                id, baudRate,
+                framesTx * 1000 / period, bytesTx * 1000 / period,
+                framesRx * 1000 / period, bytesRx * 1000 / period,
+                rttCount ? rttSumUs / rttCount : 0, rttMaxUs,
+                errorFrames, timeouts);
+
+#if PATCHED_ESP32_FWK
+  Serial.printf("   M%d rx trigger : timeout = %d symbols / fifo = %s / wake avg = %d us / max = %d us\n",
+                id, ESC_RX_TIMEOUT, ESC_RX_ADAPTIVE ? "reply size" : "112",
+                wakeCount ? wakeSumUs / wakeCount : 0, wakeMaxUs);
+  uartCounters(uartErrorsTotal, uartDropsTotal);
+  printUartStats(id, serial, period);
+#endif
+  Serial.printf("   M%d session : %d bytes / resume avg = %d cycles / max = %d cycles\n",
+                id, sizeof(EscLink),
+                resumeCount ? resumeCyclesSum / resumeCount : 0, resumeCyclesMax);
+#if FLUX_MAP
+  Serial.printf("   M%d flux : ref = %d / %d writes\n", id, fluxMap.written, fluxMap.writes);
+  fluxMap.writes = 0;
+#endif
+#if CRUISE
+  if (cruiseActive)
+    Serial.printf("   M%d cruise : target = %d rpm / speed = %d rpm\n", id, cruiseWritten, regs.speed);
+#endif
+  speedEstimator.printStats();
+  speedEstimator.resetStats();
+  inputLatency.print("input to torque");
+  inputLatency.reset();
+
+  timeLastStats = timeNow;
+  framesTx = 0;
+  framesRx = 0;
+  bytesTx = 0;
+  bytesRx = 0;
+  errorFrames = 0;
+  timeouts = 0;
+  rttCount = 0;
+  rttSumUs = 0;
+  rttMaxUs = 0;
+  wakeCount = 0;
+  wakeSumUs = 0;
+  wakeMaxUs = 0;
+  resumeCount = 0;
+  resumeCyclesSum = 0;
+  resumeCyclesMax = 0;
+}
+
+void EscLink::uartCounters(uint32_t &errors, uint32_t &drops)
+{
+  errors = uartErrorsTotal;
+  drops = uartDropsTotal;
+#if PATCHED_ESP32_FWK
+  uart_stats_t stats = serial.stats();
+  errors += stats.frame_errors + stats.parity_errors;
+  drops += stats.fifo_overflows + stats.queue_drops;
+#endif
+}
+
+// ########################## BAUD NEGOTIATION ##########################
+
+void EscLink::setBaudRate(uint32_t baud)
+{
+  serial.flush();
+  serial.updateBaudRate(baud);
+  baudRate = baud;
+
+  // drop bytes received at the previous rate
+  while (serial.available())
+    serial.read();
+}
+
+uint32_t EscLink::loadBaudRate()
+{
+  Preferences preferences;
+  char key[16];
+
+  if (id == 0)
+    snprintf(key, sizeof(key), "%s", BAUD_NVS_KEY);
+  else
+    snprintf(key, sizeof(key), "%s%d", BAUD_NVS_KEY, id);
+
+  preferences.begin(NVS_NAMESPACE, true);
+  uint32_t baud = preferences.getUInt(key, BAUD_RATE_SMARTESC);
+  preferences.end();
+  return baud;
+}
+
+void EscLink::saveBaudRate(uint32_t baud)
+{
+  Preferences preferences;
+  char key[16];
+
+  if (id == 0)
+    snprintf(key, sizeof(key), "%s", BAUD_NVS_KEY);
+  else
+    snprintf(key, sizeof(key), "%s%d", BAUD_NVS_KEY, id);
+
+  preferences.begin(NVS_NAMESPACE, false);
+  preferences.putUInt(key, baud);
+  preferences.end();
+}
+
+// send a GET REG outside of the state machine and wait for its reply
+// return the round trip time in us, or 0 on timeout / checksum error
+uint32_t EscLink::probeGetReg(uint8_t reg)
+{
+  uint8_t frame[ESC_FRAME_MAX_SIZE];
+  uint8_t size = escEncodeGetReg(frame, reg);
+  uint8_t reply[8];
+  uint8_t nbBytes = 0;
+
+  unsigned long timeStart = micros();
+  serial.write(frame, size);
+
+  while (micros() - timeStart < BAUD_PROBE_TIMEOUT * 1000)
+  {
+    if (!serial.available())
+      continue;
+
+    reply[nbBytes++] = serial.read();
+
+    // header + size + datas + crc
+    if ((nbBytes >= 2) && (((size_t)reply[1] + 3 > sizeof(reply)) || (reply[0] != SERIAL_START_FRAME_ESC_TO_DISPLAY_OK)))
+      return 0;
+    if ((nbBytes >= 2) && (nbBytes == reply[1] + 3))
+    {
+      if (getCrc(reply, nbBytes) != reply[nbBytes - 1])
+        return 0;
+
+      uint32_t rtt = micros() - timeStart;
+      return rtt > 0 ? rtt : 1;
+    }
+  }
+
+  return 0;
+}
+
+// check the current rate with a burst of GET REG round trips
+bool EscLink::probeBaudRate(uint32_t baud)
+{
+  uint32_t nbOk = 0;
+  uint32_t rttSum = 0;
+  uint32_t rttMax = 0;
+
+  setBaudRate(baud);
+
+  for (int i = 0; i < BAUD_PROBE_BURST; i++)
+  {
+    uint32_t rtt = probeGetReg(FRAME_REG_STATUS);
+    if (rtt == 0)
+      break;
+
+    nbOk++;
+    rttSum += rtt;
+    if (rtt > rttMax)
+      rttMax = rtt;
+  }
+
+  if (nbOk == BAUD_PROBE_BURST)
+    Serial.printf("   M%d baud %d : ok / rtt avg = %d us / max = %d us\n", id, baud, rttSum / nbOk, rttMax);
+  else
+    Serial.printf("   M%d baud %d : ko after %d replies\n", id, baud, nbOk);
+
+  return nbOk == BAUD_PROBE_BURST;
+}
+
+// The SmartESC has no register to change its own rate, so negotiation only probes
+// the ESP side : rates are stepped up until the ESC stops answering cleanly, and the
+// best one is stored in NVS. An ESC firmware with a non default rate is found this way.
+void EscLink::negotiateBaudRate()
+{
+  uint32_t savedBaud = loadBaudRate();
+  uint32_t bestBaud = 0;
+
+  Serial.printf("M%d baud negotiation (saved rate = %d)\n", id, savedBaud);
+
+  // fast path : saved rate still works
+  if ((savedBaud != BAUD_RATE_SMARTESC) && probeBaudRate(savedBaud))
+  {
+    return;
+  }
+
+  for (uint8_t i = 0; i < escBaudRatesCount; i++)
+  {
+    if (probeBaudRate(escBaudRates[i]))
+    {
+      bestBaud = escBaudRates[i];
+    }
+    else if (bestBaud != 0)
+    {
+      // errors at this rate, keep the previous one
+      break;
+    }
+  }
+
+  if (bestBaud == 0)
+  {
+    Serial.printf("   M%d no reply, keep %d bauds\n", id, BAUD_RATE_SMARTESC);
+    bestBaud = BAUD_RATE_SMARTESC;
+  }
+
+  setBaudRate(bestBaud);
+  if (bestBaud != savedBaud)
+    saveBaudRate(bestBaud);
+
+  Serial.printf("   ==> M%d ESC link at %d bauds\n", id, bestBaud);
+}
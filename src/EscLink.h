@@ -0,0 +1,181 @@
+// *******************************************************************
+//  SmartESC serial link
+//
+//  One instance per UART : frame encoding, reply parsing and the
+//  session state machine of one SmartESC controller.
+// *******************************************************************
+
+#ifndef ESC_LINK_H_
+#define ESC_LINK_H_
+
+#include <Arduino.h>
+#include "config.h"
+#include "SmartEscProtocol.h"
+#include "EscRegisters.h"
+#include "LatencyHistogram.h"
+#include "Protothread.h"
+#include "SpeedEstimator.h"
+#include "FluxMap.h"
+
+#if PATCHED_ESP32_FWK
+// ISR load of one UART since the previous report
+void printUartStats(uint8_t uartNr, HardwareSerial &serial, unsigned long period);
+#endif
+
+class EscLink
+{
+public:
+  EscLink(uint8_t id, HardwareSerial &serial);
+
+  void begin(uint32_t baud, int8_t rxPin, int8_t txPin);
+
+  // read and decode all pending replies, never blocks
+  void Receive();
+
+  // resume the session until its next wait, never blocks
+  void update(unsigned long timeNow);
+
+  // the torque step (state 10) is driven by the scheduler
+  bool isTorquePending() const { return torquePending; }
+  bool isRunning() const { return (state >= 8) && (regs.status == RUN); }
+  // sampleTimeUs : time the inputs of this torque were sampled, 0 if unknown
+  void sendTorque(int16_t value, uint32_t sampleTimeUs = 0);
+
+  // speed extrapolated to timeUs from the last reply and the applied torque
+  int32_t estimateSpeed(uint32_t timeUs) const { return speedEstimator.estimate(timeUs, torque); }
+
+  // latency first : next step is the torque write, diagnostic polls resume after it
+  void requestTorque() { torqueRequested = true; }
+
+  // parked : run cycle steps further apart
+  void setStepDelay(uint16_t ms) { stepDelay = ms; }
+  // waveform player : ESC_POLL_SLOW registers (the speed) read every run cycle
+  void setSpeedPollCycles(uint8_t cycles) { speedPollCycles = cycles; }
+  // [ms] time the link needs no CPU, 0 while a reply is due
+  uint32_t idleTime(unsigned long timeNow);
+
+  // speed regulated by the ESC at speedRpm, 0 to go back to torque control.
+  // A new setpoint while cruising is written as the ramp target.
+  void setCruise(int32_t speedRpm) { cruiseTarget = speedRpm; }
+  int32_t getCruise() const { return cruiseTarget; }
+  bool isCruising() const { return cruiseActive; }
+
+  // round trip of the last reply, once per reply
+  bool takeRtt(uint32_t &rttUs);
+
+  void negotiateBaudRate();
+
+  // bridge : the session stops, and starts over from the motor status when resumed
+  void restartSession(unsigned long timeNow);
+
+  void printStats(unsigned long timeNow);
+
+  // UART framing / parity errors and FIFO / queue drops since boot, 0 without the patched HAL
+  void uartCounters(uint32_t &errors, uint32_t &drops);
+
+  uint8_t id;
+  HardwareSerial &serial;
+
+  // last decoded value of every register of the table : regs.speed, regs.status...
+  EscRegisterShadow regs = {};
+  uint32_t flags = 0; // current fault bits, or the last ones if none
+  int16_t torque = 0;
+
+  int8_t state = 0;
+  uint32_t expectedAnswers = 0;
+  uint32_t baudRate = BAUD_RATE_SMARTESC;
+
+private:
+  void SendCmd(uint8_t cmd);
+  void GetReg(uint8_t reg);
+  void SetReg(uint8_t reg, int32_t val);
+  void pollRegister(const EscRegister *reg);
+  void onRegister(uint8_t reg, int32_t value);
+
+  // rare paths of the hot set, in flash with their console output
+  void unknownRegister(uint8_t reg);
+  void statusFault();
+  void flagsFault();
+  void replyTimeout(unsigned long timeNow);
+  void replyError(const char *reason);
+  void motorStopped();
+  void runCycleStart(bool started);
+
+  // session protothread, see update()
+  int8_t session(unsigned long timeNow);
+  int8_t runWait(unsigned long timeNow);
+  void restart(int8_t fromState);
+  void enterState(int8_t newState, unsigned long timeNow);
+  bool stepReady(unsigned long timeNow);
+  bool preemptReady();
+
+  void sendFrame(uint8_t *frame, uint8_t size, uint32_t orderType, uint32_t orderValue);
+
+  void setBaudRate(uint32_t baud);
+  uint32_t loadBaudRate();
+  void saveBaudRate(uint32_t baud);
+  uint32_t probeGetReg(uint8_t reg);
+  bool probeBaudRate(uint32_t baud);
+
+  uint8_t receiveBuffer[1000];
+
+  uint32_t lastOrderType = 0;
+  uint32_t lastOrderValue = 0;
+  bool torquePending = false;
+  bool torqueRequested = false;
+  int8_t preemptedState = 0; // poll to resume after a preempting torque write
+
+  Pt pt = 0;
+  Pt ptRunWait = 0;
+
+  int32_t cruiseTarget = 0;
+  int32_t cruiseWritten = 0;
+  bool cruiseActive = false;
+  bool controlModePending = false; // back to torque mode with the next torque write
+  unsigned long timeCruisePoll = 0;
+
+  unsigned long timeLastReply = 0;
+  unsigned long timeNextStep = 0;
+  uint16_t stepDelay = DELAY_BETWEEN_STATES;
+  unsigned long timeSendUs = 0;
+  uint32_t timeRxUs = 0;
+
+  // link stats, reset at each report
+  unsigned long timeLastStats = 0;
+  uint32_t framesTx = 0;
+  uint32_t framesRx = 0;
+  uint32_t bytesTx = 0;
+  uint32_t bytesRx = 0;
+  uint32_t errorFrames = 0;
+  uint32_t timeouts = 0;
+  uint32_t rttCount = 0;
+  uint32_t rttSumUs = 0;
+  uint32_t rttMaxUs = 0;
+  uint32_t rttLastUs = 0;
+  bool rttPending = false;
+  uint32_t wakeCount = 0;
+  uint32_t wakeSumUs = 0;
+  uint32_t wakeMaxUs = 0;
+  uint32_t resumeCount = 0;
+  uint32_t resumeCyclesSum = 0;
+  uint32_t resumeCyclesMax = 0;
+
+  // throttle / brake sample to torque frame on the wire
+  LatencyHistogram inputLatency;
+
+  // HAL counters up to the last link report, which resets them
+  uint32_t uartErrorsTotal = 0;
+  uint32_t uartDropsTotal = 0;
+
+  SpeedEstimator speedEstimator;
+  FluxMap fluxMap;
+  uint8_t pollIndex = 0; // run cycle poll in progress, see ESC_POLL_*
+  uint8_t speedPollCycle = 0;
+  uint8_t speedPollCycles = SPEED_POLL_CYCLES;
+};
+
+// baud rates of the negotiation, ascending
+extern const uint32_t escBaudRates[];
+extern const uint8_t escBaudRatesCount;
+
+#endif
@@ -0,0 +1,133 @@
+// *******************************************************************
+//  SmartESC register map
+// *******************************************************************
+
+#include <Arduino.h>
+#include "config.h"
+#include "EscRegisters.h"
+
+#define ESC_REGISTER_ENTRY(id, field, width, isSigned, scale, unit, poll) \
+  {id, width, isSigned, poll, scale, #field, unit, &EscRegisterShadow::field},
+
+static const EscRegister HOT_TABLE_ATTR escRegisters[] = {
+    ESC_REGISTERS(ESC_REGISTER_ENTRY)};
+
+#undef ESC_REGISTER_ENTRY
+
+#define ESC_REGISTER_COUNT (sizeof(escRegisters) / sizeof(escRegisters[0]))
+#define ESC_REGISTER_NONE 0xff
+
+// register id -> table index and poll lists, built on first use
+static uint8_t escRegisterIndex[256];
+static const EscRegister *escPollCycle[ESC_POLL_CYCLE_COUNT + 1];
+static const EscRegister *escPollSlow[ESC_POLL_SLOW_COUNT + 1];
+static bool escRegisterIndexReady = false;
+
+static void HOT_PATH_ATTR escRegisterIndexBuild()
+{
+  uint8_t nbCycle = 0;
+  uint8_t nbSlow = 0;
+
+  memset(escRegisterIndex, ESC_REGISTER_NONE, sizeof(escRegisterIndex));
+  for (uint8_t i = 0; i < ESC_REGISTER_COUNT; i++)
+  {
+    escRegisterIndex[escRegisters[i].id] = i;
+    if (escRegisters[i].poll == ESC_POLL_CYCLE)
+      escPollCycle[nbCycle++] = &escRegisters[i];
+    else if (escRegisters[i].poll == ESC_POLL_SLOW)
+      escPollSlow[nbSlow++] = &escRegisters[i];
+  }
+  escRegisterIndexReady = true;
+}
+
+const EscRegister HOT_PATH_ATTR *escRegisterFind(uint8_t id)
+{
+  if (!escRegisterIndexReady)
+    escRegisterIndexBuild();
+
+  uint8_t index = escRegisterIndex[id];
+  return index == ESC_REGISTER_NONE ? NULL : &escRegisters[index];
+}
+
+const EscRegister HOT_PATH_ATTR *escPollRegister(uint8_t poll, uint8_t index)
+{
+  if (!escRegisterIndexReady)
+    escRegisterIndexBuild();
+
+  if (poll == ESC_POLL_CYCLE)
+    return index < ESC_POLL_CYCLE_COUNT ? escPollCycle[index] : NULL;
+  if (poll == ESC_POLL_SLOW)
+    return index < ESC_POLL_SLOW_COUNT ? escPollSlow[index] : NULL;
+  return NULL;
+}
+
+uint8_t HOT_PATH_ATTR escEncodeCmd(uint8_t *frame, uint8_t cmd)
+{
+  frame[0] = SERIAL_START_FRAME_DISPLAY_TO_ESC_CMD;
+  frame[1] = 1;
+  frame[2] = cmd;
+  frame[3] = getCrc(frame, 4);
+  return 4;
+}
+
+uint8_t HOT_PATH_ATTR escEncodeGetReg(uint8_t *frame, uint8_t reg)
+{
+  frame[0] = SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET;
+  frame[1] = 1;
+  frame[2] = reg;
+  frame[3] = getCrc(frame, 4);
+  return 4;
+}
+
+uint8_t HOT_PATH_ATTR escEncodeSetReg(uint8_t *frame, const EscRegister *reg, int32_t value)
+{
+  uint8_t size = reg->width + 4;
+
+  frame[0] = SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET;
+  frame[1] = reg->width + 1;
+  frame[2] = reg->id;
+  for (uint8_t i = 0; i < reg->width; i++)
+    frame[3 + i] = (value >> (8 * i)) & 0xff;
+  frame[size - 1] = getCrc(frame, size);
+  return size;
+}
+
+int32_t HOT_PATH_ATTR escDecodeValue(const EscRegister *reg, const uint8_t *data, uint8_t size)
+{
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < size && i < 4; i++)
+    value |= (uint32_t)data[i] << (8 * i);
+
+  if (reg->isSigned && (size < 4) && (value & (1UL << (8 * size - 1))))
+    value |= 0xffffffffUL << (8 * size);
+
+  return (int32_t)value;
+}
+
+uint8_t HOT_PATH_ATTR escReplySize(uint8_t orderType, uint8_t reg)
+{
+  if (orderType != SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET)
+    return 3;
+
+  const EscRegister *entry = escRegisterFind(reg);
+  return entry == NULL ? 3 : 3 + entry->width;
+}
+
+void escPrintFaults(uint32_t flags)
+{
+  bool known = false;
+
+#define ESC_FAULT_PRINT(code)                   \
+  if (flags & code)                             \
+  {                                             \
+    Serial.printf("   ===> flags : " #code "\n"); \
+    known = true;                               \
+  }
+  ESC_FAULTS(ESC_FAULT_PRINT)
+#undef ESC_FAULT_PRINT
+
+  if (!known)
+  {
+    Serial.printf("   ===> flags : unkown\n");
+  }
+}
@@ -0,0 +1,100 @@
+// *******************************************************************
+//  SmartESC register map
+//
+//  Single declarative table of the ESC registers. Frame encoding,
+//  reply decoding, logging, the per-link shadow storage and the polls
+//  of the run cycle are all generated from it : adding a register is
+//  one ESC_REGISTERS line.
+// *******************************************************************
+
+#ifndef ESC_REGISTERS_H_
+#define ESC_REGISTERS_H_
+
+#include <stdint.h>
+#include "SmartEscProtocol.h"
+
+// polls of the run cycle
+#define ESC_POLL_NONE 0
+#define ESC_POLL_CYCLE 1 // before and after every torque write
+#define ESC_POLL_SLOW 2  // after the torque write, every few run cycles (setSpeedPollCycles)
+
+// X(id, field, width, signed, scale, unit, poll)
+//   field  : name of the decoded value in EscRegisterShadow, also used in logs
+//   width  : value size in the REG SET frame / GET REG reply, in bytes
+//   scale  : raw value is divided by it for display
+//   poll   : default poll of the run cycle, ESC_POLL_*
+#define ESC_REGISTERS(X)                                                          \
+  X(FRAME_REG_TARGET_MOTOR, targetMotor, 1, false, 1, "", ESC_POLL_NONE)          \
+  X(FRAME_REG_FLAGS, flags, 4, false, 1, "", ESC_POLL_CYCLE)                      \
+  X(FRAME_REG_STATUS, status, 1, false, 1, "", ESC_POLL_CYCLE)                    \
+  X(FRAME_REG_CONTROL_MODE, controlMode, 2, false, 1, "", ESC_POLL_NONE)          \
+  X(FRAME_REG_SPEED, speedRef, 4, true, 1, "rpm", ESC_POLL_NONE)                  \
+  X(FRAME_REG_TORQUE, torqueRef, 2, true, 1, "", ESC_POLL_NONE)                   \
+  X(FRAME_REG_TORQUE_KP, torqueKp, 2, false, 1024, "", ESC_POLL_NONE)             \
+  X(FRAME_REG_TORQUE_KI, torqueKi, 2, false, 16384, "", ESC_POLL_NONE)            \
+  X(FRAME_REG_FLUX_REF, fluxRef, 2, true, 1, "", ESC_POLL_NONE)                   \
+  X(FRAME_REG_FLUX_KI, fluxKi, 2, false, 16384, "", ESC_POLL_NONE)                \
+  X(FRAME_REG_FLUX_KP, fluxKp, 2, false, 1024, "", ESC_POLL_NONE)                 \
+  X(FRAME_REG_SPEED_MEASURED, speed, 4, true, 1, "rpm", ESC_POLL_SLOW)            \
+  X(FRAME_REG_RAMP_FINAL_SPEED, rampFinalSpeed, 4, true, 1, "rpm", ESC_POLL_NONE)
+
+// X(code)
+#define ESC_FAULTS(X)   \
+  X(MC_FOC_DURATION)    \
+  X(MC_OVER_VOLT)       \
+  X(MC_UNDER_VOLT)      \
+  X(MC_OVER_TEMP)       \
+  X(MC_START_UP)        \
+  X(MC_SPEED_FDBK)      \
+  X(MC_BREAK_IN)        \
+  X(MC_SW_ERROR)
+
+// last decoded value of every register
+struct EscRegisterShadow
+{
+#define ESC_REGISTER_FIELD(id, field, width, isSigned, scale, unit, poll) int32_t field;
+  ESC_REGISTERS(ESC_REGISTER_FIELD)
+#undef ESC_REGISTER_FIELD
+};
+
+typedef struct
+{
+  uint8_t id;
+  uint8_t width;
+  bool isSigned;
+  uint8_t poll;
+  uint16_t scale;
+  const char *name;
+  const char *unit;
+  int32_t EscRegisterShadow::*storage;
+} EscRegister;
+
+// number of registers of each poll, constant expressions
+#define ESC_POLL_CYCLE_ENTRY(id, field, width, isSigned, scale, unit, poll) +((poll) == ESC_POLL_CYCLE)
+#define ESC_POLL_SLOW_ENTRY(id, field, width, isSigned, scale, unit, poll) +((poll) == ESC_POLL_SLOW)
+#define ESC_POLL_CYCLE_COUNT (0 ESC_REGISTERS(ESC_POLL_CYCLE_ENTRY))
+#define ESC_POLL_SLOW_COUNT (0 ESC_REGISTERS(ESC_POLL_SLOW_ENTRY))
+
+// O(1) lookup, NULL for registers missing from the table
+const EscRegister *escRegisterFind(uint8_t id);
+
+// index-th register of the table polled as poll, in table order
+const EscRegister *escPollRegister(uint8_t poll, uint8_t index);
+
+// frame builders, return the frame size
+uint8_t escEncodeCmd(uint8_t *frame, uint8_t cmd);
+uint8_t escEncodeGetReg(uint8_t *frame, uint8_t reg);
+uint8_t escEncodeSetReg(uint8_t *frame, const EscRegister *reg, int32_t value);
+
+// value of a reply, sign extended according to the register
+int32_t escDecodeValue(const EscRegister *reg, const uint8_t *data, uint8_t size);
+
+// size of the ESC reply to an order : header + size + datas + crc
+uint8_t escReplySize(uint8_t orderType, uint8_t reg);
+
+// print the name of every fault bit set in flags
+void escPrintFaults(uint32_t flags);
+
+#define ESC_FRAME_MAX_SIZE 8
+
+#endif
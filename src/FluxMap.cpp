@@ -0,0 +1,80 @@
+// *******************************************************************
+//  SmartESC flux weakening map
+// *******************************************************************
+
+#include <Arduino.h>
+#include <stdlib.h>
+#include "FluxMap.h"
+
+static const FluxMapPoint HOT_TABLE_ATTR fluxMapPoints[] = FLUX_MAP_POINTS;
+#define FLUX_MAP_NB_POINTS (sizeof(fluxMapPoints) / sizeof(fluxMapPoints[0]))
+
+int16_t HOT_PATH_ATTR FluxMap::lookup(int32_t speed, int16_t torque)
+{
+  int32_t flux;
+
+  speed = abs(speed);
+  if (speed <= fluxMapPoints[0].speed)
+  {
+    flux = fluxMapPoints[0].flux;
+  }
+  else if (speed >= fluxMapPoints[FLUX_MAP_NB_POINTS - 1].speed)
+  {
+    flux = fluxMapPoints[FLUX_MAP_NB_POINTS - 1].flux;
+  }
+  else
+  {
+    uint8_t i = 1;
+    while (speed > fluxMapPoints[i].speed)
+      i++;
+
+    const FluxMapPoint &p0 = fluxMapPoints[i - 1];
+    const FluxMapPoint &p1 = fluxMapPoints[i];
+    flux = p0.flux + (p1.flux - p0.flux) * (speed - p0.speed) / (p1.speed - p0.speed);
+  }
+
+#if FLUX_MAP_TORQUE_SCALE
+  int32_t demand = abs(torque);
+  if (demand > FLUX_MAP_FULL_TORQUE)
+    demand = FLUX_MAP_FULL_TORQUE;
+  // scale in percent : flux * demand overflows 32 bits, a 64 bit division is a libgcc call in flash
+  int32_t percent = FLUX_MAP_TORQUE_MIN + (100 - FLUX_MAP_TORQUE_MIN) * demand / FLUX_MAP_FULL_TORQUE;
+  flux = flux * percent / 100;
+#else
+  (void)torque;
+#endif
+
+  return flux;
+}
+
+void FluxMap::reset(int16_t value)
+{
+  written = value;
+  speedRef = 0;
+  timeLastWrite = 0;
+}
+
+bool HOT_PATH_ATTR FluxMap::update(int32_t speed, int16_t torque, unsigned long timeMs, int16_t &flux)
+{
+  // backlash : follows accelerations at once, decelerations past the hysteresis
+  speed = abs(speed);
+  if (speed > speedRef)
+    speedRef = speed;
+  else if (speed < speedRef - FLUX_MAP_HYSTERESIS)
+    speedRef = speed + FLUX_MAP_HYSTERESIS;
+
+  flux = lookup(speedRef, torque);
+
+  // small changes are not worth a frame, except the way back to the end values
+  bool endValue = (flux == fluxMapPoints[0].flux) || (flux == fluxMapPoints[FLUX_MAP_NB_POINTS - 1].flux);
+  if ((abs(flux - written) < FLUX_MAP_THRESHOLD) && !(endValue && (flux != written)))
+    return false;
+
+  if (timeMs - timeLastWrite < FLUX_MAP_MIN_INTERVAL)
+    return false;
+
+  written = flux;
+  timeLastWrite = timeMs;
+  writes++;
+  return true;
+}
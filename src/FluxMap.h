@@ -0,0 +1,44 @@
+// *******************************************************************
+//  SmartESC flux weakening map
+//
+//  Flux reference (Id, negative to weaken the field) interpolated
+//  from a speed indexed table, optionally scaled by the torque demand.
+//  Evaluated on each torque tick, the speed follows a deceleration
+//  only past FLUX_MAP_HYSTERESIS, and a new reference is written only
+//  when it moved by FLUX_MAP_THRESHOLD, at most every
+//  FLUX_MAP_MIN_INTERVAL.
+// *******************************************************************
+
+#ifndef FLUX_MAP_H_
+#define FLUX_MAP_H_
+
+#include <stdint.h>
+#include "config.h"
+
+typedef struct
+{
+  int32_t speed; // [rpm]
+  int16_t flux;
+} FluxMapPoint;
+
+class FluxMap
+{
+public:
+  // reference currently applied by the ESC
+  void reset(int16_t written);
+
+  // true if flux must be written to the ESC now
+  bool update(int32_t speed, int16_t torque, unsigned long timeMs, int16_t &flux);
+
+  // map value, no hysteresis
+  static int16_t lookup(int32_t speed, int16_t torque);
+
+  int16_t written = 0;
+  uint32_t writes = 0;
+
+private:
+  int32_t speedRef = 0;
+  unsigned long timeLastWrite = 0;
+};
+
+#endif
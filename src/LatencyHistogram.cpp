@@ -0,0 +1,60 @@
+// *******************************************************************
+//  SmartESC latency histogram
+// *******************************************************************
+
+#include "config.h"
+#include "LatencyHistogram.h"
+
+void HOT_PATH_ATTR LatencyHistogram::add(uint32_t us)
+{
+  uint8_t bucket = 31 - __builtin_clz(us | 1);
+  if (bucket >= LATENCY_BUCKETS)
+    bucket = LATENCY_BUCKETS - 1;
+  buckets[bucket]++;
+
+  if ((count == 0) || (us < minUs))
+    minUs = us;
+  if (us > maxUs)
+    maxUs = us;
+  count++;
+  sumUs += us;
+}
+
+void LatencyHistogram::reset()
+{
+  count = 0;
+  sumUs = 0;
+  minUs = 0;
+  maxUs = 0;
+  memset(buckets, 0, sizeof(buckets));
+}
+
+uint32_t LatencyHistogram::percentile(uint8_t percent) const
+{
+  uint32_t target = ((uint64_t)count * percent + 99) / 100;
+  uint32_t seen = 0;
+
+  for (uint8_t i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    seen += buckets[i];
+    if ((seen >= target) && (seen > 0))
+      return (2UL << i) < maxUs ? (2UL << i) : maxUs;
+  }
+  return maxUs;
+}
+
+void LatencyHistogram::print(const char *name) const
+{
+  Serial.printf("   %s : n = %d / min = %d us / avg = %d us / p50 < %d us / p99 < %d us / max = %d us\n",
+                name, count, minUs, count ? sumUs / count : 0,
+                percentile(50), percentile(99), maxUs);
+
+  // non empty buckets
+  Serial.printf("     ");
+  for (uint8_t i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    if (buckets[i])
+      Serial.printf(" <%d:%d", 2UL << i, buckets[i]);
+  }
+  Serial.printf("\n");
+}
@@ -0,0 +1,32 @@
+// *******************************************************************
+//  SmartESC latency histogram
+//
+//  Power of two buckets : bucket i counts latencies in [2^i, 2^(i+1)) us.
+// *******************************************************************
+
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <Arduino.h>
+
+#define LATENCY_BUCKETS 21 // up to 2 s
+
+class LatencyHistogram
+{
+public:
+  void add(uint32_t us);
+  void reset();
+
+  // upper bound of the bucket holding the given percentile, in us
+  uint32_t percentile(uint8_t percent) const;
+
+  void print(const char *name) const;
+
+  uint32_t count = 0;
+  uint32_t sumUs = 0;
+  uint32_t minUs = 0;
+  uint32_t maxUs = 0;
+  uint32_t buckets[LATENCY_BUCKETS] = {0};
+};
+
+#endif
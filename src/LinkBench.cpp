@@ -0,0 +1,241 @@
+// *******************************************************************
+//  SmartESC link saturation benchmark
+// *******************************************************************
+
+#include "LinkBench.h"
+
+#if LINK_BENCH
+
+#define UART_RX_FIFO_FULL_DEFAULT 112 // [bytes] patched HAL default, see esp32-hal-uart.c
+
+LinkBench linkBench;
+
+static const uint8_t benchDepths[] = {1, 2, 4, 8};
+
+void LinkBench::run(EscLink &link)
+{
+  LinkBenchResult result;
+  LinkBenchResult best[2];
+  best[0].transactions = 0;
+  best[0].durationUs = 0;
+  best[1].transactions = 0;
+  best[1].durationUs = 0;
+
+#if PATCHED_ESP32_FWK
+  const uint8_t nbTriggers = 2;
+#else
+  const uint8_t nbTriggers = 1; // stock HAL : its own RX interrupt settings only
+#endif
+
+  Serial.printf("M%d link bench : %d ms per configuration\n", link.id, LINK_BENCH_DURATION);
+
+  for (uint8_t b = 0; b < escBaudRatesCount; b++)
+  {
+    for (uint8_t trigger = 0; trigger < nbTriggers; trigger++)
+    {
+      for (uint8_t set = 0; set < 2; set++)
+      {
+        for (uint8_t d = 0; d < sizeof(benchDepths) / sizeof(benchDepths[0]); d++)
+        {
+          if (benchDepths[d] > LINK_BENCH_MAX_DEPTH)
+            continue;
+
+          result.baud = escBaudRates[b];
+          result.idleTrigger = nbTriggers == 2 ? trigger : 1;
+          result.depth = benchDepths[d];
+          result.set = set;
+          runConfig(link, result);
+          print(link, result);
+
+          // best rate without a single error or timeout
+          LinkBenchResult &top = best[set];
+          if ((result.errors == 0) && (result.timeouts == 0) && (result.transactions > 0) &&
+              ((top.transactions == 0) ||
+               ((uint64_t)result.transactions * top.durationUs > (uint64_t)top.transactions * result.durationUs)))
+            top = result;
+
+          // nobody answers at this rate, deeper pipelines will not do better
+          if ((result.transactions == 0) && (result.depth == 1))
+            break;
+        }
+      }
+    }
+  }
+
+  for (uint8_t set = 0; set < 2; set++)
+  {
+    if (best[set].transactions == 0)
+    {
+      Serial.printf("M%d link bench : %s : no error free configuration\n", link.id, set ? "SET REG" : "GET REG");
+      continue;
+    }
+    Serial.printf("M%d link bench : best %s = ", link.id, set ? "SET REG" : "GET REG");
+    print(link, best[set]);
+  }
+
+  // back to the settings of EscLink::begin() / negotiateBaudRate()
+  link.serial.flush();
+  link.serial.updateBaudRate(link.baudRate);
+#if PATCHED_ESP32_FWK
+  link.serial.setUartIrqIdleTrigger(1);
+  link.serial.setRxFifoFull(UART_RX_FIFO_FULL_DEFAULT);
+  link.serial.setRxTimeout(ESC_RX_TIMEOUT);
+  link.serial.resetStats();
+#endif
+  resync(link);
+}
+
+// drop everything until the line is quiet
+void LinkBench::resync(EscLink &link)
+{
+  unsigned long timeQuiet = micros();
+  while (micros() - timeQuiet < LINK_BENCH_QUIET * 1000UL)
+  {
+    if (link.serial.available())
+    {
+      link.serial.read();
+      timeQuiet = micros();
+    }
+  }
+}
+
+void LinkBench::runConfig(EscLink &link, LinkBenchResult &result)
+{
+  uint8_t frame[ESC_FRAME_MAX_SIZE];
+  uint8_t size;
+  uint8_t replySize;
+
+  if (result.set)
+  {
+    size = escEncodeSetReg(frame, escRegisterFind(FRAME_REG_TORQUE), 0);
+    replySize = escReplySize(SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET, FRAME_REG_TORQUE);
+  }
+  else
+  {
+    size = escEncodeGetReg(frame, FRAME_REG_STATUS);
+    replySize = escReplySize(SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET, FRAME_REG_STATUS);
+  }
+
+  result.transactions = 0;
+  result.errors = 0;
+  result.timeouts = 0;
+  result.irqs = 0;
+  result.latency.reset();
+
+  link.serial.flush();
+  link.serial.updateBaudRate(result.baud);
+#if PATCHED_ESP32_FWK
+  link.serial.setUartIrqIdleTrigger(result.idleTrigger);
+  if (result.idleTrigger)
+  {
+    // run cycle settings
+    link.serial.setRxTimeout(ESC_RX_TIMEOUT);
+    link.serial.setRxFifoFull(ESC_RX_ADAPTIVE ? replySize : UART_RX_FIFO_FULL_DEFAULT);
+  }
+#endif
+  resync(link);
+#if PATCHED_ESP32_FWK
+  link.serial.resetStats();
+#endif
+
+  // send times of the requests in flight, oldest first
+  uint32_t sendUs[LINK_BENCH_MAX_DEPTH];
+  uint8_t head = 0;
+  uint8_t inFlight = 0;
+  uint8_t reply[8];
+  uint8_t nbBytes = 0;
+
+  uint32_t timeStart = micros();
+  uint32_t timeLast = timeStart;
+  uint32_t durationUs = LINK_BENCH_DURATION * 1000UL;
+
+  while (true)
+  {
+    uint32_t timeNow = micros();
+    bool sending = timeNow - timeStart < durationUs;
+    if (!sending && (inFlight == 0))
+      break;
+
+    // keep the pipeline full until the end of the run
+    while (sending && (inFlight < result.depth))
+    {
+      link.serial.write(frame, size);
+      sendUs[(head + inFlight) % LINK_BENCH_MAX_DEPTH] = micros();
+      inFlight++;
+    }
+
+    // oldest request without reply : everything in flight is lost
+    if ((inFlight > 0) && (micros() - sendUs[head] > LINK_BENCH_TIMEOUT * 1000UL))
+    {
+      result.timeouts += inFlight;
+      inFlight = 0;
+      nbBytes = 0;
+      resync(link);
+      continue;
+    }
+
+    while (link.serial.available() && (inFlight > 0))
+    {
+      reply[nbBytes++] = link.serial.read();
+
+      // header + size + datas + crc, anything else loses the frame boundaries
+      if ((reply[0] != SERIAL_START_FRAME_ESC_TO_DISPLAY_OK) && (reply[0] != SERIAL_START_FRAME_ESC_TO_DISPLAY_ERR))
+        break;
+      if ((nbBytes >= 2) && ((size_t)reply[1] + 3 > sizeof(reply)))
+        break;
+      if ((nbBytes < 2) || (nbBytes < reply[1] + 3))
+        continue;
+
+      uint32_t timeReply = micros();
+      if ((getCrc(reply, nbBytes) == reply[nbBytes - 1]) && (reply[0] == SERIAL_START_FRAME_ESC_TO_DISPLAY_OK) &&
+          (nbBytes == replySize))
+      {
+        result.transactions++;
+        result.latency.add(timeReply - sendUs[head]);
+        timeLast = timeReply;
+      }
+      else
+        result.errors++;
+
+      head = (head + 1) % LINK_BENCH_MAX_DEPTH;
+      inFlight--;
+      nbBytes = 0;
+    }
+
+    // framing lost : count the oldest request as failed, drop the rest
+    if (nbBytes > 0 && (((reply[0] != SERIAL_START_FRAME_ESC_TO_DISPLAY_OK) && (reply[0] != SERIAL_START_FRAME_ESC_TO_DISPLAY_ERR)) ||
+                        ((nbBytes >= 2) && ((size_t)reply[1] + 3 > sizeof(reply)))))
+    {
+      result.errors++;
+      result.timeouts += inFlight - 1;
+      inFlight = 0;
+      nbBytes = 0;
+      resync(link);
+    }
+  }
+
+  result.durationUs = timeLast - timeStart;
+#if PATCHED_ESP32_FWK
+  result.irqs = link.serial.stats().isr_count;
+#endif
+}
+
+void LinkBench::print(EscLink &link, const LinkBenchResult &result)
+{
+  uint32_t requests = result.transactions + result.errors + result.timeouts;
+
+  Serial.printf("M%d %6d bd / trigger %d / depth %d / %s : %5d tr/s / p50 %5.0f / p95 %5.0f / p99 %5.0f / max %5.0f us / errors %d.%02d %% (%d + %d timeouts)",
+                link.id, result.baud, result.idleTrigger, result.depth, result.set ? "SET REG" : "GET REG",
+                result.durationUs ? (uint32_t)((uint64_t)result.transactions * 1000000 / result.durationUs) : 0,
+                result.latency.quantile(0), result.latency.quantile(1), result.latency.quantile(2), result.latency.max(),
+                requests ? (result.errors + result.timeouts) * 100 / requests : 0,
+                requests ? (result.errors + result.timeouts) * 10000 / requests % 100 : 0,
+                result.errors, result.timeouts);
+#if PATCHED_ESP32_FWK
+  Serial.printf(" / %d.%02d irq per tr", result.transactions ? result.irqs / result.transactions : 0,
+                result.transactions ? result.irqs * 100 / result.transactions % 100 : 0);
+#endif
+  Serial.printf("\n");
+}
+
+#endif
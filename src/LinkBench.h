@@ -0,0 +1,63 @@
+// *******************************************************************
+//  SmartESC link saturation benchmark
+//
+//  Measures what an ESC link can carry : back to back GET REG (status)
+//  or 16 bits REG SET (torque 0) transactions, outside of the state
+//  machine, with 1 to LINK_BENCH_MAX_DEPTH requests in flight. Every
+//  depth runs at each baud rate of the negotiation and, with the
+//  patched HAL, both RX interrupt settings of setUartIrqIdleTrigger() :
+//
+//    0 : interrupt on every received byte
+//    1 : interrupt on the RX timeout (ESC_RX_TIMEOUT), or on the last
+//        byte of the reply with ESC_RX_ADAPTIVE, like the run cycle
+//
+//  One line per configuration : transactions/s, latency p50 / p95 /
+//  p99 / max (request written to reply complete), errors (bad header,
+//  checksum, ESC error reply) and timeouts, and RX interrupts per
+//  transaction. The best error free configuration of each transaction
+//  type closes the report. The link is then set back as it was.
+//
+//  Runs at boot before the session starts, the motor is stopped.
+// *******************************************************************
+
+#ifndef LINK_BENCH_H_
+#define LINK_BENCH_H_
+
+#include <Arduino.h>
+#include "config.h"
+#include "EscLink.h"
+#include "RunningStats.h"
+
+#if LINK_BENCH
+
+typedef struct
+{
+  uint32_t baud;
+  uint8_t idleTrigger;
+  uint8_t depth;
+  bool set;
+
+  uint32_t transactions;
+  uint32_t errors;
+  uint32_t timeouts;
+  uint32_t irqs;
+  uint32_t durationUs;
+  RunningStat latency; // [us]
+} LinkBenchResult;
+
+class LinkBench
+{
+public:
+  void run(EscLink &link);
+
+private:
+  void runConfig(EscLink &link, LinkBenchResult &result);
+  void resync(EscLink &link);
+  void print(EscLink &link, const LinkBenchResult &result);
+};
+
+extern LinkBench linkBench;
+
+#endif
+
+#endif
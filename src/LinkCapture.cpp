@@ -0,0 +1,103 @@
+// *******************************************************************
+//  SmartESC link traffic capture
+// *******************************************************************
+
+#include "LinkCapture.h"
+
+// record : time (4 bytes, LSB first) / link << 1 | dir / size / datas
+#define LINK_CAPTURE_HEADER 6
+#define LINK_CAPTURE_MAX_BURST 255
+
+LinkCapture linkCapture;
+
+void HOT_PATH_ATTR LinkCapture::put(uint8_t b)
+{
+  ring[head] = b;
+  head = (head + 1) % LINK_CAPTURE_SIZE;
+  used++;
+}
+
+uint8_t HOT_PATH_ATTR LinkCapture::get()
+{
+  uint8_t b = ring[tail];
+  tail = (tail + 1) % LINK_CAPTURE_SIZE;
+  used--;
+  return b;
+}
+
+void HOT_PATH_ATTR LinkCapture::dropOldest()
+{
+  uint8_t size = ring[(tail + LINK_CAPTURE_HEADER - 1) % LINK_CAPTURE_SIZE];
+  tail = (tail + LINK_CAPTURE_HEADER + size) % LINK_CAPTURE_SIZE;
+  used -= LINK_CAPTURE_HEADER + size;
+  dropped++;
+}
+
+void HOT_PATH_ATTR LinkCapture::record(uint32_t timeUs, uint8_t link, uint8_t dir, const uint8_t *data, uint16_t size)
+{
+  // long bursts are split in several records with the same time
+  while (size > 0)
+  {
+    uint8_t chunk = size > LINK_CAPTURE_MAX_BURST ? LINK_CAPTURE_MAX_BURST : size;
+
+    // oldest records are overwritten
+    while (used + LINK_CAPTURE_HEADER + chunk > LINK_CAPTURE_SIZE)
+      dropOldest();
+
+    put(timeUs & 0xff);
+    put((timeUs >> 8) & 0xff);
+    put((timeUs >> 16) & 0xff);
+    put((timeUs >> 24) & 0xff);
+    put((link << 1) | dir);
+    put(chunk);
+    for (uint8_t i = 0; i < chunk; i++)
+      put(data[i]);
+
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+void LinkCapture::clear()
+{
+  head = 0;
+  tail = 0;
+  used = 0;
+  dropped = 0;
+}
+
+void LinkCapture::dump(const char *reason)
+{
+  Serial.printf("CAP BEGIN %s dropped=%d\n", reason, dropped);
+
+  while (used >= LINK_CAPTURE_HEADER)
+  {
+    uint32_t timeUs = get();
+    timeUs |= (uint32_t)get() << 8;
+    timeUs |= (uint32_t)get() << 16;
+    timeUs |= (uint32_t)get() << 24;
+    uint8_t linkDir = get();
+    uint8_t size = get();
+
+    Serial.printf("CAP %u %d %c", timeUs, linkDir >> 1, (linkDir & 1) == LINK_CAPTURE_RX ? 'R' : 'T');
+    for (uint8_t i = 0; i < size; i++)
+      Serial.printf(" %02x", get());
+    Serial.printf("\n");
+  }
+
+  Serial.printf("CAP END\n");
+  clear();
+}
+
+void LinkCapture::dumpOnFault(const char *reason)
+{
+#if LINK_CAPTURE_DUMP_ON_FAULT
+  unsigned long timeNow = millis();
+  if (dumped && (timeNow - timeLastDump < DELAY_CAPTURE_DUMP))
+    return;
+
+  dump(reason);
+  timeLastDump = timeNow;
+  dumped = true;
+#endif
+}
@@ -0,0 +1,47 @@
+// *******************************************************************
+//  SmartESC link traffic capture
+//
+//  Always-on RAM ring of every TX / RX byte burst on the ESC links,
+//  timestamped in us. Dumped as text on the console, see
+//  tools/link_replay to replay a dump on the host.
+// *******************************************************************
+
+#ifndef LINK_CAPTURE_H_
+#define LINK_CAPTURE_H_
+
+#include <Arduino.h>
+#include "config.h"
+
+#define LINK_CAPTURE_TX 0
+#define LINK_CAPTURE_RX 1
+
+class LinkCapture
+{
+public:
+  void record(uint32_t timeUs, uint8_t link, uint8_t dir, const uint8_t *data, uint16_t size);
+
+  // print the ring on the console and empty it
+  void dump(const char *reason);
+
+  // dump after a fault, at most once every DELAY_CAPTURE_DUMP
+  void dumpOnFault(const char *reason);
+
+  void clear();
+
+private:
+  void put(uint8_t b);
+  uint8_t get();
+  void dropOldest();
+
+  uint8_t ring[LINK_CAPTURE_SIZE];
+  uint16_t head = 0; // next byte written
+  uint16_t tail = 0; // first byte of the oldest record
+  uint16_t used = 0;
+  uint32_t dropped = 0;
+  unsigned long timeLastDump = 0;
+  bool dumped = false;
+};
+
+extern LinkCapture linkCapture;
+
+#endif
@@ -0,0 +1,127 @@
+// *******************************************************************
+//  SmartESC memory report
+// *******************************************************************
+
+#include "MemoryReport.h"
+#include <esp_heap_caps.h>
+
+MemoryReport memoryReport;
+
+// ########################## ALLOCATOR WRAPPERS ##########################
+
+// updated from any task, core or ISR
+static volatile uint32_t memAllocs = 0;
+static volatile uint32_t memFrees = 0;
+static volatile uint32_t memAllocBytes = 0;
+
+extern "C"
+{
+  void *__real_malloc(size_t size);
+  void *__real_calloc(size_t n, size_t size);
+  void *__real_realloc(void *ptr, size_t size);
+  void __real_free(void *ptr);
+
+  // in IRAM : the allocator may be called with the flash cache disabled
+  void *IRAM_ATTR __wrap_malloc(size_t size)
+  {
+    __sync_fetch_and_add(&memAllocs, 1);
+    __sync_fetch_and_add(&memAllocBytes, size);
+    return __real_malloc(size);
+  }
+
+  void *IRAM_ATTR __wrap_calloc(size_t n, size_t size)
+  {
+    __sync_fetch_and_add(&memAllocs, 1);
+    __sync_fetch_and_add(&memAllocBytes, n * size);
+    return __real_calloc(n, size);
+  }
+
+  // String growth goes through realloc
+  void *IRAM_ATTR __wrap_realloc(void *ptr, size_t size)
+  {
+    __sync_fetch_and_add(&memAllocs, 1);
+    __sync_fetch_and_add(&memAllocBytes, size);
+    return __real_realloc(ptr, size);
+  }
+
+  void IRAM_ATTR __wrap_free(void *ptr)
+  {
+    if (ptr != NULL)
+      __sync_fetch_and_add(&memFrees, 1);
+    __real_free(ptr);
+  }
+}
+
+// ########################## REPORT ##########################
+
+void MemoryReport::begin()
+{
+  addTask("loopTask", xTaskGetCurrentTaskHandle());
+  addTask("IDLE0", xTaskGetIdleTaskHandleForCPU(0));
+  addTask("IDLE1", xTaskGetIdleTaskHandleForCPU(1));
+
+  allocsLastCycle = memAllocs;
+  allocsLastReport = memAllocs;
+  freesLastReport = memFrees;
+  bytesLastReport = memAllocBytes;
+  sample();
+}
+
+void MemoryReport::addTask(const char *name, TaskHandle_t handle)
+{
+  if ((handle == NULL) || (nbTasks >= MEMORY_REPORT_TASKS))
+    return;
+
+  taskNames[nbTasks] = name;
+  taskHandles[nbTasks] = handle;
+  nbTasks++;
+}
+
+void MemoryReport::sample()
+{
+  heapFree = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  heapMin = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  heapLargest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+  // high-water marks are in bytes with ESP-IDF
+  if (nbTasks > 0)
+    loopStackFree = uxTaskGetStackHighWaterMark(taskHandles[0]);
+}
+
+void HOT_PATH_ATTR MemoryReport::controlCycle()
+{
+  uint32_t allocs = memAllocs;
+  uint32_t cycleAllocs = allocs - allocsLastCycle;
+  allocsLastCycle = allocs;
+
+  cycles++;
+  cycleAllocsSum += cycleAllocs;
+  if (cycleAllocs > cycleAllocsMax)
+    cycleAllocsMax = cycleAllocs;
+}
+
+void MemoryReport::print(unsigned long period)
+{
+  sample();
+
+  Serial.printf("memory : heap free = %d / min = %d / largest block = %d / fragmentation = %d %%\n",
+                heapFree, heapMin, heapLargest, heapFree ? 100 - heapLargest * 100 / heapFree : 0);
+  Serial.printf("   allocs = %d / frees = %d / %d bytes in %lu ms / per control cycle avg = %d.%02d / max = %d\n",
+                memAllocs - allocsLastReport, memFrees - freesLastReport, memAllocBytes - bytesLastReport, period,
+                cycles ? cycleAllocsSum / cycles : 0, cycles ? (cycleAllocsSum * 100 / cycles) % 100 : 0, cycleAllocsMax);
+
+  Serial.printf("   stack free :");
+  for (uint8_t i = 0; i < nbTasks; i++)
+    Serial.printf(" %s = %d", taskNames[i], uxTaskGetStackHighWaterMark(taskHandles[i]));
+  Serial.printf("\n");
+}
+
+void MemoryReport::resetStats()
+{
+  allocsLastReport = memAllocs;
+  freesLastReport = memFrees;
+  bytesLastReport = memAllocBytes;
+  cycles = 0;
+  cycleAllocsSum = 0;
+  cycleAllocsMax = 0;
+}
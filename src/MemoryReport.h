@@ -0,0 +1,63 @@
+// *******************************************************************
+//  SmartESC memory report
+//
+//  Stack high-water marks of the known tasks, heap free / minimum /
+//  largest block, and heap allocations per control cycle.
+//
+//  Allocations are counted by wrapping malloc / calloc / realloc / free
+//  at link time (build_flags of platformio.ini), so the String, log and
+//  operator new allocations of the framework are counted too. The ROM
+//  functions calling the allocator through the syscall table are not.
+//
+//  The static RAM / IRAM budget is checked on the build output by
+//  tools/mem_budget.py.
+// *******************************************************************
+
+#ifndef MEMORY_REPORT_H_
+#define MEMORY_REPORT_H_
+
+#include <Arduino.h>
+#include "config.h"
+
+#define MEMORY_REPORT_TASKS 8
+
+class MemoryReport
+{
+public:
+  // registers the calling task (loop) and the idle tasks
+  void begin();
+  void addTask(const char *name, TaskHandle_t handle);
+
+  // heap and stack low-water marks, takes the heap lock : call it at a low rate
+  void sample();
+
+  // end of a control cycle (torque write), allocations since the previous one
+  void controlCycle();
+
+  void print(unsigned long period);
+  void resetStats();
+
+  // last sample, also published in the telemetry snapshot
+  uint32_t heapFree = 0;
+  uint32_t heapMin = 0;
+  uint32_t heapLargest = 0;
+  uint32_t loopStackFree = 0; // [bytes] lowest free stack of the loop task
+
+private:
+  const char *taskNames[MEMORY_REPORT_TASKS];
+  TaskHandle_t taskHandles[MEMORY_REPORT_TASKS];
+  uint8_t nbTasks = 0;
+
+  // allocations, reset at each report
+  uint32_t allocsLastCycle = 0;
+  uint32_t cycles = 0;
+  uint32_t cycleAllocsSum = 0;
+  uint32_t cycleAllocsMax = 0;
+  uint32_t allocsLastReport = 0;
+  uint32_t freesLastReport = 0;
+  uint32_t bytesLastReport = 0;
+};
+
+extern MemoryReport memoryReport;
+
+#endif
@@ -0,0 +1,109 @@
+// *******************************************************************
+//  Xtensa performance counters
+// *******************************************************************
+
+#include "PerfCounters.h"
+
+// performance monitor registers, external register interface (RER / WER)
+#define ERI_PERFMON_PGM 0x101000
+#define ERI_PERFMON_PM0 0x101080
+#define ERI_PERFMON_PMCTRL0 0x101100
+#define ERI_PERFMON_PMSTAT0 0x101180
+
+#define PMCTRL_KRNLCNT_SHIFT 3
+#define PMCTRL_TRACELEVEL_SHIFT 4
+#define PMCTRL_SELECT_SHIFT 8
+#define PMCTRL_MASK_SHIFT 16
+
+// event selectors and masks, see xtensa_perfmon_masks.h of ESP-IDF 4.x
+#define XTPERF_CNT_CYCLES 0
+#define XTPERF_CNT_INSN 2
+#define XTPERF_CNT_D_STALL 3
+#define XTPERF_CNT_I_STALL 4
+#define XTPERF_MASK_CYCLES 0x0001
+#define XTPERF_MASK_INSN_ALL 0x8dff
+#define XTPERF_MASK_D_STALL_CACHE_MISS 0x0004
+#define XTPERF_MASK_I_STALL_CACHE_MISS 0x0001
+
+static const uint16_t perfEvents[PERF_COUNTERS][2] = {
+    {XTPERF_CNT_CYCLES, XTPERF_MASK_CYCLES},
+    {XTPERF_CNT_INSN, XTPERF_MASK_INSN_ALL},
+    {XTPERF_CNT_I_STALL, XTPERF_MASK_I_STALL_CACHE_MISS},
+    {XTPERF_CNT_D_STALL, XTPERF_MASK_D_STALL_CACHE_MISS}};
+
+static inline uint32_t eriRead(uint32_t addr)
+{
+  uint32_t value;
+  asm volatile("rer %0, %1"
+               : "=r"(value)
+               : "r"(addr));
+  return value;
+}
+
+static inline void eriWrite(uint32_t addr, uint32_t value)
+{
+  asm volatile("wer %0, %1"
+               :
+               : "r"(value), "r"(addr));
+}
+
+void PerfCounters::begin()
+{
+  // stop all counters while they are programmed
+  eriWrite(ERI_PERFMON_PGM, 0);
+
+  for (uint8_t i = 0; i < PERF_COUNTERS; i++)
+  {
+    // count at every interrupt level, kernel mode included
+    eriWrite(ERI_PERFMON_PMCTRL0 + i * 4,
+             ((uint32_t)perfEvents[i][0] << PMCTRL_SELECT_SHIFT) |
+                 ((uint32_t)perfEvents[i][1] << PMCTRL_MASK_SHIFT) |
+                 (1 << PMCTRL_KRNLCNT_SHIFT) |
+                 (15 << PMCTRL_TRACELEVEL_SHIFT));
+    eriWrite(ERI_PERFMON_PMSTAT0 + i * 4, 0);
+    eriWrite(ERI_PERFMON_PM0 + i * 4, 0);
+  }
+
+  eriWrite(ERI_PERFMON_PGM, 1);
+  reset();
+}
+
+void IRAM_ATTR PerfCounters::start()
+{
+  for (uint8_t i = 0; i < PERF_COUNTERS; i++)
+    startValues[i] = eriRead(ERI_PERFMON_PM0 + i * 4);
+}
+
+void IRAM_ATTR PerfCounters::stop()
+{
+  for (uint8_t i = 0; i < PERF_COUNTERS; i++)
+  {
+    uint32_t value = eriRead(ERI_PERFMON_PM0 + i * 4) - startValues[i];
+    sums[i] += value;
+    if (value > maxs[i])
+      maxs[i] = value;
+  }
+  windows++;
+}
+
+void PerfCounters::print(const char *name, unsigned long period)
+{
+  uint32_t n = windows ? windows : 1;
+
+  Serial.printf("%s : %d windows in %lu ms\n", name, windows, period);
+  Serial.printf("   avg : cycles = %d / insn = %d / I miss = %d / D miss = %d\n",
+                (uint32_t)(sums[PERF_CYCLES] / n), (uint32_t)(sums[PERF_INSN] / n),
+                (uint32_t)(sums[PERF_I_STALL] / n), (uint32_t)(sums[PERF_D_STALL] / n));
+  Serial.printf("   max : cycles = %d / insn = %d / I miss = %d / D miss = %d\n",
+                maxs[PERF_CYCLES], maxs[PERF_INSN], maxs[PERF_I_STALL], maxs[PERF_D_STALL]);
+}
+
+void PerfCounters::reset()
+{
+  for (uint8_t i = 0; i < PERF_COUNTERS; i++)
+  {
+    sums[i] = 0;
+    maxs[i] = 0;
+  }
+  windows = 0;
+}
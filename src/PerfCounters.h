@@ -0,0 +1,49 @@
+// *******************************************************************
+//  Xtensa performance counters
+//
+//  Cycles, committed instructions and instruction / data cache miss
+//  stall cycles of the calling core, read around a code window. Every
+//  function and constant outside IRAM / DRAM is fetched through the
+//  flash cache, a miss costs a SPI flash read, a flash write stops the
+//  cache for both cores. Store buffer and busy stalls are not counted.
+//
+//  The counters are per core and count everything run on it between
+//  start() and stop(), interrupts and preempting tasks included.
+// *******************************************************************
+
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <Arduino.h>
+
+#define PERF_COUNTERS 4
+
+enum
+{
+  PERF_CYCLES = 0,
+  PERF_INSN,
+  PERF_I_STALL,
+  PERF_D_STALL
+};
+
+class PerfCounters
+{
+public:
+  // program and start the counters of the calling core
+  void begin();
+
+  // counted window, to call on the core given to begin()
+  void start();
+  void stop();
+
+  void print(const char *name, unsigned long period);
+  void reset();
+
+private:
+  uint32_t startValues[PERF_COUNTERS] = {};
+  uint64_t sums[PERF_COUNTERS] = {};
+  uint32_t maxs[PERF_COUNTERS] = {};
+  uint32_t windows = 0;
+};
+
+#endif
@@ -0,0 +1,146 @@
+// *******************************************************************
+//  SmartESC power management
+// *******************************************************************
+
+#include "PowerManager.h"
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <driver/uart.h>
+
+PowerManager powerManager;
+
+void PowerManager::begin()
+{
+#if POWER_LIGHT_SLEEP
+  // console : a few characters wake up, they are lost
+  uart_set_wakeup_threshold(UART_NUM_0, POWER_UART_WAKE_EDGES);
+  esp_sleep_enable_uart_wakeup(UART_NUM_0);
+#endif
+  timeAccountUs = esp_timer_get_time();
+}
+
+void PowerManager::addUart(HardwareSerial &serial)
+{
+  if (nbUarts < POWER_MAX_UARTS)
+    uarts[nbUarts++] = &serial;
+}
+
+void PowerManager::account()
+{
+  int64_t timeNow = esp_timer_get_time();
+  if (parked)
+    parkedUs += timeNow - timeAccountUs;
+  else
+    activeUs += timeNow - timeAccountUs;
+  timeAccountUs = timeNow;
+}
+
+void PowerManager::update(unsigned long timeNow, bool idle)
+{
+  if (!idle)
+    timeIdleSince = timeNow;
+
+  bool park = idle && (timeNow - timeIdleSince >= POWER_PARK_DELAY);
+  if (park == parked)
+    return;
+
+  account();
+  parked = park;
+  setCpuFrequencyMhz(parked ? POWER_PARKED_CPU_MHZ : POWER_ACTIVE_CPU_MHZ);
+  Serial.printf("power : %s / CPU %d MHz / APB %d Hz\n", parked ? "parked" : "active", getCpuFrequencyMhz(), getApbFrequency());
+}
+
+void PowerManager::idle(uint32_t idleTimeMs)
+{
+#if POWER_LIGHT_SLEEP && !BLE_TELEMETRY
+  // the BT controller does not allow light sleep
+  if (parked && !sleepFailed && (idleTimeMs >= POWER_SLEEP_MIN))
+  {
+    lightSleep(idleTimeMs < POWER_SLEEP_MAX ? idleTimeMs : POWER_SLEEP_MAX);
+    return;
+  }
+#endif
+
+  delay(1);
+  account();
+}
+
+void PowerManager::lightSleep(uint32_t timeMs)
+{
+  account();
+
+  // the UART clocks stop in light sleep, bytes still in the TX FIFOs would be lost
+  for (uint8_t i = 0; i < nbUarts; i++)
+  {
+#if PATCHED_ESP32_FWK
+    uarts[i]->waitTxIdle();
+#else
+    uarts[i]->flush();
+#endif
+  }
+
+  esp_sleep_enable_timer_wakeup(timeMs * 1000ULL);
+  int64_t timeStart = esp_timer_get_time();
+  esp_err_t err = esp_light_sleep_start();
+  int64_t timeEnd = esp_timer_get_time();
+
+  if (err != ESP_OK)
+  {
+    Serial.printf("power : light sleep failed (%d), disabled\n", err);
+    sleepFailed = true;
+    return;
+  }
+
+  sleeps++;
+  sleepUs += timeEnd - timeStart;
+  timeAccountUs = timeEnd;
+
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER)
+  {
+    // overshoot of the timer : sleep entry and wake up (clocks, flash)
+    int64_t latency = (timeEnd - timeStart) - timeMs * 1000LL;
+    if (latency < 0)
+      latency = 0;
+    wakeCount++;
+    wakeSumUs += latency;
+    if (latency > wakeMaxUs)
+      wakeMaxUs = latency;
+  }
+  else
+  {
+    uartWakes++;
+  }
+}
+
+void PowerManager::printStats(unsigned long period)
+{
+  account();
+
+  uint64_t totalUs = activeUs + parkedUs + sleepUs;
+  if (totalUs == 0)
+    totalUs = 1;
+
+  // [uA] time weighted
+  uint32_t current = (uint32_t)((activeUs * POWER_CURRENT_ACTIVE + parkedUs * POWER_CURRENT_PARKED +
+                                 sleepUs * POWER_CURRENT_LIGHT_SLEEP) /
+                                totalUs);
+
+  Serial.printf("power : %s / active %d %% / parked %d %% / light sleep %d %% in %lu ms / estimated %d.%d mA (%d mAh/day)\n",
+                parked ? "parked" : "active",
+                (uint32_t)(activeUs * 100 / totalUs), (uint32_t)(parkedUs * 100 / totalUs), (uint32_t)(sleepUs * 100 / totalUs),
+                period, current / 1000, (current % 1000) / 100, current * 24 / 1000);
+  Serial.printf("   %d sleeps / %d console wakes / wake latency avg = %d us / max = %d us\n",
+                sleeps, uartWakes, wakeCount ? wakeSumUs / wakeCount : 0, wakeMaxUs);
+}
+
+void PowerManager::resetStats()
+{
+  activeUs = 0;
+  parkedUs = 0;
+  sleepUs = 0;
+  sleeps = 0;
+  uartWakes = 0;
+  wakeCount = 0;
+  wakeSumUs = 0;
+  wakeMaxUs = 0;
+}
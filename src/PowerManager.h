@@ -0,0 +1,68 @@
+// *******************************************************************
+//  SmartESC power management
+//
+//  Parked (inputs released, motors stopped for POWER_PARK_DELAY) :
+//  - CPU at POWER_PARKED_CPU_MHZ. From 80 MHz up the APB clock stays at
+//    80 MHz, the UART dividers stay valid and the patched APB change
+//    callback lets the links run through the change.
+//  - the links poll the ESC every POWER_PARKED_STEP_DELAY
+//  - POWER_LIGHT_SLEEP : light sleep between the polls, woken by the
+//    timer of the next poll (at most POWER_SLEEP_MAX, the input sampling
+//    period) or by the console UART. Never while a reply is due.
+//
+//  Any input or motor speed unparks at the next loop pass. The time
+//  spent in each mode gives a current estimate from POWER_CURRENT_*.
+// *******************************************************************
+
+#ifndef POWER_MANAGER_H_
+#define POWER_MANAGER_H_
+
+#include <Arduino.h>
+#include "config.h"
+
+#define POWER_MAX_UARTS 3
+
+class PowerManager
+{
+public:
+  void begin();
+
+  // UARTs to drain before a light sleep
+  void addUart(HardwareSerial &serial);
+
+  // idle : inputs released and motors stopped, parks after POWER_PARK_DELAY
+  void update(unsigned long timeNow, bool idle);
+  bool isParked() const { return parked; }
+
+  // end of the loop pass, idleTimeMs : time no link needs the CPU
+  void idle(uint32_t idleTimeMs);
+
+  void printStats(unsigned long period);
+  void resetStats();
+
+private:
+  void account();
+  void lightSleep(uint32_t timeMs);
+
+  HardwareSerial *uarts[POWER_MAX_UARTS];
+  uint8_t nbUarts = 0;
+
+  bool parked = false;
+  bool sleepFailed = false;
+  unsigned long timeIdleSince = 0;
+
+  // time in each mode, reset at each report
+  int64_t timeAccountUs = 0;
+  uint64_t activeUs = 0;
+  uint64_t parkedUs = 0;
+  uint64_t sleepUs = 0;
+  uint32_t sleeps = 0;
+  uint32_t uartWakes = 0;
+  uint32_t wakeCount = 0;
+  uint32_t wakeSumUs = 0;
+  uint32_t wakeMaxUs = 0;
+};
+
+extern PowerManager powerManager;
+
+#endif
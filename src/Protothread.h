@@ -0,0 +1,58 @@
+// *******************************************************************
+//  Protothreads
+//
+//  Stackless coroutines, Duff's device style : the resume point is the
+//  source line of the last wait, kept in a 2 bytes local continuation,
+//  and the body of the thread is a switch on it.
+//
+//  Rules inside a thread body :
+//  - locals do not survive a wait, keep the thread state in members
+//  - no switch statement
+//  - at most one wait per source line
+//
+//  A thread returns PT_WAITING until it reaches PT_END.
+// *******************************************************************
+
+#ifndef PROTOTHREAD_H_
+#define PROTOTHREAD_H_
+
+#include <stdint.h>
+
+typedef uint16_t Pt;
+
+#define PT_WAITING 0
+#define PT_ENDED 1
+
+#define PT_INIT(pt) (pt) = 0
+
+#define PT_BEGIN(pt) \
+  switch (pt)        \
+  {                  \
+  case 0:
+
+#define PT_END(pt) \
+  }                \
+  (pt) = 0;        \
+  return PT_ENDED
+
+// resume here until cond is true
+#define PT_WAIT_UNTIL(pt, cond) \
+  do                            \
+  {                             \
+    (pt) = __LINE__;            \
+  case __LINE__:                \
+    if (!(cond))                \
+      return PT_WAITING;        \
+  } while (0)
+
+#define PT_WAIT_WHILE(pt, cond) PT_WAIT_UNTIL(pt, !(cond))
+
+// run a child thread from its beginning until it ends
+#define PT_SPAWN(pt, child, thread) \
+  do                                \
+  {                                 \
+    PT_INIT(child);                 \
+    PT_WAIT_UNTIL(pt, (thread) != PT_WAITING); \
+  } while (0)
+
+#endif
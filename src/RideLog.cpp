@@ -0,0 +1,336 @@
+// *******************************************************************
+//  SmartESC ride log
+// *******************************************************************
+
+#include "RideLog.h"
+
+#if RIDE_LOG
+
+#include <FS.h>
+#include <SPIFFS.h>
+#include <Preferences.h>
+
+RideLog rideLog;
+
+void RideLog::begin(uint8_t links)
+{
+  nbLinks = links;
+
+  if (!SPIFFS.begin(true))
+  {
+    Serial.printf("ride log : no file system\n");
+    return;
+  }
+
+  Preferences preferences;
+  preferences.begin(NVS_NAMESPACE, false);
+  ride = preferences.getUShort(RIDE_LOG_NVS_KEY, 0) + 1;
+  preferences.putUShort(RIDE_LOG_NVS_KEY, ride);
+  preferences.end();
+
+  snprintf(logName, sizeof(logName), "/r%05u.log", ride);
+  snprintf(indexName, sizeof(indexName), "/r%05u.idx", ride);
+
+  freeQueue = xQueueCreate(RIDE_LOG_BUFFERS, sizeof(int8_t));
+  fullQueue = xQueueCreate(RIDE_LOG_BUFFERS, sizeof(int8_t));
+  for (int8_t i = 0; i < RIDE_LOG_BUFFERS; i++)
+    xQueueSend(freeQueue, &i, 0);
+
+  xTaskCreatePinnedToCore(task, "rideLog", RIDE_LOG_TASK_STACK, this,
+                          RIDE_LOG_TASK_PRIORITY, &taskHandle, RIDE_LOG_TASK_CORE);
+
+  ready = true;
+  Serial.printf("ride log : ride %d / %d of %d bytes used\n", ride, SPIFFS.usedBytes(), SPIFFS.totalBytes());
+}
+
+// ########################## LOOP SIDE ##########################
+
+bool RideLog::takeBuffer()
+{
+  if (xQueueReceive(freeQueue, &current, 0) != pdTRUE)
+  {
+    current = -1;
+    return false;
+  }
+  encoder.begin(buffers[current], ride, nbLinks);
+  return true;
+}
+
+void RideLog::handOver()
+{
+  // never full, there are as many slots as buffers
+  xQueueSend(fullQueue, &current, 0);
+  current = -1;
+}
+
+void RideLog::add(const RideLogSample &sample)
+{
+  if (!ready || failed)
+    return;
+
+  if ((current < 0) && !takeBuffer())
+  {
+    drops++;
+    return;
+  }
+
+  uint16_t used = encoder.used();
+  if (!encoder.add(sample))
+  {
+    handOver();
+    if (!takeBuffer())
+    {
+      drops++;
+      return;
+    }
+    used = encoder.used();
+    encoder.add(sample);
+  }
+
+  samples++;
+  encodedBytes += encoder.used() - used;
+}
+
+void RideLog::update(unsigned long timeNow)
+{
+  if ((current >= 0) && (encoder.count() > 0) && (timeNow - encoder.firstTimeMs() > RIDE_LOG_FLUSH))
+    handOver();
+}
+
+// ########################## WRITER TASK ##########################
+
+void RideLog::task(void *arg)
+{
+  RideLog *log = (RideLog *)arg;
+  int8_t index;
+
+  while (true)
+  {
+    xQueueReceive(log->fullQueue, &index, portMAX_DELAY);
+    if (!log->failed)
+      log->writeBlock(log->buffers[index]);
+    xQueueSend(log->freeQueue, &index, portMAX_DELAY);
+  }
+}
+
+// delete the oldest rides until RIDE_LOG_FREE_BLOCKS are free
+bool RideLog::makeRoom()
+{
+  while (SPIFFS.totalBytes() - SPIFFS.usedBytes() < RIDE_LOG_FREE_BLOCKS * RIDE_LOG_BLOCK_SIZE)
+  {
+    unsigned oldest = 0xffff;
+    File root = SPIFFS.open("/");
+    File file = root.openNextFile();
+    while (file)
+    {
+      unsigned fileRide;
+      if ((sscanf(file.name(), "/r%u.log", &fileRide) == 1) && (fileRide != ride) && (fileRide < oldest))
+        oldest = fileRide;
+      file = root.openNextFile();
+    }
+
+    if (oldest == 0xffff)
+      return false;
+
+    char name[16];
+    snprintf(name, sizeof(name), "/r%05u.log", oldest);
+    SPIFFS.remove(name);
+    snprintf(name, sizeof(name), "/r%05u.idx", oldest);
+    SPIFFS.remove(name);
+    ridesDeleted++;
+  }
+  return true;
+}
+
+void RideLog::writeBlock(const uint8_t *block)
+{
+  uint32_t timeStart = micros();
+
+  if (!makeRoom())
+  {
+    Serial.printf("ride log : file system full, stopped\n");
+    failed = true;
+    return;
+  }
+
+  // one flash page per write : each program stops the flash cache of both cores for one page only
+  File file = SPIFFS.open(logName, FILE_APPEND);
+  size_t written = 0;
+  for (uint16_t pos = 0; file && (pos < RIDE_LOG_BLOCK_SIZE); pos += RIDE_LOG_WRITE_CHUNK)
+  {
+    written += file.write(&block[pos], RIDE_LOG_WRITE_CHUNK);
+    vTaskDelay(1);
+  }
+  file.close();
+
+  // the block offsets are implied by the index, a short write breaks them
+  if (written != RIDE_LOG_BLOCK_SIZE)
+  {
+    Serial.printf("ride log : write error, stopped\n");
+    failed = true;
+    return;
+  }
+
+  const RideLogBlockHeader *header = (const RideLogBlockHeader *)block;
+  RideLogIndexEntry entry = {header->firstTimeMs, header->lastTimeMs};
+  File index = SPIFFS.open(indexName, FILE_APPEND);
+  index.write((const uint8_t *)&entry, sizeof(entry));
+  index.close();
+
+  blocksWritten++;
+  uint32_t duration = micros() - timeStart;
+  if (duration > writeMaxUs)
+    writeMaxUs = duration;
+}
+
+// ########################## READ BACK ##########################
+
+void RideLog::printSample(const RideLogSample &sample, uint8_t links)
+{
+  Serial.printf("RIDE %u,%d,%d", sample.timeMs, sample.throttle, sample.brake);
+  for (uint8_t i = 0; i < links; i++)
+    Serial.printf(",%d,%d,%u,%d,%d", sample.torque[i], sample.speed[i], sample.flags[i], sample.state[i], sample.status[i]);
+  Serial.printf("\n");
+}
+
+void RideLog::requestDump(uint32_t fromMs, uint32_t toMs)
+{
+  if (!ready)
+    return;
+
+  Serial.printf("RIDE BEGIN ride %d / %u - %u ms\n", ride, fromMs, toMs);
+  Serial.printf("RIDE time_ms,throttle,brake");
+  for (uint8_t i = 0; i < nbLinks; i++)
+    Serial.printf(",torque%d,speed%d,flags%d,state%d,status%d", i, i, i, i, i);
+  Serial.printf("\n");
+
+  // blocks on flash : binary search of the first block ending after fromMs
+  File index = SPIFFS.open(indexName, FILE_READ);
+  uint32_t nbBlocks = index ? index.size() / sizeof(RideLogIndexEntry) : 0;
+  uint32_t low = 0;
+  uint32_t high = nbBlocks;
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    RideLogIndexEntry entry;
+    index.seek(mid * sizeof(entry));
+    index.read((uint8_t *)&entry, sizeof(entry));
+    if (entry.lastTimeMs < fromMs)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  index.close();
+
+  dumpStage = DUMP_FLASH;
+  dumpFromMs = fromMs;
+  dumpToMs = toMs;
+  dumpNextBlock = low;
+  dumpSamples = 0;
+  dumpDecoding = false;
+}
+
+RideLog::DumpLoad RideLog::loadDumpBlock()
+{
+  if (dumpStage == DUMP_FLASH)
+  {
+    File index = SPIFFS.open(indexName, FILE_READ);
+    uint32_t nbBlocks = index ? index.size() / sizeof(RideLogIndexEntry) : 0;
+    index.close();
+
+    if (dumpNextBlock < nbBlocks)
+    {
+      File file = SPIFFS.open(logName, FILE_READ);
+      bool valid = file && file.seek(dumpNextBlock * RIDE_LOG_BLOCK_SIZE) &&
+                   (file.read(dumpBlock, RIDE_LOG_BLOCK_SIZE) == RIDE_LOG_BLOCK_SIZE) && dumpDecoder.begin(dumpBlock);
+      file.close();
+      dumpNextBlock++;
+      if (!valid || (dumpDecoder.header().firstTimeMs > dumpToMs))
+        return DUMP_LOAD_END;
+      return DUMP_LOAD_OK;
+    }
+
+    // handed over blocks : every buffer but the current one back in freeQueue once written
+    if (uxQueueMessagesWaiting(freeQueue) + (current >= 0 ? 1 : 0) < RIDE_LOG_BUFFERS)
+      return DUMP_LOAD_WAIT;
+    dumpStage = DUMP_RAM;
+  }
+
+  // samples still in RAM, copied : the buffer may be handed over before the end of the dump
+  if ((dumpStage == DUMP_RAM) && (current >= 0))
+  {
+    dumpStage = DUMP_LAST;
+    memcpy(dumpBlock, buffers[current], RIDE_LOG_BLOCK_SIZE);
+    if (dumpDecoder.begin(dumpBlock))
+      return DUMP_LOAD_OK;
+  }
+
+  return DUMP_LOAD_END;
+}
+
+void RideLog::dump()
+{
+  if (dumpStage == DUMP_NONE)
+    return;
+
+  // at most one block read per pass
+  bool loaded = false;
+  RideLogSample sample;
+  uint8_t n = 0;
+  while (n < RIDE_LOG_DUMP_ROWS)
+  {
+    if (!dumpDecoding)
+    {
+      if (loaded)
+        return;
+      DumpLoad load = loadDumpBlock();
+      if (load == DUMP_LOAD_WAIT)
+        return;
+      if (load == DUMP_LOAD_END)
+      {
+        Serial.printf("RIDE END %u samples\n", dumpSamples);
+        dumpStage = DUMP_NONE;
+        return;
+      }
+      loaded = true;
+      dumpDecoding = true;
+    }
+
+    if (!dumpDecoder.next(sample))
+    {
+      dumpDecoding = false;
+      continue;
+    }
+    if ((sample.timeMs >= dumpFromMs) && (sample.timeMs <= dumpToMs))
+    {
+      printSample(sample, nbLinks);
+      dumpSamples++;
+      n++;
+    }
+  }
+}
+
+// ########################## STATS ##########################
+
+void RideLog::printStats(unsigned long period)
+{
+  if (!ready)
+    return;
+
+  Serial.printf("ride log : ride %d / %d samples in %lu ms / %d.%02d bytes per sample (raw %d) / %d drops%s\n",
+                ride, samples, period,
+                samples ? encodedBytes / samples : 0, samples ? (encodedBytes * 100 / samples) % 100 : 0,
+                sizeof(RideLogSample), drops, failed ? " / STOPPED" : "");
+  Serial.printf("   %d blocks written / write max = %d ms / %d old rides deleted / %d of %d bytes used\n",
+                blocksWritten, writeMaxUs / 1000, ridesDeleted, SPIFFS.usedBytes(), SPIFFS.totalBytes());
+}
+
+void RideLog::resetStats()
+{
+  samples = 0;
+  drops = 0;
+  encodedBytes = 0;
+  writeMaxUs = 0;
+}
+
+#endif
@@ -0,0 +1,113 @@
+// *******************************************************************
+//  SmartESC ride log
+//
+//  Every control tick sample goes into a RAM block (RideLogBlock.h).
+//  Full blocks are handed over to a background task that appends them
+//  to the ride file on SPIFFS in flash page chunks, then appends the
+//  first / last sample times of the block to the index file. A time
+//  range is read back from the index then only the blocks it covers,
+//  a few samples per loop pass so the links keep running. Blocks
+//  handed over but not written yet are printed once on flash.
+//
+//  The loop never waits : without a free RAM block (flash too slow)
+//  the sample is dropped and counted.
+//
+//  One file pair per boot : /rNNNNN.log and /rNNNNN.idx, the ride
+//  number is kept in NVS. The oldest rides are deleted to keep
+//  RIDE_LOG_FREE_BLOCKS free.
+// *******************************************************************
+
+#ifndef RIDE_LOG_H_
+#define RIDE_LOG_H_
+
+#include <Arduino.h>
+#include "config.h"
+#include "RideLogBlock.h"
+
+#if RIDE_LOG
+
+class RideLog
+{
+public:
+  // mount the file system, open a new ride and start the writer task
+  void begin(uint8_t nbLinks);
+
+  // control path, never blocks
+  void add(const RideLogSample &sample);
+
+  // hands over a block whose first sample is older than RIDE_LOG_FLUSH
+  void update(unsigned long timeNow);
+
+  // current ride samples from fromMs to toMs on the console, "RIDE" lines
+  void requestDump(uint32_t fromMs, uint32_t toMs);
+
+  // prints a few pending samples, call every loop pass
+  void dump();
+
+  void printStats(unsigned long period);
+  void resetStats();
+
+  TaskHandle_t taskHandle = NULL;
+
+private:
+  static void task(void *arg);
+  bool takeBuffer();
+  void handOver();
+  void writeBlock(const uint8_t *block);
+  bool makeRoom();
+  void printSample(const RideLogSample &sample, uint8_t links);
+
+  enum DumpStage
+  {
+    DUMP_NONE,
+    DUMP_FLASH, // blocks of the index, then those waiting for the writer
+    DUMP_RAM,   // block being filled
+    DUMP_LAST
+  };
+  enum DumpLoad
+  {
+    DUMP_LOAD_OK,
+    DUMP_LOAD_WAIT, // the writer still holds blocks
+    DUMP_LOAD_END
+  };
+  DumpLoad loadDumpBlock();
+
+  uint8_t buffers[RIDE_LOG_BUFFERS][RIDE_LOG_BLOCK_SIZE];
+  QueueHandle_t freeQueue = NULL;
+  QueueHandle_t fullQueue = NULL;
+  int8_t current = -1;
+  RideLogEncoder encoder;
+
+  bool ready = false;
+  uint16_t ride = 0;
+  uint8_t nbLinks = 1;
+  char logName[16];
+  char indexName[16];
+
+  // dump in progress, one block decoded at a time
+  DumpStage dumpStage = DUMP_NONE;
+  uint32_t dumpFromMs = 0;
+  uint32_t dumpToMs = 0;
+  uint32_t dumpNextBlock = 0;
+  uint32_t dumpSamples = 0;
+  bool dumpDecoding = false;
+  uint8_t dumpBlock[RIDE_LOG_BLOCK_SIZE];
+  RideLogDecoder dumpDecoder;
+
+  // updated by the writer task
+  volatile bool failed = false;
+  volatile uint32_t blocksWritten = 0;
+  volatile uint32_t writeMaxUs = 0;
+  volatile uint32_t ridesDeleted = 0;
+
+  // reset at each report
+  uint32_t samples = 0;
+  uint32_t drops = 0;
+  uint32_t encodedBytes = 0;
+};
+
+extern RideLog rideLog;
+
+#endif
+
+#endif
@@ -0,0 +1,159 @@
+// *******************************************************************
+//  SmartESC ride log block
+// *******************************************************************
+
+#include <string.h>
+#include "RideLogBlock.h"
+
+static uint8_t getFields(const RideLogSample &sample, uint8_t nbLinks, int32_t *fields)
+{
+  uint8_t n = 0;
+  fields[n++] = sample.throttle;
+  fields[n++] = sample.brake;
+  for (uint8_t i = 0; i < nbLinks; i++)
+  {
+    fields[n++] = sample.torque[i];
+    fields[n++] = sample.speed[i];
+    fields[n++] = (int32_t)sample.flags[i];
+    fields[n++] = sample.state[i];
+    fields[n++] = sample.status[i];
+  }
+  return n;
+}
+
+static void setFields(RideLogSample &sample, uint8_t nbLinks, const int32_t *fields)
+{
+  uint8_t n = 0;
+  memset(&sample, 0, sizeof(sample));
+  sample.throttle = fields[n++];
+  sample.brake = fields[n++];
+  for (uint8_t i = 0; i < nbLinks; i++)
+  {
+    sample.torque[i] = fields[n++];
+    sample.speed[i] = fields[n++];
+    sample.flags[i] = (uint32_t)fields[n++];
+    sample.state[i] = fields[n++];
+    sample.status[i] = fields[n++];
+  }
+}
+
+// ########################## ENCODER ##########################
+
+void RideLogEncoder::begin(uint8_t *buffer, uint16_t ride, uint8_t nbLinks)
+{
+  if (nbLinks > RIDE_LOG_LINKS)
+    nbLinks = RIDE_LOG_LINKS;
+
+  block = buffer;
+  memset(block, 0xff, RIDE_LOG_BLOCK_SIZE);
+
+  RideLogBlockHeader *h = header();
+  h->magic[0] = 'R';
+  h->magic[1] = 'L';
+  h->format = RIDE_LOG_FORMAT;
+  h->nbLinks = nbLinks;
+  h->ride = ride;
+  h->count = 0;
+  h->used = sizeof(RideLogBlockHeader);
+  h->firstTimeMs = 0;
+  h->lastTimeMs = 0;
+
+  memset(previous, 0, sizeof(previous));
+  previousTimeMs = 0;
+}
+
+bool RideLogEncoder::add(const RideLogSample &sample)
+{
+  RideLogBlockHeader *h = header();
+
+  uint8_t encoded[RIDE_LOG_MAX_SAMPLE];
+  uint8_t size = 0;
+  int32_t fields[RIDE_LOG_FIELDS];
+  uint32_t mask = 0;
+
+  uint8_t nbFields = getFields(sample, h->nbLinks, fields);
+  for (uint8_t i = 0; i < nbFields; i++)
+  {
+    if (fields[i] != previous[i])
+      mask |= 1 << i;
+  }
+
+  // the first sample of a block is a delta from 0, a block decodes alone
+  size += putVarint(&encoded[size], sample.timeMs - previousTimeMs);
+  size += putVarint(&encoded[size], mask);
+  for (uint8_t i = 0; i < nbFields; i++)
+  {
+    if (mask & (1 << i))
+      size += putVarint(&encoded[size], zigzag((int32_t)((uint32_t)fields[i] - (uint32_t)previous[i])));
+  }
+
+  if ((h->used + size > RIDE_LOG_BLOCK_SIZE) || (h->count == 0xffff))
+    return false;
+
+  memcpy(&block[h->used], encoded, size);
+  h->used += size;
+  if (h->count == 0)
+    h->firstTimeMs = sample.timeMs;
+  h->lastTimeMs = sample.timeMs;
+  h->count++;
+
+  previousTimeMs = sample.timeMs;
+  memcpy(previous, fields, sizeof(previous));
+  return true;
+}
+
+// ########################## DECODER ##########################
+
+bool RideLogDecoder::begin(const uint8_t *data)
+{
+  block = data;
+  const RideLogBlockHeader &h = header();
+
+  if ((h.magic[0] != 'R') || (h.magic[1] != 'L') || (h.format != RIDE_LOG_FORMAT) ||
+      (h.nbLinks > RIDE_LOG_LINKS) || (h.used > RIDE_LOG_BLOCK_SIZE) || (h.used < sizeof(RideLogBlockHeader)))
+    return false;
+
+  pos = sizeof(RideLogBlockHeader);
+  remaining = h.count;
+  memset(fields, 0, sizeof(fields));
+  timeMs = 0;
+  return true;
+}
+
+bool RideLogDecoder::next(RideLogSample &sample)
+{
+  if (remaining == 0)
+    return false;
+
+  const RideLogBlockHeader &h = header();
+  const uint8_t *end = block + h.used;
+  uint8_t nbFields = 2 + 5 * h.nbLinks;
+  uint32_t value;
+  uint8_t n;
+
+  if ((n = getVarint(block + pos, end, value)) == 0)
+    return false;
+  pos += n;
+  timeMs += value;
+
+  uint32_t mask;
+  if ((n = getVarint(block + pos, end, mask)) == 0)
+    return false;
+  pos += n;
+
+  for (uint8_t i = 0; i < nbFields; i++)
+  {
+    if (mask & (1 << i))
+    {
+      if ((n = getVarint(block + pos, end, value)) == 0)
+        return false;
+      pos += n;
+      fields[i] = (int32_t)((uint32_t)fields[i] + (uint32_t)unzigzag(value));
+    }
+  }
+
+  setFields(sample, h.nbLinks, fields);
+  sample.timeMs = timeMs;
+  remaining--;
+  return true;
+}
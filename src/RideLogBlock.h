@@ -0,0 +1,103 @@
+// *******************************************************************
+//  SmartESC ride log block
+//
+//  Control tick samples packed into fixed size blocks, each block is
+//  self-contained (the first sample is a delta from 0) :
+//
+//    header : magic "RL", format, links, ride, count, used bytes,
+//             first and last sample time [ms]
+//    sample : time delta [ms], changed fields mask, field deltas
+//
+//  All numbers are LEB128 varints, deltas are zigzag encoded. Fields :
+//  throttle, brake, then torque / speed / flags / state / status of
+//  each link. Unused bytes at the end of a block are 0xff (erased
+//  flash).
+//
+//  No Arduino dependency, builds on the host.
+// *******************************************************************
+
+#ifndef RIDE_LOG_BLOCK_H_
+#define RIDE_LOG_BLOCK_H_
+
+#include <stdint.h>
+#include "Varint.h"
+
+#define RIDE_LOG_FORMAT 1
+#define RIDE_LOG_LINKS 2
+#define RIDE_LOG_FIELDS (2 + 5 * RIDE_LOG_LINKS)
+#define RIDE_LOG_BLOCK_SIZE 2048                                      // [bytes] 8 flash pages
+#define RIDE_LOG_MAX_SAMPLE (VARINT_MAX_SIZE * (2 + RIDE_LOG_FIELDS)) // worst case varints
+
+typedef struct
+{
+  uint32_t timeMs;
+  int16_t throttle;
+  int16_t brake;
+  int16_t torque[RIDE_LOG_LINKS];
+  int32_t speed[RIDE_LOG_LINKS];
+  uint32_t flags[RIDE_LOG_LINKS];
+  int8_t state[RIDE_LOG_LINKS];
+  uint8_t status[RIDE_LOG_LINKS];
+} RideLogSample;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t magic[2];
+  uint8_t format;
+  uint8_t nbLinks;
+  uint16_t ride;
+  uint16_t count;
+  uint16_t used; // header included
+  uint32_t firstTimeMs;
+  uint32_t lastTimeMs;
+} RideLogBlockHeader;
+
+// one entry per block in the index file, block n at offset n * RIDE_LOG_BLOCK_SIZE
+typedef struct __attribute__((packed))
+{
+  uint32_t firstTimeMs;
+  uint32_t lastTimeMs;
+} RideLogIndexEntry;
+
+class RideLogEncoder
+{
+public:
+  // start a block in buffer (RIDE_LOG_BLOCK_SIZE bytes)
+  void begin(uint8_t *buffer, uint16_t ride, uint8_t nbLinks);
+
+  // false if the sample does not fit : the block is complete
+  bool add(const RideLogSample &sample);
+
+  uint16_t count() const { return header()->count; }
+  uint16_t used() const { return header()->used; }
+  uint32_t firstTimeMs() const { return header()->firstTimeMs; }
+  uint32_t lastTimeMs() const { return header()->lastTimeMs; }
+
+private:
+  RideLogBlockHeader *header() const { return (RideLogBlockHeader *)block; }
+
+  uint8_t *block = 0;
+  int32_t previous[RIDE_LOG_FIELDS];
+  uint32_t previousTimeMs = 0;
+};
+
+class RideLogDecoder
+{
+public:
+  // false if block is not a ride log block
+  bool begin(const uint8_t *block);
+
+  // false at the end of the block or on a corrupted sample
+  bool next(RideLogSample &sample);
+
+  const RideLogBlockHeader &header() const { return *(const RideLogBlockHeader *)block; }
+
+private:
+  const uint8_t *block = 0;
+  uint16_t pos = 0;
+  uint16_t remaining = 0;
+  int32_t fields[RIDE_LOG_FIELDS];
+  uint32_t timeMs = 0;
+};
+
+#endif
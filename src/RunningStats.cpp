@@ -0,0 +1,171 @@
+// *******************************************************************
+//  SmartESC running statistics
+// *******************************************************************
+
+#include <math.h>
+#include <string.h>
+#include "RunningStats.h"
+
+static const float quantileLevels[RUNNING_STATS_QUANTILES] = {0.50f, 0.95f, 0.99f};
+
+static void sort(float *values, uint8_t n)
+{
+  for (uint8_t i = 1; i < n; i++)
+  {
+    float v = values[i];
+    int8_t j = i - 1;
+    for (; (j >= 0) && (values[j] > v); j--)
+      values[j + 1] = values[j];
+    values[j + 1] = v;
+  }
+}
+
+// sum += value, error keeps the low order bits lost by the sum
+static inline void kahanAdd(float &sum, float &error, float value)
+{
+  float y = value - error;
+  float t = sum + y;
+  error = (t - sum) - y;
+  sum = t;
+}
+
+// ########################## P² QUANTILE ##########################
+
+void P2Quantile::begin(float quantile)
+{
+  p = quantile;
+  count = 0;
+}
+
+void P2Quantile::add(float x)
+{
+  // the first 5 samples are the markers
+  if (count < 5)
+  {
+    heights[count++] = x;
+    if (count == 5)
+    {
+      sort(heights, 5);
+      for (uint8_t i = 0; i < 5; i++)
+        positions[i] = i + 1;
+      // desired positions 1 + 2p, 1 + 4p, 3 + 2p
+      offsets[0] = 2.0f * p - 1.0f;
+      offsets[1] = 4.0f * p - 2.0f;
+      offsets[2] = 2.0f * p - 1.0f;
+    }
+    return;
+  }
+
+  // cell k of the sample, extremes follow the sample
+  uint8_t k;
+  if (x < heights[0])
+  {
+    heights[0] = x;
+    k = 0;
+  }
+  else if (x >= heights[4])
+  {
+    heights[4] = x;
+    k = 3;
+  }
+  else
+  {
+    for (k = 0; (k < 3) && (x >= heights[k + 1]); k++)
+      ;
+  }
+
+  for (uint8_t i = k + 1; i < 5; i++)
+    positions[i]++;
+  for (uint8_t i = k + 1; i < 4; i++)
+    offsets[i - 1] -= 1.0f;
+  offsets[0] += p / 2.0f;
+  offsets[1] += p;
+  offsets[2] += (1.0f + p) / 2.0f;
+  count++;
+
+  // move the middle markers by one position towards their desired positions
+  for (uint8_t i = 1; i < 4; i++)
+  {
+    float d = offsets[i - 1];
+    if (((d >= 1.0f) && (positions[i + 1] - positions[i] > 1)) ||
+        ((d <= -1.0f) && (positions[i - 1] - positions[i] < -1)))
+    {
+      int8_t s = d > 0 ? 1 : -1;
+      // gaps in integers, positions go past the float mantissa on long rides
+      float below = positions[i] - positions[i - 1];
+      float above = positions[i + 1] - positions[i];
+
+      // parabolic prediction, linear if it leaves the neighbours order
+      float h = heights[i] + s / (below + above) *
+                                 ((below + s) * (heights[i + 1] - heights[i]) / above +
+                                  (above - s) * (heights[i] - heights[i - 1]) / below);
+      if ((h <= heights[i - 1]) || (h >= heights[i + 1]))
+        h = heights[i] + s * (heights[i + s] - heights[i]) / (s > 0 ? above : -below);
+
+      heights[i] = h;
+      positions[i] += s;
+      offsets[i - 1] -= s;
+    }
+  }
+}
+
+float P2Quantile::value() const
+{
+  if (count >= 5)
+    return heights[2];
+  if (count == 0)
+    return 0.0f;
+
+  // exact on the first samples
+  float values[5];
+  memcpy(values, heights, count * sizeof(float));
+  sort(values, count);
+  return values[(uint8_t)(p * (count - 1) + 0.5f)];
+}
+
+// ########################## RUNNING STAT ##########################
+
+void RunningStat::reset()
+{
+  n = 0;
+  avg = 0.0f;
+  m2 = 0.0f;
+  avgError = 0.0f;
+  m2Error = 0.0f;
+  lowest = 0.0f;
+  highest = 0.0f;
+  for (uint8_t i = 0; i < RUNNING_STATS_QUANTILES; i++)
+    quantiles[i].begin(quantileLevels[i]);
+}
+
+void RunningStat::add(float x)
+{
+  n++;
+  float delta = x - avg;
+  kahanAdd(avg, avgError, delta / n);
+  kahanAdd(m2, m2Error, delta * (x - avg));
+
+  if ((n == 1) || (x < lowest))
+    lowest = x;
+  if ((n == 1) || (x > highest))
+    highest = x;
+
+  for (uint8_t i = 0; i < RUNNING_STATS_QUANTILES; i++)
+    quantiles[i].add(x);
+}
+
+float RunningStat::stddev() const
+{
+  return sqrtf(variance());
+}
+
+void RunningStat::summarize(RunningStatSummary &summary) const
+{
+  summary.count = n;
+  summary.mean = avg;
+  summary.stddev = stddev();
+  summary.min = lowest;
+  summary.max = highest;
+  for (uint8_t i = 0; i < RUNNING_STATS_QUANTILES; i++)
+    summary.quantiles[i] = quantile(i);
+}
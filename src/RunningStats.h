@@ -0,0 +1,81 @@
+// *******************************************************************
+//  SmartESC running statistics
+//
+//  Fixed memory, O(1) per sample :
+//    - count, mean and variance with Welford's update
+//    - min / max
+//    - p50 / p95 / p99 with the P² algorithm (Jain & Chlamtac) : five
+//      markers per quantile, adjusted by parabolic interpolation
+//
+//  Single precision : the ESP32 FPU has no double. Mean and squared
+//  deviations are Kahan compensated, a ride of millions of samples
+//  keeps them exact to float precision. The quantiles are exact up to
+//  5 samples, estimates after.
+//
+//  No Arduino dependency, builds on the host.
+// *******************************************************************
+
+#ifndef RUNNING_STATS_H_
+#define RUNNING_STATS_H_
+
+#include <stdint.h>
+
+#define RUNNING_STATS_QUANTILES 3 // p50, p95, p99
+
+class P2Quantile
+{
+public:
+  void begin(float p);
+  void add(float x);
+  float value() const;
+
+private:
+  float p = 0.5f;
+  uint32_t count = 0;
+  float heights[5];
+  int32_t positions[5];
+  float offsets[3]; // desired - actual position of the middle markers, stays exact on long rides
+};
+
+// packed summary, little endian on the wire
+typedef struct __attribute__((packed))
+{
+  uint32_t count;
+  float mean;
+  float stddev;
+  float min;
+  float max;
+  float quantiles[RUNNING_STATS_QUANTILES];
+} RunningStatSummary;
+
+class RunningStat
+{
+public:
+  RunningStat() { reset(); }
+
+  void add(float x);
+  void reset();
+
+  uint32_t count() const { return n; }
+  float mean() const { return avg; }
+  float variance() const { return n > 1 ? m2 / (n - 1) : 0.0f; }
+  float stddev() const;
+  float min() const { return lowest; }
+  float max() const { return highest; }
+  // i : 0 p50, 1 p95, 2 p99
+  float quantile(uint8_t i) const { return quantiles[i].value(); }
+
+  void summarize(RunningStatSummary &summary) const;
+
+private:
+  uint32_t n;
+  float avg;
+  float m2;
+  float avgError; // Kahan compensations
+  float m2Error;
+  float lowest;
+  float highest;
+  P2Quantile quantiles[RUNNING_STATS_QUANTILES];
+};
+
+#endif
@@ -0,0 +1,203 @@
+// *******************************************************************
+//  SmartESC serial protocol
+// *******************************************************************
+
+#ifndef SMARTESC_PROTOCOL_H_
+#define SMARTESC_PROTOCOL_H_
+
+#include <stdint.h>
+
+// send frame headers
+#define SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET 0x01
+#define SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET 0x02
+#define SERIAL_START_FRAME_DISPLAY_TO_ESC_CMD 0x03 // [-] Start frame definition for serial commands
+#define SERIAL_START_FRAME_ESC_TO_DISPLAY_OK 0xF0
+#define SERIAL_START_FRAME_ESC_TO_DISPLAY_ERR 0xFF
+
+// commandes
+#define SERIAL_FRAME_CMD_START 0x01
+#define SERIAL_FRAME_CMD_STOP 0x02
+#define SERIAL_FRAME_CMD_FAULT_ACK 0x07
+
+// registers
+#define FRAME_REG_TARGET_MOTOR 0x00
+#define FRAME_REG_FLAGS 0x01
+#define FRAME_REG_STATUS 0x02
+#define FRAME_REG_CONTROL_MODE 0x03
+#define FRAME_REG_SPEED 0x04
+#define FRAME_REG_TORQUE 0x08
+#define FRAME_REG_TORQUE_KP 0x09
+#define FRAME_REG_TORQUE_KI 0x0A
+#define FRAME_REG_FLUX_REF 0x0C
+#define FRAME_REG_FLUX_KI 0x0D
+#define FRAME_REG_FLUX_KP 0x0E
+#define FRAME_REG_SPEED_MEASURED 0x1E
+#define FRAME_REG_RAMP_FINAL_SPEED 91
+
+#pragma pack(push, 1)
+typedef struct
+{
+  uint8_t Frame_start;
+  uint8_t Lenght;
+  uint8_t Command;
+  uint8_t CRC8;
+} __attribute__((packed)) SerialCommand;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct
+{
+  uint8_t Frame_start;
+  uint8_t Lenght;
+  uint8_t Reg;
+  int32_t Value;
+  uint8_t CRC8;
+} __attribute__((packed)) SerialRegSet32;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct
+{
+  uint8_t Frame_start;
+  uint8_t Lenght;
+  uint8_t Reg;
+  int16_t Value;
+  uint8_t CRC8;
+} __attribute__((packed)) SerialRegSet16;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct
+{
+  uint8_t Frame_start;
+  uint8_t Lenght;
+  uint8_t Reg;
+  uint16_t Value;
+  uint8_t CRC8;
+} __attribute__((packed)) SerialRegSetU16;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct
+{
+  uint8_t Frame_start;
+  uint8_t Lenght;
+  uint8_t Reg;
+  int8_t Value;
+  uint8_t CRC8;
+} __attribute__((packed)) SerialRegSet8;
+#pragma pack(pop)
+
+/** @name Fault source error codes */
+/** @{ */
+#define MC_NO_ERROR (uint16_t)(0x0000u)     /**< @brief No error.*/
+#define MC_NO_FAULTS (uint16_t)(0x0000u)    /**< @brief No error.*/
+#define MC_FOC_DURATION (uint16_t)(0x0001u) /**< @brief Error: FOC rate to high.*/
+#define MC_OVER_VOLT (uint16_t)(0x0002u)    /**< @brief Error: Software over voltage.*/
+#define MC_UNDER_VOLT (uint16_t)(0x0004u)   /**< @brief Error: Software under voltage.*/
+#define MC_OVER_TEMP (uint16_t)(0x0008u)    /**< @brief Error: Software over temperature.*/
+#define MC_START_UP (uint16_t)(0x0010u)     /**< @brief Error: Startup failed.*/
+#define MC_SPEED_FDBK (uint16_t)(0x0020u)   /**< @brief Error: Speed feedback.*/
+#define MC_BREAK_IN (uint16_t)(0x0040u)     /**< @brief Error: Emergency input (Over current).*/
+#define MC_SW_ERROR (uint16_t)(0x0080u)     /**< @brief Software Error.*/
+
+typedef enum
+{
+  ICLWAIT = 12,               /*!< Persistent state, the system is waiting for ICL
+                           deactivation. Is not possible to run the motor if
+                           ICL is active. Until the ICL is active the state is
+                           forced to ICLWAIT, when ICL become inactive the state
+                           is moved to IDLE */
+  IDLE = 0,                   /*!< Persistent state, following state can be IDLE_START
+                           if a start motor command has been given or
+                           IDLE_ALIGNMENT if a start alignment command has been
+                           given */
+  IDLE_ALIGNMENT = 1,         /*!< "Pass-through" state containg the code to be executed
+                           only once after encoder alignment command.
+                           Next states can be ALIGN_CHARGE_BOOT_CAP or
+                           ALIGN_OFFSET_CALIB according the configuration. It
+                           can also be ANY_STOP if a stop motor command has been
+                           given. */
+  ALIGN_CHARGE_BOOT_CAP = 13, /*!< Persistent state where the gate driver boot
+                           capacitors will be charged. Next states will be
+                           ALIGN_OFFSET_CALIB. It can also be ANY_STOP if a stop
+                           motor command has been given. */
+  ALIGN_OFFSET_CALIB = 14,    /*!< Persistent state where the offset of motor currents
+                           measurements will be calibrated. Next state will be
+                           ALIGN_CLEAR. It can also be ANY_STOP if a stop motor
+                           command has been given. */
+  ALIGN_CLEAR = 15,           /*!< "Pass-through" state in which object is cleared and
+                           set for the startup.
+                           Next state will be ALIGNMENT. It can also be ANY_STOP
+                           if a stop motor command has been given. */
+  ALIGNMENT = 2,              /*!< Persistent state in which the encoder are properly
+                           aligned to set mechanical angle, following state can
+                           only be ANY_STOP */
+  IDLE_START = 3,             /*!< "Pass-through" state containg the code to be executed
+                           only once after start motor command.
+                           Next states can be CHARGE_BOOT_CAP or OFFSET_CALIB
+                           according the configuration. It can also be ANY_STOP
+                           if a stop motor command has been given. */
+  CHARGE_BOOT_CAP = 16,       /*!< Persistent state where the gate driver boot
+                           capacitors will be charged. Next states will be
+                           OFFSET_CALIB. It can also be ANY_STOP if a stop motor
+                           command has been given. */
+  OFFSET_CALIB = 17,          /*!< Persistent state where the offset of motor currents
+                           measurements will be calibrated. Next state will be
+                           CLEAR. It can also be ANY_STOP if a stop motor
+                           command has been given. */
+  CLEAR = 18,                 /*!< "Pass-through" state in which object is cleared and
+                           set for the startup.
+                           Next state will be START. It can also be ANY_STOP if
+                           a stop motor command has been given. */
+  START = 4,                  /*!< Persistent state where the motor start-up is intended
+                           to be executed. The following state is normally
+                           SWITCH_OVER or RUN as soon as first validated speed is
+                           detected. Another possible following state is
+                           ANY_STOP if a stop motor command has been executed */
+  SWITCH_OVER = 19,           /**< TBD */
+  START_RUN = 5,              /*!< "Pass-through" state, the code to be executed only
+                           once between START and RUN states itâ€™s intended to be
+                           here executed. Following state is normally  RUN but
+                           it can also be ANY_STOP  if a stop motor command has
+                           been given */
+  RUN = 6,                    /*!< Persistent state with running motor. The following
+                           state is normally ANY_STOP when a stop motor command
+                           has been executed */
+  ANY_STOP = 7,               /*!< "Pass-through" state, the code to be executed only
+                           once between any state and STOP itâ€™s intended to be
+                           here executed. Following state is normally STOP */
+  STOP = 8,                   /*!< Persistent state. Following state is normally
+                           STOP_IDLE as soon as conditions for moving state
+                           machine are detected */
+  STOP_IDLE = 9,              /*!< "Pass-through" state, the code to be executed only
+                           once between STOP and IDLE itâ€™s intended to be here
+                           executed. Following state is normally IDLE */
+  FAULT_NOW = 10,             /*!< Persistent state, the state machine can be moved from
+                           any condition directly to this state by
+                           STM_FaultProcessing method. This method also manage
+                           the passage to the only allowed following state that
+                           is FAULT_OVER */
+  FAULT_OVER = 11,            /*!< Persistent state where the application is intended to
+                          stay when the fault conditions disappeared. Following
+                          state is normally STOP_IDLE, state machine is moved as
+                          soon as the user has acknowledged the fault condition.
+                      */
+  WAIT_STOP_MOTOR = 20
+
+} State_t;
+
+// always inlined, so it lands in the section of its callers (IRAM_HOT_PATH)
+__attribute__((always_inline)) inline uint8_t getCrc(uint8_t *buffer, uint8_t size)
+{
+  uint16_t crc = 0;
+  for (int i = 0; i < size - 1; i++)
+  {
+    crc = crc + buffer[i];
+  }
+
+  uint8_t finalCrc = (uint8_t)(crc & 0xff) + ((crc >> 8) & 0xff);
+  return finalCrc;
+}
+
+#endif
@@ -0,0 +1,81 @@
+// *******************************************************************
+//  SmartESC speed estimator
+// *******************************************************************
+
+#include <Arduino.h>
+#include "SpeedEstimator.h"
+
+// speed change over dt at the given acceleration, Q8
+static int32_t HOT_PATH_ATTR integrate(int32_t accelQ8, uint32_t dtUs)
+{
+  return (int32_t)((int64_t)accelQ8 * dtUs / 1000000);
+}
+
+int32_t HOT_PATH_ATTR SpeedEstimator::estimate(uint32_t timeUs, int16_t torque) const
+{
+  if (!valid)
+    return 0;
+
+  uint32_t dtUs = timeUs - timeLastUs;
+  if (dtUs > SPEED_EST_MAX_AGE * 1000UL)
+    dtUs = SPEED_EST_MAX_AGE * 1000UL;
+
+  int32_t accelQ8 = accel + ((int32_t)(torque - torqueLast) * SPEED_EST_TORQUE_GAIN * 256 / 1024);
+  int32_t speedEst = speedQ8 + integrate(accelQ8, dtUs);
+
+  // no sign change by extrapolation
+  if ((speedQ8 >= 0) != (speedEst >= 0))
+    return 0;
+
+  return speedEst / 256;
+}
+
+void HOT_PATH_ATTR SpeedEstimator::update(int32_t speed, uint32_t timeUs, int16_t torque)
+{
+  if (!valid)
+  {
+    speedQ8 = speed * 256;
+    accel = 0;
+    torqueLast = torque;
+    timeLastUs = timeUs;
+    valid = true;
+    return;
+  }
+
+  uint32_t dtUs = timeUs - timeLastUs;
+  if ((dtUs == 0) || (dtUs > SPEED_EST_MAX_AGE * 1000UL))
+  {
+    // too old to tell an acceleration, restart from the reply
+    valid = false;
+    update(speed, timeUs, torque);
+    return;
+  }
+
+  uint32_t error = abs(estimate(timeUs, torque) - speed);
+  errorCount++;
+  errorSum += error;
+  if (error > errorMax)
+    errorMax = error;
+
+  // predict, then correct speed and acceleration with the residual
+  int32_t predicted = speedQ8 + integrate(accel, dtUs);
+  int32_t residual = speed * 256 - predicted;
+  speedQ8 = predicted + residual * SPEED_EST_ALPHA / 256;
+  accel += (int32_t)((int64_t)residual * SPEED_EST_BETA * 1000000 / 256 / dtUs);
+
+  torqueLast = torque;
+  timeLastUs = timeUs;
+}
+
+void SpeedEstimator::printStats()
+{
+  Serial.printf("   speed estimate : %d rpm/s / error avg = %d rpm / max = %d rpm on %d replies\n",
+                acceleration(), errorCount ? errorSum / errorCount : 0, errorMax, errorCount);
+}
+
+void SpeedEstimator::resetStats()
+{
+  errorCount = 0;
+  errorSum = 0;
+  errorMax = 0;
+}
@@ -0,0 +1,46 @@
+// *******************************************************************
+//  SmartESC speed estimator
+//
+//  Fixed point alpha-beta filter on the timestamped speed replies :
+//  tracks speed and acceleration, extrapolates the speed between two
+//  polls from the acceleration and the torque change since the last
+//  reply. Speeds in rpm, times in us.
+// *******************************************************************
+
+#ifndef SPEED_ESTIMATOR_H_
+#define SPEED_ESTIMATOR_H_
+
+#include <stdint.h>
+#include "config.h"
+
+class SpeedEstimator
+{
+public:
+  // speed reply received at timeUs, torque applied at that time
+  void update(int32_t speed, uint32_t timeUs, int16_t torque);
+
+  // speed at timeUs with the torque currently applied
+  int32_t estimate(uint32_t timeUs, int16_t torque) const;
+
+  int32_t acceleration() const { return accel >> 8; } // [rpm/s]
+  uint32_t age(uint32_t timeUs) const { return valid ? timeUs - timeLastUs : UINT32_MAX; }
+
+  void reset() { valid = false; }
+
+  // prediction error at each reply, reset at each report
+  void printStats();
+  void resetStats();
+
+private:
+  bool valid = false;
+  int32_t speedQ8 = 0; // [rpm / 256]
+  int32_t accel = 0;   // [rpm/s / 256]
+  int16_t torqueLast = 0;
+  uint32_t timeLastUs = 0;
+
+  uint32_t errorCount = 0;
+  uint32_t errorSum = 0;
+  uint32_t errorMax = 0;
+};
+
+#endif
@@ -0,0 +1,38 @@
+// *******************************************************************
+//  SmartESC telemetry snapshot
+// *******************************************************************
+
+#include <Arduino.h>
+#include "Telemetry.h"
+
+TelemetryStore telemetry;
+
+// seq odd  : copies[0] is rewritten, readers use copies[1]
+// seq even : copies[1] is rewritten (or stable), readers use copies[0]
+void TelemetryStore::publish(const TelemetrySnapshot &snapshot)
+{
+  seq = seq + 1;
+  __sync_synchronize();
+  copies[0] = snapshot;
+  __sync_synchronize();
+  seq = seq + 1;
+  __sync_synchronize();
+  copies[1] = snapshot;
+  __sync_synchronize();
+}
+
+void IRAM_ATTR TelemetryStore::read(TelemetrySnapshot &snapshot)
+{
+  while (true)
+  {
+    uint32_t seqStart = seq;
+    __sync_synchronize();
+    snapshot = copies[seqStart & 1];
+    __sync_synchronize();
+
+    // the copy read was not rewritten meanwhile
+    if (seq == seqStart)
+      return;
+    retries = retries + 1;
+  }
+}
@@ -0,0 +1,67 @@
+// *******************************************************************
+//  SmartESC telemetry snapshot
+//
+//  One consistent copy of the ESC and input values, published by the
+//  loop task once per pass and read by any other task, core or ISR
+//  (telemetry, BLE, logger) without locking.
+//
+//  Seqlock over two copies : the writer bumps the sequence before
+//  each copy it rewrites, readers take the copy the sequence points
+//  to and retry only if a publish completed meanwhile. Publishing is
+//  wait-free, and an ISR preempting the writer still reads the stable
+//  copy at the first try.
+// *******************************************************************
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+#define TELEMETRY_LINKS 2
+
+typedef struct
+{
+  uint32_t timeUs; // publication time
+  uint8_t nbLinks;
+
+  // per ESC link
+  int32_t speed[TELEMETRY_LINKS];
+  uint32_t flags[TELEMETRY_LINKS];
+  int16_t torque[TELEMETRY_LINKS];
+  uint8_t status[TELEMETRY_LINKS];
+  int8_t state[TELEMETRY_LINKS];
+  uint32_t uartErrors[TELEMETRY_LINKS]; // framing and parity errors since boot
+  uint32_t uartDrops[TELEMETRY_LINKS];  // HW FIFO overflows and RX queue drops since boot
+
+  // inputs, 0-255
+  int16_t throttle;
+  int16_t brake;
+
+  // memory report, sampled every DELAY_MEMORY_SAMPLE [bytes]
+  uint32_t heapFree;
+  uint32_t heapMin;
+  uint32_t heapLargest;
+  uint32_t loopStackFree;
+} TelemetrySnapshot;
+
+class TelemetryStore
+{
+public:
+  // single writer
+  void publish(const TelemetrySnapshot &snapshot);
+
+  // consistent copy, never blocks the writer
+  void read(TelemetrySnapshot &snapshot);
+
+  uint32_t publishCount() const { return seq / 2; }
+  uint32_t retryCount() const { return retries; }
+
+private:
+  volatile uint32_t seq = 0;
+  volatile uint32_t retries = 0;
+  TelemetrySnapshot copies[2];
+};
+
+extern TelemetryStore telemetry;
+
+#endif
@@ -0,0 +1,86 @@
+// *******************************************************************
+//  SmartESC telemetry packer
+// *******************************************************************
+
+#include <string.h>
+#include "TelemetryPacker.h"
+#include "Varint.h"
+
+static void getFields(const TelemetrySnapshot &snapshot, int32_t *fields)
+{
+  uint8_t n = 0;
+  fields[n++] = snapshot.throttle;
+  fields[n++] = snapshot.brake;
+  for (uint8_t i = 0; i < TELEMETRY_LINKS; i++)
+  {
+    fields[n++] = snapshot.speed[i];
+    fields[n++] = snapshot.torque[i];
+    fields[n++] = (int32_t)snapshot.flags[i];
+    fields[n++] = snapshot.status[i];
+    fields[n++] = (int32_t)snapshot.uartErrors[i];
+    fields[n++] = (int32_t)snapshot.uartDrops[i];
+  }
+  fields[n++] = (int32_t)snapshot.heapFree;
+  fields[n++] = (int32_t)snapshot.heapMin;
+  fields[n++] = (int32_t)snapshot.heapLargest;
+  fields[n++] = (int32_t)snapshot.loopStackFree;
+}
+
+TelemetryPacker::TelemetryPacker()
+{
+  reset();
+}
+
+void TelemetryPacker::setPayloadSize(uint16_t size)
+{
+  if (size > TELEMETRY_PACKER_MAX_SIZE)
+    size = TELEMETRY_PACKER_MAX_SIZE;
+  payloadSize = size;
+}
+
+void TelemetryPacker::reset()
+{
+  buffer[0] = (TELEMETRY_PACKER_FORMAT << 4) | TELEMETRY_LINKS;
+  buffer[1] = 0;
+  used = TELEMETRY_PACKER_HEADER;
+  previousTimeMs = 0;
+  memset(previous, 0, sizeof(previous));
+}
+
+bool TelemetryPacker::add(const TelemetrySnapshot &snapshot)
+{
+  if (buffer[1] == 0xff)
+    return false;
+
+  uint8_t sample[TELEMETRY_PACKER_MAX_SAMPLE];
+  uint8_t size = 0;
+  int32_t fields[TELEMETRY_FIELDS];
+  uint32_t mask = 0;
+
+  getFields(snapshot, fields);
+  for (uint8_t i = 0; i < TELEMETRY_FIELDS; i++)
+  {
+    if (fields[i] != previous[i])
+      mask |= 1 << i;
+  }
+
+  uint32_t timeMs = snapshot.timeUs / 1000;
+  size += putVarint(&sample[size], timeMs - previousTimeMs);
+  size += putVarint(&sample[size], mask);
+  for (uint8_t i = 0; i < TELEMETRY_FIELDS; i++)
+  {
+    if (mask & (1 << i))
+      size += putVarint(&sample[size], zigzag((int32_t)((uint32_t)fields[i] - (uint32_t)previous[i])));
+  }
+
+  if (used + size > payloadSize)
+    return false;
+
+  memcpy(&buffer[used], sample, size);
+  used += size;
+  buffer[1]++;
+  previousTimeMs = timeMs;
+  memcpy(previous, fields, sizeof(previous));
+
+  return true;
+}
@@ -0,0 +1,58 @@
+// *******************************************************************
+//  SmartESC telemetry packer
+//
+//  Batches telemetry samples into one BLE notification. Each batch is
+//  self-contained, a lost notification does not break the next ones :
+//
+//    header : format (4 bits) / links (4 bits), sample count
+//    sample : time delta [ms], changed fields mask, field deltas
+//
+//  All numbers are LEB128 varints, deltas are zigzag encoded. The
+//  first sample of a batch is a delta from 0 (absolute values).
+//  Fields : throttle, brake, then speed / torque / flags / status /
+//  UART errors / UART drops of each link, then heap free / min /
+//  largest block and loop stack free.
+//  Decoder : tools/ble_telemetry.py
+//
+//  No Arduino dependency, builds on the host.
+// *******************************************************************
+
+#ifndef TELEMETRY_PACKER_H_
+#define TELEMETRY_PACKER_H_
+
+#include <stdint.h>
+#include "Telemetry.h"
+
+#define TELEMETRY_PACKER_FORMAT 3
+#define TELEMETRY_FIELDS (2 + 6 * TELEMETRY_LINKS + 4)
+#define TELEMETRY_PACKER_HEADER 2
+#define TELEMETRY_PACKER_MAX_SAMPLE (5 + 5 + 5 * TELEMETRY_FIELDS) // worst case varints
+#define TELEMETRY_PACKER_MAX_SIZE 512                               // max ATT payload
+
+class TelemetryPacker
+{
+public:
+  TelemetryPacker();
+
+  // notification payload size, ATT MTU - 3
+  void setPayloadSize(uint16_t size);
+
+  // false if the sample does not fit : send the batch, reset and add it again
+  bool add(const TelemetrySnapshot &snapshot);
+
+  // start a new batch
+  void reset();
+
+  const uint8_t *data() const { return buffer; }
+  uint16_t size() const { return used; }
+  uint8_t count() const { return buffer[1]; }
+
+private:
+  uint8_t buffer[TELEMETRY_PACKER_MAX_SIZE];
+  uint16_t used = TELEMETRY_PACKER_HEADER;
+  uint16_t payloadSize = 20;
+  uint32_t previousTimeMs = 0;
+  int32_t previous[TELEMETRY_FIELDS];
+};
+
+#endif
@@ -0,0 +1,120 @@
+// *******************************************************************
+//  SmartESC telemetry statistics
+// *******************************************************************
+
+#include "TelemetryStats.h"
+
+#if TELEMETRY_STATS
+
+TelemetryStats telemetryStats;
+
+static const uint32_t windowDurations[STATS_WINDOWS] = {1000, 10000, 0};
+static const char *windowNames[STATS_WINDOWS] = {"1 s", "10 s", "ride"};
+
+void TelemetryStats::begin(uint8_t links, unsigned long timeNow)
+{
+  nbLinks = links;
+  for (uint8_t w = 0; w < STATS_WINDOWS; w++)
+  {
+    timeStart[w] = timeNow;
+    memset(&reports[w], 0, sizeof(StatsReport));
+    reports[w].format = STATS_FORMAT;
+    reports[w].window = w;
+    reports[w].nbChannels = STATS_CHANNELS;
+    reports[w].nbLinks = nbLinks;
+  }
+  publish();
+}
+
+void TelemetryStats::add(uint8_t channel, float value)
+{
+  for (uint8_t w = 0; w < STATS_WINDOWS; w++)
+    stats[w][channel].add(value);
+}
+
+void TelemetryStats::update(unsigned long timeNow)
+{
+  if (timeNow - timeStart[STATS_WINDOW_1S] < windowDurations[STATS_WINDOW_1S])
+    return;
+
+  for (uint8_t w = 0; w < STATS_WINDOWS; w++)
+  {
+    // the ride summary follows the 1 s window
+    if ((windowDurations[w] == 0) || (timeNow - timeStart[w] >= windowDurations[w]))
+      summarize(w, timeNow);
+  }
+  publish();
+}
+
+void TelemetryStats::summarize(uint8_t window, unsigned long timeNow)
+{
+  StatsReport &report = reports[window];
+
+  report.timeMs = timeNow;
+  report.durationMs = timeNow - timeStart[window];
+  report.sequence++;
+  for (uint8_t c = 0; c < STATS_CHANNELS; c++)
+    stats[window][c].summarize(report.channels[c]);
+
+  if (windowDurations[window] == 0)
+    return;
+
+  for (uint8_t c = 0; c < STATS_CHANNELS; c++)
+    stats[window][c].reset();
+  timeStart[window] = timeNow;
+}
+
+// seqlock over two copies, see TelemetryStore
+void TelemetryStats::publish()
+{
+  seq = seq + 1;
+  __sync_synchronize();
+  memcpy(copies[0], reports, sizeof(reports));
+  __sync_synchronize();
+  seq = seq + 1;
+  __sync_synchronize();
+  memcpy(copies[1], reports, sizeof(reports));
+  __sync_synchronize();
+}
+
+void TelemetryStats::read(uint8_t window, StatsReport &report)
+{
+  if (window >= STATS_WINDOWS)
+    window = STATS_WINDOW_RIDE;
+
+  while (true)
+  {
+    uint32_t seqStart = seq;
+    __sync_synchronize();
+    report = copies[seqStart & 1][window];
+    __sync_synchronize();
+    if (seq == seqStart)
+      return;
+  }
+}
+
+void TelemetryStats::print(uint8_t window)
+{
+  static const char *channelNames[] = {"speed", "torque", "rtt us"};
+  StatsReport report;
+  read(window, report);
+
+  Serial.printf("stats %s : %lu ms / count, mean, stddev, min, max, p50, p95, p99\n",
+                windowNames[window], (unsigned long)report.durationMs);
+  for (uint8_t c = 0; c < 3 + 3 * nbLinks; c++)
+  {
+    const RunningStatSummary &s = report.channels[c];
+    if (c == STATS_LOOP_PERIOD)
+      Serial.printf("   loop us   ");
+    else if (c == STATS_THROTTLE)
+      Serial.printf("   throttle  ");
+    else if (c == STATS_BRAKE)
+      Serial.printf("   brake     ");
+    else
+      Serial.printf("   M%d %-7s", (c - 3) / 3, channelNames[(c - 3) % 3]);
+    Serial.printf("%6u %9.1f %8.1f %8.0f %8.0f %8.0f %8.0f %8.0f\n", s.count, s.mean, s.stddev,
+                  s.min, s.max, s.quantiles[0], s.quantiles[1], s.quantiles[2]);
+  }
+}
+
+#endif
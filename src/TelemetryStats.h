@@ -0,0 +1,93 @@
+// *******************************************************************
+//  SmartESC telemetry statistics
+//
+//  Running statistics (RunningStats.h) of the loop period, inputs and
+//  per link speed, torque and round trip time, over three windows :
+//  the last second, the last 10 seconds and the whole ride (since
+//  boot). The 1 s and 10 s windows are tumbling : the summary of a
+//  window is published when it ends, the next one starts empty.
+//
+//  The loop task adds the samples and publishes the summaries once
+//  per second. Any other task reads them without locking (seqlock,
+//  same as TelemetryStore), e.g. the BLE summary characteristic.
+//
+//  One window summary is a StatsReport : 16 + 32 bytes per channel,
+//  304 bytes with two links.
+// *******************************************************************
+
+#ifndef TELEMETRY_STATS_H_
+#define TELEMETRY_STATS_H_
+
+#include <Arduino.h>
+#include "config.h"
+#include "RunningStats.h"
+#include "Telemetry.h"
+
+#if TELEMETRY_STATS
+
+#define STATS_FORMAT 1
+
+enum
+{
+  STATS_WINDOW_1S,
+  STATS_WINDOW_10S,
+  STATS_WINDOW_RIDE,
+  STATS_WINDOWS
+};
+
+// channels : loop period [us], throttle, brake, then speed [rpm], torque, rtt [us] of each link
+#define STATS_LOOP_PERIOD 0
+#define STATS_THROTTLE 1
+#define STATS_BRAKE 2
+#define STATS_SPEED(link) (3 + 3 * (link))
+#define STATS_TORQUE(link) (4 + 3 * (link))
+#define STATS_RTT(link) (5 + 3 * (link))
+#define STATS_CHANNELS (3 + 3 * TELEMETRY_LINKS)
+
+typedef struct __attribute__((packed))
+{
+  uint8_t format;
+  uint8_t window;
+  uint8_t nbChannels;
+  uint8_t nbLinks;
+  uint32_t timeMs;     // end of the window
+  uint32_t durationMs; // time covered
+  uint32_t sequence;   // published reports of this window
+  RunningStatSummary channels[STATS_CHANNELS];
+} StatsReport;
+
+class TelemetryStats
+{
+public:
+  void begin(uint8_t nbLinks, unsigned long timeNow);
+
+  // loop task only
+  void add(uint8_t channel, float value);
+
+  // ends the windows that are due and publishes their summaries
+  void update(unsigned long timeNow);
+
+  // any task : last published summary of a window
+  void read(uint8_t window, StatsReport &report);
+
+  void print(uint8_t window);
+
+private:
+  void summarize(uint8_t window, unsigned long timeNow);
+  void publish();
+
+  uint8_t nbLinks = 1;
+  unsigned long timeStart[STATS_WINDOWS];
+  RunningStat stats[STATS_WINDOWS][STATS_CHANNELS];
+
+  // reports being built, then published like TelemetryStore
+  StatsReport reports[STATS_WINDOWS];
+  volatile uint32_t seq = 0;
+  StatsReport copies[2][STATS_WINDOWS];
+};
+
+extern TelemetryStats telemetryStats;
+
+#endif
+
+#endif
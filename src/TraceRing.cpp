@@ -0,0 +1,60 @@
+// *******************************************************************
+//  SmartESC timing trace
+// *******************************************************************
+
+#include "TraceRing.h"
+
+TraceRing traceRing;
+
+void HOT_PATH_ATTR TraceRing::add(uint8_t type, uint8_t link, int16_t value)
+{
+  portENTER_CRITICAL(&mux);
+  TraceEvent *event = &events[head];
+  event->timeUs = micros();
+  event->type = type;
+  event->link = link;
+  event->value = value;
+  head = (head + 1) % TRACE_SIZE;
+  if (count < TRACE_SIZE)
+    count++;
+  portEXIT_CRITICAL(&mux);
+}
+
+void IRAM_ATTR TraceRing::addFromISR(uint8_t type, uint8_t link, int16_t value)
+{
+  portENTER_CRITICAL_ISR(&mux);
+  TraceEvent *event = &events[head];
+  event->timeUs = micros();
+  event->type = type;
+  event->link = link;
+  event->value = value;
+  head = (head + 1) % TRACE_SIZE;
+  if (count < TRACE_SIZE)
+    count++;
+  portEXIT_CRITICAL_ISR(&mux);
+}
+
+void TraceRing::dump()
+{
+  Serial.printf("TRC BEGIN %d\n", count);
+
+  while (count > 0)
+  {
+    TraceEvent event;
+
+    // copy under lock, print outside of it
+    portENTER_CRITICAL(&mux);
+    event = events[(head + TRACE_SIZE - count) % TRACE_SIZE];
+    count--;
+    portEXIT_CRITICAL(&mux);
+
+    Serial.printf("TRC %u %d %d %d\n", event.timeUs, event.type, event.link, event.value);
+  }
+
+  Serial.printf("TRC END\n");
+}
+
+void IRAM_ATTR traceUartIsr(uint8_t uartNr)
+{
+  traceRing.addFromISR(TRACE_ISR, uartNr, 0);
+}
@@ -0,0 +1,59 @@
+// *******************************************************************
+//  SmartESC timing trace
+//
+//  Compact ring of timestamped events (state machine, frames, ISR,
+//  ADC, torque). Dumped as text on the console, converted to a
+//  Chrome / Perfetto trace by tools/trace2chrome.py.
+// *******************************************************************
+
+#ifndef TRACE_RING_H_
+#define TRACE_RING_H_
+
+#include <Arduino.h>
+#include "config.h"
+
+// event types, keep in sync with tools/trace2chrome.py
+#define TRACE_STATE 0    // loop() state machine transition, value = new state
+#define TRACE_TX_START 1 // frame write start, value = register / command
+#define TRACE_TX_END 2   // frame written to the UART FIFO, value = frame size
+#define TRACE_RX_FRAME 3 // reply decoded, value = register / command it answers
+#define TRACE_ISR 4      // UART interrupt entry, link = UART number
+#define TRACE_ADC 5      // throttle / brake sampled, value = throttle
+#define TRACE_TORQUE 6   // torque computed, value = torque
+
+typedef struct
+{
+  uint32_t timeUs;
+  uint8_t type;
+  uint8_t link;
+  int16_t value;
+} TraceEvent;
+
+class TraceRing
+{
+public:
+  void add(uint8_t type, uint8_t link, int16_t value);
+  void addFromISR(uint8_t type, uint8_t link, int16_t value);
+
+  // print the ring on the console and empty it
+  void dump();
+
+private:
+  TraceEvent events[TRACE_SIZE];
+  uint16_t head = 0;
+  uint16_t count = 0;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+};
+
+extern TraceRing traceRing;
+
+// UART ISR hook, see HardwareSerial::setIsrHook()
+void traceUartIsr(uint8_t uartNr);
+
+#if TRACE_EVENTS
+#define TRACE(type, link, value) traceRing.add(type, link, value)
+#else
+#define TRACE(type, link, value)
+#endif
+
+#endif
@@ -0,0 +1,53 @@
+// *******************************************************************
+//  LEB128 varints and zigzag encoding
+//
+//  Shared by the telemetry packer and the ride log. No Arduino
+//  dependency, builds on the host.
+// *******************************************************************
+
+#ifndef VARINT_H_
+#define VARINT_H_
+
+#include <stdint.h>
+
+#define VARINT_MAX_SIZE 5 // 32 bits values
+
+static inline uint8_t putVarint(uint8_t *p, uint32_t value)
+{
+  uint8_t n = 0;
+  while (value >= 0x80)
+  {
+    p[n++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  p[n++] = (uint8_t)value;
+  return n;
+}
+
+// 0 if the varint runs past end
+static inline uint8_t getVarint(const uint8_t *p, const uint8_t *end, uint32_t &value)
+{
+  uint8_t n = 0;
+  value = 0;
+  while ((p + n < end) && (n < VARINT_MAX_SIZE))
+  {
+    uint8_t b = p[n];
+    value |= (uint32_t)(b & 0x7f) << (7 * n);
+    n++;
+    if (b < 0x80)
+      return n;
+  }
+  return 0;
+}
+
+static inline uint32_t zigzag(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+#endif
@@ -0,0 +1,70 @@
+// *******************************************************************
+//  SmartESC waveform tables
+// *******************************************************************
+
+#include <math.h>
+#include "Waveform.h"
+
+static const char *shapeNames[WAVEFORM_SHAPES] = {"step", "ramp", "triangle", "sine", "chirp"};
+
+const char *waveformShapeName(uint8_t shape)
+{
+  return shape < WAVEFORM_SHAPES ? shapeNames[shape] : "?";
+}
+
+static int16_t clamp16(float value)
+{
+  if (value > 32767.0f)
+    return 32767;
+  if (value < -32768.0f)
+    return -32768;
+  return (int16_t)lroundf(value);
+}
+
+uint16_t buildWaveform(const WaveformProfile &profile, int16_t *table, uint16_t maxTicks)
+{
+  if ((profile.tickMs == 0) || (profile.periodMs == 0))
+    return 0;
+
+  uint32_t ticks = profile.durationMs / profile.tickMs;
+  if (ticks > maxTicks)
+    ticks = maxTicks;
+
+  const float twoPi = 6.2831853f;
+  float duration = profile.durationMs / 1000.0f;
+  float f0 = 1000.0f / profile.periodMs;
+  float f1 = profile.endPeriodMs ? 1000.0f / profile.endPeriodMs : f0;
+
+  for (uint32_t k = 0; k < ticks; k++)
+  {
+    uint32_t timeMs = k * profile.tickMs;
+    float t = timeMs / 1000.0f;
+    float shape = 0.0f; // 0 to 1, or -1 to 1
+
+    switch (profile.shape)
+    {
+    case WAVEFORM_STEP:
+      shape = timeMs >= profile.periodMs ? 1.0f : 0.0f;
+      break;
+    case WAVEFORM_RAMP:
+      shape = timeMs >= profile.periodMs ? 1.0f : (float)timeMs / profile.periodMs;
+      break;
+    case WAVEFORM_TRIANGLE:
+    {
+      float phase = (float)(timeMs % profile.periodMs) / profile.periodMs;
+      shape = phase < 0.5f ? 2.0f * phase : 2.0f - 2.0f * phase;
+      break;
+    }
+    case WAVEFORM_SINE:
+      // phase from the integer time, no drift on long profiles
+      shape = sinf(twoPi * (float)(timeMs % profile.periodMs) / profile.periodMs);
+      break;
+    case WAVEFORM_CHIRP:
+      shape = sinf(twoPi * (f0 * t + (f1 - f0) * t * t / (2.0f * duration)));
+      break;
+    }
+
+    table[k] = clamp16(profile.offset + profile.amplitude * shape);
+  }
+  return ticks;
+}
@@ -0,0 +1,48 @@
+// *******************************************************************
+//  SmartESC waveform tables
+//
+//  Torque profiles for bench tests, computed once into a table of one
+//  value per control tick : the player only indexes it.
+//
+//    step     : offset until period, then offset + amplitude
+//    ramp     : offset to offset + amplitude over period, then held
+//    triangle : offset to offset + amplitude and back every period
+//    sine     : offset + amplitude * sin(2 pi t / period)
+//    chirp    : sine with a frequency sweeping linearly from
+//               1 / period to 1 / endPeriod over the duration
+//
+//  No Arduino dependency, builds on the host.
+// *******************************************************************
+
+#ifndef WAVEFORM_H_
+#define WAVEFORM_H_
+
+#include <stdint.h>
+
+enum
+{
+  WAVEFORM_STEP,
+  WAVEFORM_RAMP,
+  WAVEFORM_TRIANGLE,
+  WAVEFORM_SINE,
+  WAVEFORM_CHIRP,
+  WAVEFORM_SHAPES
+};
+
+typedef struct
+{
+  uint8_t shape;
+  int16_t offset;
+  int16_t amplitude;
+  uint32_t periodMs;    // step time, ramp length, triangle / sine period, chirp start period
+  uint32_t endPeriodMs; // chirp end period
+  uint32_t durationMs;
+  uint16_t tickMs;
+} WaveformProfile;
+
+// fills table with one value per tick, returns the number of ticks (at most maxTicks)
+uint16_t buildWaveform(const WaveformProfile &profile, int16_t *table, uint16_t maxTicks);
+
+const char *waveformShapeName(uint8_t shape);
+
+#endif
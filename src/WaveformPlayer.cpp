@@ -0,0 +1,171 @@
+// *******************************************************************
+//  SmartESC waveform player
+// *******************************************************************
+
+#include "WaveformPlayer.h"
+
+#if WAVEFORM
+
+WaveformPlayer waveformPlayer;
+
+bool WaveformPlayer::start(const WaveformProfile &newProfile, EscLink *const *escLinks, uint8_t count, uint32_t timeUs)
+{
+  if (playing || (dumpRow >= 0))
+    return false;
+
+  profile = newProfile;
+  nbTicks = buildWaveform(profile, table, WAVEFORM_MAX_TICKS);
+  if (nbTicks == 0)
+  {
+    Serial.printf("waveform : empty profile\n");
+    return false;
+  }
+
+  links = escLinks;
+  nbLinks = count < WAVEFORM_LINKS ? count : WAVEFORM_LINKS;
+  for (uint16_t k = 0; k < nbTicks; k++)
+    records[k].lateUs = WAVEFORM_MISSED;
+
+  // fresh speed in every row
+  for (uint8_t i = 0; i < nbLinks; i++)
+    links[i]->setSpeedPollCycles(1);
+
+  tickUs = profile.tickMs * 1000UL;
+  timeStartUs = timeUs;
+  tick = 0;
+  nextTick = 0;
+  recordPending = false;
+  nbRecords = 0;
+  missed = 0;
+  lateMaxUs = 0;
+  playing = true;
+
+  Serial.printf("waveform : %s / offset %d / amplitude %d / period %u ms / %u ticks of %u ms\n",
+                waveformShapeName(profile.shape), profile.offset, profile.amplitude,
+                profile.periodMs, nbTicks, profile.tickMs);
+  return true;
+}
+
+void WaveformPlayer::stop(const char *reason)
+{
+  if (!playing)
+    return;
+
+  playing = false;
+  if (recordPending)
+    missed++;
+  recordPending = false;
+  lastTick = tick;
+
+  for (uint8_t i = 0; i < nbLinks; i++)
+    links[i]->setSpeedPollCycles(SPEED_POLL_CYCLES);
+
+  Serial.printf("waveform : %s after %u of %u ticks / %u recorded / %u missed / late max = %u us\n",
+                reason, lastTick + 1, nbTicks, nbRecords, missed, lateMaxUs);
+  dumpRow = 0;
+}
+
+// tick k is due at timeStartUs + k * tickUs, late ticks do not shift the next ones
+bool WaveformPlayer::update(uint32_t timeUs)
+{
+  if (!playing)
+    return false;
+
+  uint32_t due = (timeUs - timeStartUs) / tickUs;
+  if (due < nextTick)
+    return false;
+
+  if (due >= nbTicks)
+  {
+    missed += nbTicks - nextTick;
+    stop("done");
+    return true;
+  }
+
+  // previous tick without torque write, and ticks skipped by a long loop pass
+  if (recordPending)
+    missed++;
+  missed += due - nextTick;
+
+  tick = due;
+  nextTick = due + 1;
+  recordPending = true;
+  return true;
+}
+
+void HOT_PATH_ATTR WaveformPlayer::record(uint32_t timeUs)
+{
+  if (!recordPending)
+    return;
+  recordPending = false;
+
+  uint32_t late = timeUs - (timeStartUs + tick * tickUs);
+  WaveformRecord &row = records[tick];
+  row.lateUs = late < WAVEFORM_MISSED ? late : WAVEFORM_MISSED - 1;
+  row.torque = table[tick];
+  for (uint8_t i = 0; i < nbLinks; i++)
+  {
+    row.speed[i] = links[i]->regs.speed;
+    row.flags[i] = links[i]->flags;
+    row.status[i] = links[i]->regs.status;
+  }
+
+  nbRecords++;
+  if (row.lateUs > lateMaxUs)
+    lateMaxUs = row.lateUs;
+}
+
+void WaveformPlayer::dump()
+{
+  if (dumpRow < 0)
+    return;
+
+  if (dumpRow == 0)
+  {
+    Serial.printf("WAVE BEGIN %s / offset %d / amplitude %d / period %u ms / end period %u ms / tick %u ms\n",
+                  waveformShapeName(profile.shape), profile.offset, profile.amplitude,
+                  profile.periodMs, profile.endPeriodMs, profile.tickMs);
+    Serial.printf("WAVE tick,time_ms,late_us,torque");
+    for (uint8_t i = 0; i < nbLinks; i++)
+      Serial.printf(",speed%d,flags%d,status%d", i, i, i);
+    Serial.printf("\n");
+  }
+
+  for (uint8_t n = 0; (n < WAVEFORM_DUMP_ROWS) && (dumpRow <= lastTick); n++, dumpRow++)
+  {
+    const WaveformRecord &row = records[dumpRow];
+    uint32_t timeMs = dumpRow * profile.tickMs;
+
+    // missed tick : time and table value only, empty responses
+    if (row.lateUs == WAVEFORM_MISSED)
+    {
+      Serial.printf("WAVE %d,%u,,%d", dumpRow, timeMs, table[dumpRow]);
+      for (uint8_t i = 0; i < nbLinks; i++)
+        Serial.printf(",,,");
+      Serial.printf("\n");
+      continue;
+    }
+
+    Serial.printf("WAVE %d,%u,%u,%d", dumpRow, timeMs, row.lateUs, row.torque);
+    for (uint8_t i = 0; i < nbLinks; i++)
+      Serial.printf(",%d,%u,%u", row.speed[i], row.flags[i], row.status[i]);
+    Serial.printf("\n");
+  }
+
+  if (dumpRow > lastTick)
+  {
+    Serial.printf("WAVE END\n");
+    dumpRow = -1;
+  }
+}
+
+void WaveformPlayer::printStats()
+{
+  if (!playing)
+    return;
+
+  Serial.printf("waveform : %s / tick %u of %u / %u recorded / %u missed / late max = %u us\n",
+                waveformShapeName(profile.shape), tick, nbTicks, nbRecords, missed, lateMaxUs);
+}
+
+#endif
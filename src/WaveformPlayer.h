@@ -0,0 +1,89 @@
+// *******************************************************************
+//  SmartESC waveform player
+//
+//  Bench test mode : plays a precomputed torque table (Waveform.h) on
+//  every link, without a rider. Tick k is due at start + k * tickMs,
+//  from the start time and not from the previous tick, so a late tick
+//  never shifts the next ones. When a tick is due the links are asked
+//  for a torque write at their next step (same preemption as
+//  LATENCY_FIRST), and the first torque write of the tick records one
+//  row : how late the write was, the torque, then speed / flags /
+//  status of each link. Speed is polled every run cycle while playing.
+//
+//  At the end the torque goes back to 0 and the rows are printed as
+//  "WAVE" CSV lines, a few per loop pass so the links keep running.
+//  Any brake stops the profile.
+// *******************************************************************
+
+#ifndef WAVEFORM_PLAYER_H_
+#define WAVEFORM_PLAYER_H_
+
+#include <Arduino.h>
+#include "config.h"
+#include "Waveform.h"
+#include "EscLink.h"
+
+#if WAVEFORM
+
+#define WAVEFORM_LINKS 2
+#define WAVEFORM_MISSED 0xffff // lateUs of a tick without torque write
+
+typedef struct
+{
+  uint16_t lateUs; // torque write after the tick time
+  int16_t torque;
+  int32_t speed[WAVEFORM_LINKS];
+  uint32_t flags[WAVEFORM_LINKS];
+  uint8_t status[WAVEFORM_LINKS];
+} WaveformRecord;
+
+class WaveformPlayer
+{
+public:
+  bool start(const WaveformProfile &profile, EscLink *const *links, uint8_t nbLinks, uint32_t timeUs);
+  void stop(const char *reason);
+
+  bool isPlaying() const { return playing; }
+
+  // true when a new tick is due or the profile ended : every link should write its torque
+  bool update(uint32_t timeUs);
+
+  // torque of the current tick, 0 once stopped
+  int16_t value() const { return playing ? table[tick] : 0; }
+
+  // first torque write of the tick : row of the ESC responses
+  void record(uint32_t timeUs);
+
+  // prints a few pending rows, call every loop pass
+  void dump();
+
+  void printStats();
+
+private:
+  WaveformProfile profile;
+  int16_t table[WAVEFORM_MAX_TICKS];
+  WaveformRecord records[WAVEFORM_MAX_TICKS];
+  uint16_t nbTicks = 0;
+  EscLink *const *links = NULL;
+  uint8_t nbLinks = 1;
+
+  bool playing = false;
+  uint16_t tick = 0;
+  uint32_t nextTick = 0;
+  bool recordPending = false;
+  uint32_t timeStartUs = 0;
+  uint32_t tickUs = 0;
+
+  // rows recorded, missed ticks (no torque write before the next tick), worst lateness
+  uint16_t nbRecords = 0;
+  uint16_t lastTick = 0;
+  uint16_t missed = 0;
+  uint16_t lateMaxUs = 0;
+  int32_t dumpRow = -1; // -1 : no dump pending
+};
+
+extern WaveformPlayer waveformPlayer;
+
+#endif
+
+#endif
@@ -0,0 +1,196 @@
+// *******************************************************************
+//  SmartESC serial control - build configuration
+// *******************************************************************
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+// ########################## DEFINES ##########################
+
+#define DEBUG 0
+#define DEBUG_SERIAL 0
+#define DEBUG_SERIAL_EXPECTED_ANSWERS 0
+#define DEBUG_SERIAL_ORDERS 0 // console line per ESC order and reply, printf from the IRAM hot path
+#define PATCHED_ESP32_FWK 1
+#define START_AND_STOP 0
+#define KICK_START 0
+#define BAUD_NEGOTIATION 0
+#define DUAL_ESC 0     // second SmartESC on UART2
+#define SYNC_TORQUE 1  // dual ESC : send torque to both motors in the same loop pass
+#define LINK_STATS 1   // periodic per-link throughput / latency report
+#define LINK_CAPTURE 1 // RAM capture of the ESC link traffic, dumped with 'c' on the console
+#define LINK_CAPTURE_DUMP_ON_FAULT 1
+#define TRACE_EVENTS 1 // timing trace ring, dumped with 't' on the console
+#define LATENCY_FIRST 0 // torque write preempts the diagnostic polls when throttle / brake move
+#define BLE_TELEMETRY 0 // telemetry GATT service, samples batched in MTU sized notifications
+#define FLUX_MAP 0      // speed indexed flux weakening, written with the torque
+#define CRUISE 0        // steady throttle hands the speed loop to the ESC, brake or throttle takes it back
+#define IRAM_HOT_PATH 1 // frame encode / parse, torque mapping and link tick in IRAM, tables in DRAM
+#define PROFILE_HOT_PATH 0 // cycles and cache miss stall counters of the hot path in the link stats report
+#define PROFILE_FLASH_LOAD 0 // profiling : NVS writes from core 0 to measure the hot path while flash is busy
+#define POWER_MANAGEMENT 0 // parked : CPU at 80 MHz and slower ESC polls
+#define POWER_LIGHT_SLEEP 0 // parked : light sleep between the ESC polls, not with BLE_TELEMETRY
+#define MEMORY_REPORT 1 // stack high-water marks, heap low-water and allocations per control cycle, 'm' on the console
+#define TELEMETRY_STATS 0 // mean / stddev / min / max / p50 / p95 / p99 over 1 s, 10 s and the ride, 's' on the console
+#define WAVEFORM 0 // bench test : 'w' on the console plays the WAVEFORM_* torque profile on every motor, any brake stops it
+#define RIDE_LOG 0 // delta-compressed samples of every torque write on SPIFFS, last minute dumped with 'r' on the console
+#define ESC_BRIDGE 0 // 'b' on the console : the PC drives the first ESC through the console UART, see EscBridge.h
+#define LINK_BENCH 0 // bench test at boot : saturation of every link per baud rate, RX interrupt setting and pipeline depth
+
+// serial
+#define SERIAL_BAUD 921600        // [-] Baud rate for built-in Serial (used for the Serial Monitor)
+#define BAUD_RATE_SMARTESC 115200 //115200
+#define ESC_RX_TIMEOUT 2           // [symbols] RX interrupt after this idle time on the ESC UART
+#define ESC_RX_ADAPTIVE 1          // [-] RX interrupt exactly on the last byte of the expected reply
+#define ESC_UART_ISR_CORE -1      // [-] core servicing the ESC UART interrupts, -1 for the setup() core
+
+// persisted settings
+#define NVS_NAMESPACE "smartesc"
+
+// baud negotiation
+#define BAUD_PROBE_BURST 20        // [-] GET REG round trips per tested rate
+#define BAUD_PROBE_TIMEOUT 20      // [ms] max wait for each probe reply
+#define BAUD_NVS_KEY "escBaud"     // link id is appended
+
+// BLE telemetry
+#define BLE_DEVICE_NAME "SmartESC"
+#define BLE_TELEMETRY_MTU 185           // [bytes] requested ATT MTU, the peer may negotiate less
+#define BLE_TELEMETRY_PERIOD 20         // [ms] sampling period
+#define BLE_TELEMETRY_FLUSH 200         // [ms] max age of the first sample of a batch
+#define BLE_TELEMETRY_TASK_CORE 0       // [-] BT host core, the ESC links run on core 1
+#define BLE_TELEMETRY_TASK_PRIORITY 0   // [-] below the loop task (1)
+#define BLE_TELEMETRY_TASK_STACK 3072   // [bytes]
+#define BLE_PIN 123456                  // static passkey of the first pairing, then bonded keys in NVS
+#define BLE_CONN_FAST_INTERVAL 24       // [1.25 ms] dashboard in the foreground, notifications enabled
+#define BLE_CONN_SLOW_INTERVAL 400      // [1.25 ms] connected but idle
+#define BLE_CONN_SLOW_LATENCY 4         // [-] connection events the peripheral may skip when idle
+#define BLE_CONN_TIMEOUT 600            // [10 ms] supervision timeout
+#define BLE_NVS_KEY_NOTIFY "bleNotify"  // notifications state of the bonded client
+
+// profiling
+#define PROFILE_FLASH_LOAD_PERIOD 100 // [ms] NVS write period of the flash load task
+
+// hot path placement, see IRAM_HOT_PATH
+#if IRAM_HOT_PATH
+#define HOT_PATH_ATTR IRAM_ATTR
+#define HOT_TABLE_ATTR DRAM_ATTR
+#else
+#define HOT_PATH_ATTR
+#define HOT_TABLE_ATTR
+#endif
+
+// power management
+#define POWER_PARK_DELAY 10000       // [ms] inputs released and motors stopped before parking
+#define POWER_PARK_SPEED 10          // [rpm] estimated speed of a stopped motor
+#define POWER_ACTIVE_CPU_MHZ 240
+#define POWER_PARKED_CPU_MHZ 80      // [MHz] 80 and above keep the APB clock at 80 MHz
+#define POWER_PARKED_STEP_DELAY 100  // [ms] run cycle step interval when parked
+#define POWER_SLEEP_MIN 5            // [ms] shorter idle times are not worth a light sleep
+#define POWER_SLEEP_MAX 50           // [ms] input sampling period in light sleep
+#define POWER_REPLY_WAIT 20          // [ms] reply wait before a silent ESC no longer prevents light sleep
+#define POWER_UART_WAKE_EDGES 3      // [-] console RX edges waking from light sleep, these bytes are lost
+#define POWER_CURRENT_ACTIVE 50000   // [uA] 240 MHz, radio off : datasheet typical at 3.3 V, to measure per board
+#define POWER_CURRENT_PARKED 25000   // [uA] 80 MHz
+#define POWER_CURRENT_LIGHT_SLEEP 800 // [uA]
+
+// ride log
+#define RIDE_LOG_BUFFERS 3          // [-] RAM blocks, one filling while the others wait for the flash
+#define RIDE_LOG_FLUSH 60000        // [ms] max age of the first sample of a block in RAM
+#define RIDE_LOG_WRITE_CHUNK 256    // [bytes] one flash page per write, bounds each cache stall
+#define RIDE_LOG_FREE_BLOCKS 8      // [-] free space kept by deleting the oldest rides
+#define RIDE_LOG_DUMP 60000         // [ms] history dumped with 'r' on the console
+#define RIDE_LOG_DUMP_ROWS 2        // [-] samples printed per loop pass
+#define RIDE_LOG_TASK_CORE 0        // [-] the ESC links run on core 1
+#define RIDE_LOG_TASK_PRIORITY 0    // [-] below the loop task (1)
+#define RIDE_LOG_TASK_STACK 4096    // [bytes] SPIFFS calls
+
+// USB bridge
+#define BRIDGE_BATCH_SIZE 256       // [bytes] records sent to the host in one write
+#define BRIDGE_FLUSH 2              // [ms] max age of the first record of a batch
+#define BRIDGE_REPLY_TIMEOUT 20     // [ms] requests in flight dropped without reply
+#define BRIDGE_HOST_TIMEOUT 100     // [ms] host silence before torque 0, then again every period
+
+// link saturation bench
+#define LINK_BENCH_DURATION 300     // [ms] per configuration
+#define LINK_BENCH_TIMEOUT 20       // [ms] max wait for the oldest reply in flight
+#define LINK_BENCH_QUIET 5          // [ms] line silence before a run and after an error
+#define LINK_BENCH_MAX_DEPTH 8      // [-] max requests in flight
+#define RIDE_LOG_NVS_KEY "ride"     // ride counter
+
+// waveform player (bench test), shapes in Waveform.h
+#define WAVEFORM_SHAPE WAVEFORM_SINE
+#define WAVEFORM_OFFSET 2000       // [-] torque
+#define WAVEFORM_AMPLITUDE 1000    // [-] torque
+#define WAVEFORM_PERIOD 2000       // [ms] step time, ramp length, triangle / sine period, chirp start period
+#define WAVEFORM_END_PERIOD 200    // [ms] chirp end period
+#define WAVEFORM_DURATION 10000    // [ms]
+#define WAVEFORM_TICK 10           // [ms] one torque write per tick
+#define WAVEFORM_MAX_TICKS 1000    // [-] table and records, 26 bytes per tick
+#define WAVEFORM_DUMP_ROWS 2       // [-] rows printed per loop pass
+
+// pinout
+#define PIN_SERIAL_ESP_TO_CNTRL 27 //TX
+#define PIN_SERIAL_CNTRL_TO_ESP 14 //RX
+#define PIN_SERIAL2_ESP_TO_CNTRL 17 //TX -- second ESC
+#define PIN_SERIAL2_CNTRL_TO_ESP 16 //RX -- second ESC
+#define PIN_IN_ABRAKE 34           //Brake
+#define PIN_IN_ATHROTTLE 39        //Throttle
+
+// delays
+#define DELAY_SEND_ERROR 1000 // [ms] Sending time interval
+#define DELAY_BETWEEN_STATES 10
+#define DELAY_CMD 10
+#define DELAY_TORQUE_SYNC 20  // [ms] max wait for the other motor before sending torque alone
+#define DELAY_LINK_STATS 5000 // [ms] link stats report interval
+#define DELAY_CAPTURE_DUMP 5000 // [ms] min interval between two fault dumps
+#define DELAY_MEMORY_SAMPLE 1000 // [ms] heap and stack sample interval
+
+// buffers
+#define LINK_CAPTURE_SIZE 8192 // [bytes] link capture ring
+#define TRACE_SIZE 1024        // [events] timing trace ring, 8 bytes each
+
+// motor orders
+#define THROTTLE_TO_TORQUE_FACTOR 50 // 128 for max -- positive torque on throttle
+#define BRAKE_TO_TORQUE_FACTOR 20  // 128 for max -- negative torque on brake
+#define THROTTLE_MINIMAL_TORQUE 1000 // appying this minimal torque when throttle is engaged
+
+#define MIN_KICK_START_RPM 60 // minimal RPM speed before applying torque -- used only if KICK_START is enabled
+#define MIN_BRAKE_RPM 40      // minimal RPM speed for electric brake
+
+// speed estimator, brake and kick start decisions use the extrapolated speed
+#define SPEED_POLL_CYCLES 2       // [-] run cycles per speed poll (ESC_POLL_SLOW registers)
+#define SPEED_EST_ALPHA 192       // [/256] alpha-beta filter speed gain
+#define SPEED_EST_BETA 115        // [/256] acceleration gain, alpha^2 / (2 - alpha) for critical damping
+#define SPEED_EST_TORQUE_GAIN 20  // [rpm/s per 1024 torque] torque change feed-forward, to tune per motor, 0 to disable
+#define SPEED_EST_MAX_AGE 300     // [ms] no extrapolation beyond, speed is polled at the next cycle
+#define TORQUE_KP 200         // divided by 1024
+#define TORQUE_KI 50          // divided by 16384
+#define FLUX_KP 1800          // divided by 1024 // default 3649
+#define FLUX_KI 1000          // divided by 16384 // default 1995
+#define STARUP_FLUX_REFERENCE 0
+
+// flux weakening map, values to tune per motor and battery voltage
+#define FLUX_MAP_POINTS {{0, 0}, {600, 0}, {800, -1000}, {1000, -2500}} // {speed [rpm], flux reference}, ascending speeds
+#define FLUX_MAP_HYSTERESIS 30     // [rpm] speed drop before the map follows a deceleration
+#define FLUX_MAP_THRESHOLD 100     // [-] min flux reference change written to the ESC
+#define FLUX_MAP_MIN_INTERVAL 50   // [ms] min time between two flux reference writes
+#define FLUX_MAP_TORQUE_SCALE 0    // 1 : map value scaled by the torque demand
+#define FLUX_MAP_TORQUE_MIN 50     // [%] scale at zero torque, keeps weakening above base speed when coasting
+#define FLUX_MAP_FULL_TORQUE 10000 // [-] torque demand for the full map value
+
+// cruise
+#define CRUISE_MIN_SPEED 200        // [rpm] no cruise below
+#define CRUISE_ENGAGE_DELAY 5000    // [ms] steady throttle time before cruising
+#define CRUISE_THROTTLE_TOLERANCE 8 // [-] throttle (0-255) move still seen as steady
+#define CRUISE_POLL_PERIOD 250      // [ms] status and speed polls while cruising
+#define CRUISE_NUDGE_TIME 400       // [ms] max throttle tap while cruising, raises the setpoint
+#define CRUISE_NUDGE_SPEED 50       // [rpm] setpoint step of a throttle tap
+
+// dual motor torque split, in percent of the computed torque
+#define TORQUE_SPLIT_MOTOR_0 100
+#define TORQUE_SPLIT_MOTOR_1 100
+
+#define SECURITY_OFFSET 100 // throttle and brake threshold
+#define LATENCY_FIRST_THRESHOLD 2 // [-] throttle / brake change (0-255) requesting a torque write
+
+#endif
@@ -1,4 +1,3 @@
-
 // *******************************************************************
 //  ESP32 example code
 //
@@ -9,81 +8,23 @@
 // *******************************************************************
 
 #include <Arduino.h>
-
-// ########################## DEFINES ##########################
-
-#define DEBUG 0
-#define DEBUG_SERIAL 0
-#define DEBUG_SERIAL_EXPECTED_ANSWERS 0
-#define TEST_DYNAMIC_FLUX 0
-#define PATCHED_ESP32_FWK 1
-#define START_AND_STOP 0
-#define KICK_START 0
-
-// serial
-#define SERIAL_BAUD 921600        // [-] Baud rate for built-in Serial (used for the Serial Monitor)
-#define BAUD_RATE_SMARTESC 115200 //115200
-
-// pinout
-#define PIN_SERIAL_ESP_TO_CNTRL 27 //TX
-#define PIN_SERIAL_CNTRL_TO_ESP 14 //RX
-#define PIN_IN_ABRAKE 34           //Brake
-#define PIN_IN_ATHROTTLE 39        //Throttle
-
-// delays
-#define DELAY_SEND_ERROR 1000 // [ms] Sending time interval
-#define DELAY_BETWEEN_STATES 10
-#define DELAY_CMD 10
-
-// send frame headers
-#define SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET 0x01
-#define SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET 0x02
-#define SERIAL_START_FRAME_DISPLAY_TO_ESC_CMD 0x03 // [-] Start frame definition for serial commands
-#define SERIAL_START_FRAME_ESC_TO_DISPLAY_OK 0xF0
-#define SERIAL_START_FRAME_ESC_TO_DISPLAY_ERR 0xFF
-
-// commandes
-#define SERIAL_FRAME_CMD_START 0x01
-#define SERIAL_FRAME_CMD_STOP 0x02
-#define SERIAL_FRAME_CMD_FAULT_ACK 0x07
-
-// registers
-#define FRAME_REG_TARGET_MOTOR 0x00
-#define FRAME_REG_FLAGS 0x01
-#define FRAME_REG_STATUS 0x02
-#define FRAME_REG_CONTROL_MODE 0x03
-#define FRAME_REG_SPEED 0x04
-#define FRAME_REG_TORQUE 0x08
-#define FRAME_REG_TORQUE_KP 0x09
-#define FRAME_REG_TORQUE_KI 0x0A
-#define FRAME_REG_FLUX_REF 0x0C
-#define FRAME_REG_FLUX_KI 0x0D
-#define FRAME_REG_FLUX_KP 0x0E
-#define FRAME_REG_SPEED_MEASURED 0x1E
-#define FRAME_REG_RAMP_FINAL_SPEED 91
-
-// motor orders
-#define THROTTLE_TO_TORQUE_FACTOR 50 // 128 for max -- positive torque on throttle
-#define BRAKE_TO_TORQUE_FACTOR 20  // 128 for max -- negative torque on brake
-#define THROTTLE_MINIMAL_TORQUE 1000 // appying this minimal torque when throttle is engaged
-
-#define MIN_KICK_START_RPM 60 // minimal RPM speed before applying torque -- used only if KICK_START is enabled
-#define MIN_BRAKE_RPM 40      // minimal RPM speed for electric brake
-#define TORQUE_KP 200         // divided by 1024
-#define TORQUE_KI 50          // divided by 16384
-#define FLUX_KP 1800          // divided by 1024 // default 3649
-#define FLUX_KI 1000          // divided by 16384 // default 1995
-#define STARUP_FLUX_REFERENCE 0
-
-#define SECURITY_OFFSET 100 // throttle and brake threshold
+#include <Preferences.h>
+#include "config.h"
+#include "EscLink.h"
+#include "LinkCapture.h"
+#include "TraceRing.h"
+#include "Telemetry.h"
+#include "BleTelemetry.h"
+#include "PerfCounters.h"
+#include "MemoryReport.h"
+#include "PowerManager.h"
+#include "RideLog.h"
+#include "TelemetryStats.h"
+#include "WaveformPlayer.h"
+#include "LinkBench.h"
+#include "EscBridge.h"
 
 // Global variables
-uint8_t idx = 0;       // Index for new data pointer
-uint8_t bufStartFrame; // Buffer Start Frame
-byte *p;               // Pointer declaration for the new received data
-byte incomingByte;
-byte incomingBytePrev;
-uint8_t receiveBuffer[1000]; // Buffer Start Frame
 
 // Trottle
 int32_t analogValueThrottle = 0;
@@ -95,743 +36,680 @@ int32_t analogValueBrake = 0;
 uint16_t analogValueBrakeRaw = 0;
 uint16_t analogValueBrakeMinCalibRaw = 0;
 
-uint32_t lastOrderType;
-uint32_t lastOrderValue;
-
-int32_t speed = 0;
-uint32_t flags = 0;
-int16_t torque = 0;
-uint8_t motorStateMachineStatus;
-
-unsigned long timeSend = 0;
-unsigned long timeLastReply;
-uint32_t expectedAnswers = 0;
-int8_t state = 0;
-uint32_t iLoop = 0;
-
-char print_buffer[500];
 
-#pragma pack(push, 1)
-typedef struct
-{
-  uint8_t Frame_start;
-  uint8_t Lenght;
-  uint8_t Command;
-  uint8_t CRC8;
-} __attribute__((packed)) SerialCommand;
-#pragma pack(pop)
-SerialCommand command;
-
-#pragma pack(push, 1)
-typedef struct
-{
-  uint8_t Frame_start;
-  uint8_t Lenght;
-  uint8_t Reg;
-  int32_t Value;
-  uint8_t CRC8;
-} __attribute__((packed)) SerialRegSet32;
-#pragma pack(pop)
-SerialRegSet32 regSet32;
-
-#pragma pack(push, 1)
-typedef struct
-{
-  uint8_t Frame_start;
-  uint8_t Lenght;
-  uint8_t Reg;
-  int16_t Value;
-  uint8_t CRC8;
-} __attribute__((packed)) SerialRegSet16;
-#pragma pack(pop)
-SerialRegSet16 regSetS16;
-
-#pragma pack(push, 1)
-typedef struct
-{
-  uint8_t Frame_start;
-  uint8_t Lenght;
-  uint8_t Reg;
-  uint16_t Value;
-  uint8_t CRC8;
-} __attribute__((packed)) SerialRegSetU16;
-#pragma pack(pop)
-SerialRegSetU16 regSetU16;
-
-#pragma pack(push, 1)
-typedef struct
-{
-  uint8_t Frame_start;
-  uint8_t Lenght;
-  uint8_t Reg;
-  int8_t Value;
-  uint8_t CRC8;
-} __attribute__((packed)) SerialRegSet8;
-#pragma pack(pop)
-SerialRegSet8 regSet8;
-
-/** @name Fault source error codes */
-/** @{ */
-#define MC_NO_ERROR (uint16_t)(0x0000u)     /**< @brief No error.*/
-#define MC_NO_FAULTS (uint16_t)(0x0000u)    /**< @brief No error.*/
-#define MC_FOC_DURATION (uint16_t)(0x0001u) /**< @brief Error: FOC rate to high.*/
-#define MC_OVER_VOLT (uint16_t)(0x0002u)    /**< @brief Error: Software over voltage.*/
-#define MC_UNDER_VOLT (uint16_t)(0x0004u)   /**< @brief Error: Software under voltage.*/
-#define MC_OVER_TEMP (uint16_t)(0x0008u)    /**< @brief Error: Software over temperature.*/
-#define MC_START_UP (uint16_t)(0x0010u)     /**< @brief Error: Startup failed.*/
-#define MC_SPEED_FDBK (uint16_t)(0x0020u)   /**< @brief Error: Speed feedback.*/
-#define MC_BREAK_IN (uint16_t)(0x0040u)     /**< @brief Error: Emergency input (Over current).*/
-#define MC_SW_ERROR (uint16_t)(0x0080u)     /**< @brief Software Error.*/
-
-typedef enum
-{
-  ICLWAIT = 12,               /*!< Persistent state, the system is waiting for ICL
-                           deactivation. Is not possible to run the motor if
-                           ICL is active. Until the ICL is active the state is
-                           forced to ICLWAIT, when ICL become inactive the state
-                           is moved to IDLE */
-  IDLE = 0,                   /*!< Persistent state, following state can be IDLE_START
-                           if a start motor command has been given or
-                           IDLE_ALIGNMENT if a start alignment command has been
-                           given */
-  IDLE_ALIGNMENT = 1,         /*!< "Pass-through" state containg the code to be executed
-                           only once after encoder alignment command.
-                           Next states can be ALIGN_CHARGE_BOOT_CAP or
-                           ALIGN_OFFSET_CALIB according the configuration. It
-                           can also be ANY_STOP if a stop motor command has been
-                           given. */
-  ALIGN_CHARGE_BOOT_CAP = 13, /*!< Persistent state where the gate driver boot
-                           capacitors will be charged. Next states will be
-                           ALIGN_OFFSET_CALIB. It can also be ANY_STOP if a stop
-                           motor command has been given. */
-  ALIGN_OFFSET_CALIB = 14,    /*!< Persistent state where the offset of motor currents
-                           measurements will be calibrated. Next state will be
-                           ALIGN_CLEAR. It can also be ANY_STOP if a stop motor
-                           command has been given. */
-  ALIGN_CLEAR = 15,           /*!< "Pass-through" state in which object is cleared and
-                           set for the startup.
-                           Next state will be ALIGNMENT. It can also be ANY_STOP
-                           if a stop motor command has been given. */
-  ALIGNMENT = 2,              /*!< Persistent state in which the encoder are properly
-                           aligned to set mechanical angle, following state can
-                           only be ANY_STOP */
-  IDLE_START = 3,             /*!< "Pass-through" state containg the code to be executed
-                           only once after start motor command.
-                           Next states can be CHARGE_BOOT_CAP or OFFSET_CALIB
-                           according the configuration. It can also be ANY_STOP
-                           if a stop motor command has been given. */
-  CHARGE_BOOT_CAP = 16,       /*!< Persistent state where the gate driver boot
-                           capacitors will be charged. Next states will be
-                           OFFSET_CALIB. It can also be ANY_STOP if a stop motor
-                           command has been given. */
-  OFFSET_CALIB = 17,          /*!< Persistent state where the offset of motor currents
-                           measurements will be calibrated. Next state will be
-                           CLEAR. It can also be ANY_STOP if a stop motor
-                           command has been given. */
-  CLEAR = 18,                 /*!< "Pass-through" state in which object is cleared and
-                           set for the startup.
-                           Next state will be START. It can also be ANY_STOP if
-                           a stop motor command has been given. */
-  START = 4,                  /*!< Persistent state where the motor start-up is intended
-                           to be executed. The following state is normally
-                           SWITCH_OVER or RUN as soon as first validated speed is
-                           detected. Another possible following state is
-                           ANY_STOP if a stop motor command has been executed */
-  SWITCH_OVER = 19,           /**< TBD */
-  START_RUN = 5,              /*!< "Pass-through" state, the code to be executed only
-                           once between START and RUN states itâ€™s intended to be
-                           here executed. Following state is normally  RUN but
-                           it can also be ANY_STOP  if a stop motor command has
-                           been given */
-  RUN = 6,                    /*!< Persistent state with running motor. The following
-                           state is normally ANY_STOP when a stop motor command
-                           has been executed */
-  ANY_STOP = 7,               /*!< "Pass-through" state, the code to be executed only
-                           once between any state and STOP itâ€™s intended to be
-                           here executed. Following state is normally STOP */
-  STOP = 8,                   /*!< Persistent state. Following state is normally
-                           STOP_IDLE as soon as conditions for moving state
-                           machine are detected */
-  STOP_IDLE = 9,              /*!< "Pass-through" state, the code to be executed only
-                           once between STOP and IDLE itâ€™s intended to be here
-                           executed. Following state is normally IDLE */
-  FAULT_NOW = 10,             /*!< Persistent state, the state machine can be moved from
-                           any condition directly to this state by
-                           STM_FaultProcessing method. This method also manage
-                           the passage to the only allowed following state that
-                           is FAULT_OVER */
-  FAULT_OVER = 11,            /*!< Persistent state where the application is intended to
-                          stay when the fault conditions disappeared. Following
-                          state is normally STOP_IDLE, state machine is moved as
-                          soon as the user has acknowledged the fault condition.
-                      */
-  WAIT_STOP_MOTOR = 20
-
-} State_t;
+unsigned long timeAnalogSampleUs = 0;
+unsigned long timeInputChangeUs = 0; // first sample that saw the inputs move, 0 if none pending
+int32_t analogValueThrottleSent = 0;
+int32_t analogValueBrakeSent = 0;
 
+// ESC links
 HardwareSerial hwSerCntrl(1);
+EscLink escLink(0, hwSerCntrl);
+#if DUAL_ESC
+HardwareSerial hwSerCntrl2(2);
+EscLink escLink2(1, hwSerCntrl2);
+EscLink *escLinks[] = {&escLink, &escLink2};
+const int16_t HOT_TABLE_ATTR torqueSplit[] = {TORQUE_SPLIT_MOTOR_0, TORQUE_SPLIT_MOTOR_1};
+#else
+EscLink *escLinks[] = {&escLink};
+const int16_t HOT_TABLE_ATTR torqueSplit[] = {TORQUE_SPLIT_MOTOR_0};
+#endif
+#define NB_ESC_LINKS (sizeof(escLinks) / sizeof(escLinks[0]))
 
-void displayBuffer(uint8_t *buffer, uint8_t size)
-{
-  for (int i = 0; i < size; i++)
-  {
-    Serial.printf("%02x ", buffer[i]);
-  }
-  Serial.printf("\n");
-}
-uint8_t getCrc(uint8_t *buffer, uint8_t size)
-{
-  uint16_t crc = 0;
-  for (int i = 0; i < size - 1; i++)
-  {
-    crc = crc + buffer[i];
-    //Serial.printf("crc = %02x\n", crc);
-  }
+unsigned long timeTorquePending = 0;
 
-  uint8_t finalCrc = (uint8_t)(crc & 0xff) + ((crc >> 8) & 0xff);
-  //Serial.printf("finalCrc = %02x\n", finalCrc);
-  //Serial.printf("\n");
-  return finalCrc;
-}
+#if PROFILE_HOT_PATH
+PerfCounters hotPathCounters;
+#endif
+#if MEMORY_REPORT
+unsigned long timeMemorySample = 0;
+#endif
+
+#if CRUISE
+bool cruising = false;             // speed regulated by the ESCs
+int32_t cruiseThrottle = 0;        // throttle held when the cruise engaged
+bool cruiseReleased = false;       // throttle released since the cruise engaged
+unsigned long timeCruisePress = 0; // start of the throttle press in progress, 0 if released
+int32_t throttleSteady = 0;
+unsigned long timeThrottleSteady = 0;
+#endif
+#if TELEMETRY_STATS
+uint32_t timeLastLoopUs = 0;
+#endif
+unsigned long timeLastStats = 0;
 
-// ########################## SEND ##########################
+// ########################## THROTTLE / BRAKE ##########################
 
-void SendCmd(uint8_t cmd)
+void HOT_PATH_ATTR sampleAnalogData()
 {
-  // Create command
-  command.Frame_start = SERIAL_START_FRAME_DISPLAY_TO_ESC_CMD;
-  command.Lenght = 1;
-  command.Command = cmd;
-  command.CRC8 = getCrc((uint8_t *)&command, sizeof(command));
+  timeAnalogSampleUs = micros();
 
-  displayBuffer((uint8_t *)&command, sizeof(command));
+  // Compute throttle
+  analogValueThrottleRaw = analogRead(PIN_IN_ATHROTTLE);
+  analogValueThrottle = analogValueThrottleRaw - analogValueThrottleMinCalibRaw - SECURITY_OFFSET;
+  analogValueThrottle = analogValueThrottle / 4;
+  if (analogValueThrottle > 255)
+    analogValueThrottle = 255;
+  if (analogValueThrottle < 0)
+    analogValueThrottle = 0;
 
-  // Write to Serial
-  hwSerCntrl.write((uint8_t *)&command, sizeof(command));
+  // Compute brake
+  analogValueBrakeRaw = analogRead(PIN_IN_ABRAKE);
+  analogValueBrake = analogValueBrakeRaw - analogValueBrakeMinCalibRaw - SECURITY_OFFSET;
+  analogValueBrake = analogValueBrake / 3;
+  if (analogValueBrake > 255)
+    analogValueBrake = 255;
+  if (analogValueBrake < 0)
+    analogValueBrake = 0;
 
-  // store last command
-  lastOrderType = SERIAL_START_FRAME_DISPLAY_TO_ESC_CMD;
-  lastOrderValue = cmd;
-  expectedAnswers++;
+  TRACE(TRACE_ADC, 0, analogValueThrottle);
 }
 
-void GetReg(uint8_t reg)
+void readAnalogData(uint32_t state)
 {
-  // Create command
-  command.Frame_start = SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET;
-  command.Lenght = 1;
-  command.Command = reg;
-  command.CRC8 = getCrc((uint8_t *)&command, sizeof(command));
-
-  displayBuffer((uint8_t *)&command, sizeof(command));
-
-  // Write to Serial
-  hwSerCntrl.write((uint8_t *)&command, sizeof(command));
-  // store last command
-  lastOrderType = SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET;
-  lastOrderValue = reg;
-  expectedAnswers++;
-}
+  sampleAnalogData();
 
-void SetRegU16(uint8_t reg, uint16_t val)
-{
-  // Create command
-  regSetU16.Frame_start = SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET;
-  regSetU16.Lenght = 3;
-  regSetU16.Reg = reg;
-  regSetU16.Value = val;
-  regSetU16.CRC8 = getCrc((uint8_t *)&regSetU16, sizeof(regSetU16));
-
-  displayBuffer((uint8_t *)&regSetU16, sizeof(regSetU16));
-
-  // Write to Serial
-  hwSerCntrl.write((uint8_t *)&regSetU16, sizeof(regSetU16));
-
-  // store last command
-  lastOrderType = SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET;
-  lastOrderValue = reg;
-  expectedAnswers++;
+  // printed in pieces : no String, and Serial.printf allocates beyond 64 characters
+  Serial.printf("%d / readAnalogData // throttleRaw = %d", state, analogValueThrottleRaw);
+  Serial.printf(" / throttleMinCalibRaw = %d / throttle = %d", analogValueThrottleMinCalibRaw, analogValueThrottle);
+  Serial.printf(" / brakeRaw = %d / brakeMinCalibRaw = %d", analogValueBrakeRaw, analogValueBrakeMinCalibRaw);
+  Serial.printf(" / brake = %d\n", analogValueBrake);
 }
 
-void SetRegS16(uint8_t reg, int16_t val)
-{
-  // Create command
-  regSetS16.Frame_start = SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET;
-  regSetS16.Lenght = 3;
-  regSetS16.Reg = reg;
-  regSetS16.Value = val;
-  regSetS16.CRC8 = getCrc((uint8_t *)&regSetS16, sizeof(regSetS16));
-
-  displayBuffer((uint8_t *)&regSetS16, sizeof(regSetS16));
-
-  // Write to Serial
-  hwSerCntrl.write((uint8_t *)&regSetS16, sizeof(regSetS16));
-
-  // store last command
-  lastOrderType = SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET;
-  lastOrderValue = reg;
-  expectedAnswers++;
-}
+// ########################## TORQUE ##########################
 
-// ########################## RECEIVE ##########################
-void Receive()
+int16_t HOT_PATH_ATTR computeTorque(int32_t speed, int16_t torque)
 {
-  uint16_t nbBytes = 0;
-
-  // Check for new data availability in the Serial buffer
-  while (hwSerCntrl.available())
+  // Send torque commands
+  if (analogValueBrake > 0)
   {
-    incomingByte = hwSerCntrl.read();      // Read the incoming byte
-    receiveBuffer[nbBytes] = incomingByte; // Construct the start frame
-
-    nbBytes++;
+    if (speed > MIN_BRAKE_RPM)
+    {
+      torque = -analogValueBrake * BRAKE_TO_TORQUE_FACTOR;
+    }
+    else
+    {
+      torque = 0;
+    }
   }
-  if (nbBytes > 0)
+  else if (analogValueThrottle > 0)
   {
-
-    timeLastReply = millis();
-
-#if DEBUG_SERIAL
-    // display frame
-    Serial.print("   received : ");
-    for (int i = 0; i < nbBytes; i++)
+#if KICK_START
+    if (speed >= MIN_KICK_START_RPM)
     {
-      Serial.printf("%02x ", receiveBuffer[i]);
+      torque = THROTTLE_MINIMAL_TORQUE + (analogValueThrottle * THROTTLE_TO_TORQUE_FACTOR);
     }
-    Serial.println();
+#else
+    torque = THROTTLE_MINIMAL_TORQUE + (analogValueThrottle * THROTTLE_TO_TORQUE_FACTOR);
 #endif
+  }
+  else
+  {
+    torque = 0;
+  }
 
-    int iFrame = 0;
-    bool continueReading = true;
-    uint16_t msgSize = 0;
-    bool isErrorFrame = false;
-    while (continueReading)
-    {
-      msgSize = receiveBuffer[iFrame + 1];
-#if DEBUG_SERIAL
-      Serial.printf("   size = %02x\n", msgSize);
+  return torque;
+}
+
+#if RIDE_LOG
+// one sample per torque write
+void logRide(unsigned long timeNow)
+{
+  RideLogSample sample;
+
+  sample.timeMs = timeNow;
+  sample.throttle = analogValueThrottle;
+  sample.brake = analogValueBrake;
+  for (uint8_t i = 0; i < RIDE_LOG_LINKS; i++)
+  {
+    EscLink *link = (i < NB_ESC_LINKS) ? escLinks[i] : NULL;
+    sample.torque[i] = link ? link->torque : 0;
+    sample.speed[i] = link ? link->regs.speed : 0;
+    sample.flags[i] = link ? link->flags : 0;
+    sample.state[i] = link ? link->state : 0;
+    sample.status[i] = link ? link->regs.status : 0;
+  }
+
+  rideLog.add(sample);
+}
 #endif
-      if (receiveBuffer[iFrame] == SERIAL_START_FRAME_ESC_TO_DISPLAY_OK)
-      {
-        Serial.printf("   ==> ok");
-      }
-      else if (receiveBuffer[iFrame] == SERIAL_START_FRAME_ESC_TO_DISPLAY_ERR)
-      {
-        Serial.printf("   ==> KO !!!!!!!!!");
-      }
 
-      if (msgSize == 0)
-      {
-        Serial.println("   ===> CMD or REG_SET");
-      }
-      else if (msgSize == 1)
-      {
+// Each link waits at its torque step (state 10). With SYNC_TORQUE, the inputs are
+// sampled once all running links are waiting there, then every motor gets its share
+// of the torque in the same loop pass. A link that does not come within
+// DELAY_TORQUE_SYNC does not hold the other one back.
+void HOT_PATH_ATTR sendTorques(unsigned long timeNow)
+{
+  uint8_t nbPending = 0;
+  bool allReady = true;
 
-        if ((lastOrderType == SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET) && (lastOrderValue == FRAME_REG_STATUS))
-        {
-          motorStateMachineStatus = receiveBuffer[iFrame + 2];
-          Serial.printf("   ===> motorStateMachineStatus = %02x\n", motorStateMachineStatus);
-        }
-        else
-        {
-          Serial.printf("   ===> value = %02x\n", receiveBuffer[iFrame + 2]);
-        }
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+  {
+    if (escLinks[i]->isTorquePending())
+      nbPending++;
+    else if (escLinks[i]->isRunning())
+      allReady = false;
+  }
 
-        if (lastOrderType == SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET)
-        {
-          if ((receiveBuffer[iFrame] == SERIAL_START_FRAME_ESC_TO_DISPLAY_OK) && ((receiveBuffer[iFrame + 2] == FAULT_NOW) || (receiveBuffer[iFrame + 2] == FAULT_OVER)) && (state >= 8))
-          {
-            state = -1;
-            Serial.printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! ERROR !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-          }
-        }
-      }
-      else if (msgSize == 2)
-      {
-        Serial.printf("   ===> unknonw");
-      }
-      else if (msgSize == 4)
-      {
+  if (nbPending == 0)
+  {
+    timeTorquePending = 0;
+    return;
+  }
 
-        //        Serial.printf("   ===> lastOrderType = %d / lastOrderValue : %d\n", lastOrderType, lastOrderValue);
+  if (timeTorquePending == 0)
+    timeTorquePending = timeNow;
 
-        if ((lastOrderType == SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET) && (lastOrderValue == FRAME_REG_SPEED_MEASURED))
-        {
-          memcpy(&speed, &(receiveBuffer[iFrame + 2]), 4);
-          Serial.printf("   ===> speed : %d\n", speed);
-        }
-        else if ((lastOrderType == SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET) && (lastOrderValue == FRAME_REG_FLAGS))
-        {
-          memcpy(&flags, &(receiveBuffer[iFrame + 2]), 4);
-          Serial.printf("   ===> flags : %08x\n", flags);
-
-          // try current and last faults
-          if (flags >> 16 == 0)
-            flags = flags & 0xffff;
-          else
-            flags = flags >> 16;
-
-          // decode faults
-          if (flags != 0)
-          {
-            Serial.printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! FLASG ERROR !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-
-            if (flags == MC_NO_ERROR)
-            {
-              Serial.printf("   ===> flags : MC_NO_ERROR\n");
-            }
-            else if (flags == MC_NO_FAULTS)
-            {
-              Serial.printf("   ===> flags : MC_NO_FAULTS\n");
-            }
-            else if (flags == MC_FOC_DURATION)
-            {
-              Serial.printf("   ===> flags : MC_FOC_DURATION\n");
-            }
-            else if (flags == MC_OVER_VOLT)
-            {
-              Serial.printf("   ===> flags : MC_OVER_VOLT\n");
-            }
-            else if (flags == MC_UNDER_VOLT)
-            {
-              Serial.printf("   ===> flags : MC_UNDER_VOLT\n");
-            }
-            else if (flags == MC_OVER_TEMP)
-            {
-              Serial.printf("   ===> flags : MC_OVER_TEMP\n");
-            }
-            else if (flags == MC_START_UP)
-            {
-              Serial.printf("   ===> flags : MC_START_UP\n");
-            }
-            else if (flags == MC_SPEED_FDBK)
-            {
-              Serial.printf("   ===> flags : MC_SPEED_FDBK\n");
-            }
-            else if (flags == MC_BREAK_IN)
-            {
-              Serial.printf("   ===> flags : MC_BREAK_IN\n");
-            }
-            else if (flags == MC_SW_ERROR)
-            {
-              Serial.printf("   ===> flags : MC_SW_ERROR\n");
-            }
-            else
-            {
-              Serial.printf("   ===> flags : unkown\n");
-            }
-          }
-        }
-      }
-      else
-      {
-        Serial.printf("   ===> ko (unknonw data) ----------------------------------------\n");
-        isErrorFrame = true;
-      }
+#if SYNC_TORQUE
+  if (!allReady && (timeNow - timeTorquePending < DELAY_TORQUE_SYNC))
+    return;
+#endif
 
-#if DEBUG_SERIAL
-      Serial.printf("   nbBytes = %d / iFrame = %d / nextIFrame = %d\n", nbBytes, iFrame, msgSize + 3);
+#if LATENCY_FIRST
+  // no console line between the sample and the frames
+  sampleAnalogData();
+  uint32_t sampleTimeUs = timeInputChangeUs ? timeInputChangeUs : timeAnalogSampleUs;
+#else
+  readAnalogData(10);
+  uint32_t sampleTimeUs = timeAnalogSampleUs;
 #endif
-      iFrame += msgSize + 3;
 
-#if DEBUG_SERIAL
-      Serial.printf("   next msg : iFrame = %d / msgSize = %02x\n", iFrame, msgSize);
+#if WAVEFORM
+  // the operator brakes : back to the inputs at once
+  if (waveformPlayer.isPlaying() && (analogValueBrake > 0))
+    waveformPlayer.stop("brake");
+  uint32_t timeWriteUs = micros();
 #endif
 
-      // protection against unexpected datas
-      if ((expectedAnswers > 0) && (!isErrorFrame))
-      {
-        expectedAnswers--;
-      }
-      else
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+  {
+    if (escLinks[i]->isTorquePending())
+    {
+#if WAVEFORM
+      // bench profile : the same torque on every motor, no split
+      if (waveformPlayer.isPlaying())
       {
-        Serial.printf("   unexpected datas !!!\n");
+        int16_t torque = waveformPlayer.value();
+        TRACE(TRACE_TORQUE, i, torque);
+        escLinks[i]->sendTorque(torque, sampleTimeUs);
+        continue;
       }
+#endif
+      int32_t torque = computeTorque(escLinks[i]->estimateSpeed(micros()), escLinks[i]->torque);
+      TRACE(TRACE_TORQUE, i, torque);
+      escLinks[i]->sendTorque(torque * torqueSplit[i] / 100, sampleTimeUs);
+    }
+  }
 
-      isErrorFrame = false;
+#if WAVEFORM
+  waveformPlayer.record(timeWriteUs);
+#endif
 
-      if (iFrame < nbBytes)
-      {
-        continueReading = true;
-#if DEBUG_SERIAL
-        Serial.println("      continue");
+  analogValueThrottleSent = analogValueThrottle;
+  analogValueBrakeSent = analogValueBrake;
+  timeInputChangeUs = 0;
+
+#if MEMORY_REPORT
+  memoryReport.controlCycle();
 #endif
-      }
-      else
-      {
-        continueReading = false;
-#if DEBUG_SERIAL
-        Serial.println("      stop");
+
+#if RIDE_LOG
+  logRide(timeNow);
 #endif
-      }
-    }
 
-    Serial.println();
+#if TELEMETRY_STATS
+  telemetryStats.add(STATS_THROTTLE, analogValueThrottle);
+  telemetryStats.add(STATS_BRAKE, analogValueBrake);
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+  {
+    telemetryStats.add(STATS_SPEED(i), escLinks[i]->regs.speed);
+    telemetryStats.add(STATS_TORQUE(i), escLinks[i]->torque);
   }
+#endif
+
+  timeTorquePending = 0;
 }
 
-// ########################## THROTTLE / BRAKE ##########################
+// ########################## TELEMETRY ##########################
 
-void readAnalogData(uint32_t state)
+// one consistent snapshot per loop pass for the other tasks
+void publishTelemetry()
 {
+  TelemetrySnapshot snapshot;
 
-  // Compute throttle
-  analogValueThrottleRaw = analogRead(PIN_IN_ATHROTTLE);
-  analogValueThrottle = analogValueThrottleRaw - analogValueThrottleMinCalibRaw - SECURITY_OFFSET;
-  analogValueThrottle = analogValueThrottle / 4;
-  if (analogValueThrottle > 255)
-    analogValueThrottle = 255;
-  if (analogValueThrottle < 0)
-    analogValueThrottle = 0;
+  snapshot.timeUs = micros();
+  snapshot.nbLinks = NB_ESC_LINKS;
+  for (uint8_t i = 0; i < TELEMETRY_LINKS; i++)
+  {
+    EscLink *link = (i < NB_ESC_LINKS) ? escLinks[i] : NULL;
+    snapshot.speed[i] = link ? link->regs.speed : 0;
+    snapshot.flags[i] = link ? link->flags : 0;
+    snapshot.torque[i] = link ? link->torque : 0;
+    snapshot.status[i] = link ? link->regs.status : 0;
+    snapshot.state[i] = link ? link->state : 0;
+    snapshot.uartErrors[i] = 0;
+    snapshot.uartDrops[i] = 0;
+    if (link)
+      link->uartCounters(snapshot.uartErrors[i], snapshot.uartDrops[i]);
+  }
+  snapshot.throttle = analogValueThrottle;
+  snapshot.brake = analogValueBrake;
+  snapshot.heapFree = memoryReport.heapFree;
+  snapshot.heapMin = memoryReport.heapMin;
+  snapshot.heapLargest = memoryReport.heapLargest;
+  snapshot.loopStackFree = memoryReport.loopStackFree;
+
+  telemetry.publish(snapshot);
+}
 
-  // Compute brake
-  analogValueBrakeRaw = analogRead(PIN_IN_ABRAKE);
-  analogValueBrake = analogValueBrakeRaw - analogValueBrakeMinCalibRaw - SECURITY_OFFSET;
-  analogValueBrake = analogValueBrake / 3;
-  if (analogValueBrake > 255)
-    analogValueBrake = 255;
-  if (analogValueBrake < 0)
-    analogValueBrake = 0;
+#if LINK_STATS
+void printTelemetryStats()
+{
+  TelemetrySnapshot snapshot;
 
-  Serial.println((String)state + " / readAnalogData // throttleRaw = " + (String)analogValueThrottleRaw + " / throttleMinCalibRaw = " + //
-                 (String)analogValueThrottleMinCalibRaw + " / throttle = " + (String)analogValueThrottle + " / brakeRaw = " +           //
-                 (String)analogValueBrakeRaw + " / brakeMinCalibRaw = " + (String)analogValueBrakeMinCalibRaw +                         //
-                 " / brake = " + (String)analogValueBrake + " / torque = " + (String)torque + " / speed = " + (String)speed);
+  uint32_t cycles = xthal_get_ccount();
+  telemetry.read(snapshot);
+  cycles = xthal_get_ccount() - cycles;
+
+  Serial.printf("telemetry : %d snapshots / %d bytes / read = %d cycles / reader retries = %d\n",
+                telemetry.publishCount(), sizeof(TelemetrySnapshot), cycles, telemetry.retryCount());
 }
+#endif
 
-// ########################## LOOP ##########################
+#if WAVEFORM
+// ########################## WAVEFORM ##########################
 
-void loop(void)
+// 'w' on the console : plays the WAVEFORM_* profile, or stops it
+void toggleWaveform()
 {
-  unsigned long timeNow = millis();
-
-  // Check for new received data
-  Receive();
+  if (waveformPlayer.isPlaying())
+  {
+    waveformPlayer.stop("console");
+    return;
+  }
 
-  // Avoid delay
-  if (expectedAnswers > 0)
+  if (analogValueBrake > 0)
   {
-#if DEBUG_SERIAL_EXPECTED_ANSWERS
-    Serial.printf("expectedAnswers = %d => return\n", expectedAnswers);
+    Serial.printf("waveform : release the brake first\n");
+    return;
+  }
+
+  WaveformProfile profile;
+  profile.shape = WAVEFORM_SHAPE;
+  profile.offset = WAVEFORM_OFFSET;
+  profile.amplitude = WAVEFORM_AMPLITUDE;
+  profile.periodMs = WAVEFORM_PERIOD;
+  profile.endPeriodMs = WAVEFORM_END_PERIOD;
+  profile.durationMs = WAVEFORM_DURATION;
+  profile.tickMs = WAVEFORM_TICK;
+  waveformPlayer.start(profile, escLinks, NB_ESC_LINKS, micros());
+}
 #endif
-    delay(DELAY_BETWEEN_STATES); // 5 // 200 Hz orders
 
-    // no reply received for a long time... restart at state 0
-    if (timeNow > timeLastReply + DELAY_SEND_ERROR)
-    {
-      Serial.printf("//!\\\\ no reply for %d ms, restart at state 0\n", DELAY_SEND_ERROR);
-      state = -2; // will be incremeted to 0 at the next loop occurence
-      expectedAnswers = 0;
-      timeLastReply = timeNow;
-    }
+// ########################## CONSOLE ##########################
 
-    // wait for next loop cycle
+void readConsole()
+{
+#if ESC_BRIDGE
+  // the host frames are for the bridge
+  if (escBridge.isActive())
     return;
-  }
-  else
+#endif
+
+  while (Serial.available())
   {
-    if (state == 14) // end os state machine
-    {
-      state = 8;
-    }
-    else if ((state > 9) && (motorStateMachineStatus != RUN)) // skip restart if motor is already spining
+    char c = Serial.read();
+
+#if LINK_CAPTURE
+    if (c == 'c')
+      linkCapture.dump("console");
+#endif
+#if TRACE_EVENTS
+    if (c == 't')
+      traceRing.dump();
+#endif
+#if MEMORY_REPORT
+    if (c == 'm')
+      memoryReport.print(millis() - timeLastStats);
+#endif
+#if WAVEFORM
+    if (c == 'w')
+      toggleWaveform();
+#endif
+#if TELEMETRY_STATS
+    if (c == 's')
     {
-      Serial.printf("//!\\\\ motor in RUN state in state>9 => error ==> restart at step 0\n");
-      state = 0;
+      for (uint8_t w = 0; w < STATS_WINDOWS; w++)
+        telemetryStats.print(w);
     }
-    else if ((state == 0) && (motorStateMachineStatus == RUN)) // skip restart if motor is already spining
+#endif
+#if RIDE_LOG
+    if (c == 'r')
     {
-      Serial.printf("//!\\\\ motor already started => go to step 8\n");
-      state = 8;
+      uint32_t timeNow = millis();
+      rideLog.requestDump(timeNow > RIDE_LOG_DUMP ? timeNow - RIDE_LOG_DUMP : 0, timeNow);
     }
-    else // next step
+#endif
+#if ESC_BRIDGE
+    if (c == 'b')
     {
-      state++;
+      escBridge.start(Serial, escLink, micros());
+      return;
     }
-#if DEBUG_SERIAL_EXPECTED_ANSWERS
-    Serial.printf("expectedAnswers = %d => next state = %d\n", expectedAnswers, state);
 #endif
   }
+}
 
-  // -------------------------------------
-  // STATE MACHINE
-  // -------------------------------------
-  if (state == -2)
-  {
-    // error state
-  }
-  else if (state == -1)
-  {
-    Serial.printf("%d / send : GET REG FRAME_REG_SPEED_MEASURED : ", state);
-    GetReg(FRAME_REG_SPEED_MEASURED);
-  }
-  else if (state == 0)
+#if LATENCY_FIRST
+// inputs moved since the last torque write : ask every running link for a torque write
+// on its next step. The inputs are sampled again just before the frame is built.
+void checkInputChange()
+{
+  sampleAnalogData();
+
+  if ((abs(analogValueThrottle - analogValueThrottleSent) < LATENCY_FIRST_THRESHOLD) &&
+      (abs(analogValueBrake - analogValueBrakeSent) < LATENCY_FIRST_THRESHOLD))
+    return;
+
+  // latency is counted from the first sample that saw the change
+  if (timeInputChangeUs == 0)
+    timeInputChangeUs = timeAnalogSampleUs;
+
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
   {
-    Serial.printf("%d / send : GET REG FRAME_REG_STATUS : ", state);
-    GetReg(FRAME_REG_STATUS);
+    if (escLinks[i]->isRunning())
+      escLinks[i]->requestTorque();
   }
-  else if (state == 1)
-  {
-    Serial.printf("%d / send : CMD STOP : ", state);
-    SendCmd(SERIAL_FRAME_CMD_STOP);
+}
+#endif
 
-    // reset values
-    analogValueThrottleRaw = 0;
-    analogValueBrakeRaw = 0;
-    torque = 0;
+#if CRUISE
+// ########################## CRUISE ##########################
 
-    delay(DELAY_CMD);
-  }
+// Throttle held within CRUISE_THROTTLE_TOLERANCE for CRUISE_ENGAGE_DELAY with every
+// motor above CRUISE_MIN_SPEED : each ESC regulates the current speed of its motor and
+// the links only poll it. The throttle may then be released. Any brake, or throttle
+// past the held position, gives the torque back to the rider in the next torque
+// write. Once the throttle was released, a tap that stays below the held position
+// (released within CRUISE_NUDGE_TIME) raises every setpoint by CRUISE_NUDGE_SPEED.
+void updateCruise(unsigned long timeNow)
+{
+#if !LATENCY_FIRST
+  // no torque write samples the inputs while cruising
+  sampleAnalogData();
+#endif
+
+  bool running = true;
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+    running = running && escLinks[i]->isRunning();
 
-  else if (state == 2)
+  if (cruising)
   {
-    Serial.printf("%d / send : GET REG FRAME_REG_FLAGS : ", state);
-    GetReg(FRAME_REG_FLAGS);
+    if ((analogValueBrake > 0) || (analogValueThrottle > cruiseThrottle + CRUISE_THROTTLE_TOLERANCE) || !running)
+    {
+      Serial.printf("cruise off / throttle = %d / brake = %d\n", analogValueThrottle, analogValueBrake);
+      cruising = false;
+      throttleSteady = analogValueThrottle;
+      timeThrottleSteady = timeNow;
+      for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+        escLinks[i]->setCruise(0);
+    }
+    else if (analogValueThrottle > 0)
+    {
+      if (cruiseReleased && (timeCruisePress == 0))
+        timeCruisePress = timeNow;
+    }
+    else
+    {
+      if ((timeCruisePress != 0) && (timeNow - timeCruisePress <= CRUISE_NUDGE_TIME))
+      {
+        Serial.printf("cruise nudge");
+        for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+        {
+          int32_t speed = escLinks[i]->getCruise() + CRUISE_NUDGE_SPEED;
+          Serial.printf(" / M%d target = %d", i, speed);
+          escLinks[i]->setCruise(speed);
+        }
+        Serial.printf("\n");
+      }
+      cruiseReleased = true;
+      timeCruisePress = 0;
+    }
+    return;
   }
 
-  else if (state == 3)
+  // the slowest motor decides
+  bool fastEnough = true;
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+    fastEnough = fastEnough && (escLinks[i]->estimateSpeed(micros()) >= CRUISE_MIN_SPEED);
+
+  if ((analogValueBrake > 0) || (analogValueThrottle == 0) || !running || !fastEnough ||
+      (abs(analogValueThrottle - throttleSteady) > CRUISE_THROTTLE_TOLERANCE))
   {
-    Serial.printf("%d / send : GET REG FRAME_REG_STATUS : ", state);
-    GetReg(FRAME_REG_STATUS);
+    throttleSteady = analogValueThrottle;
+    timeThrottleSteady = timeNow;
   }
-  else if (state == 4)
+  else if (timeNow - timeThrottleSteady >= CRUISE_ENGAGE_DELAY)
   {
-    Serial.printf("%d / send : CMD FAULT_ACK : ", state);
-    SendCmd(SERIAL_FRAME_CMD_FAULT_ACK);
+    cruising = true;
+    cruiseThrottle = analogValueThrottle;
+    cruiseReleased = false;
+    timeCruisePress = 0;
+    Serial.printf("cruise on / throttle = %d", analogValueThrottle);
+    for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+    {
+      int32_t speed = escLinks[i]->estimateSpeed(micros());
+      Serial.printf(" / M%d speed = %d", i, speed);
+      escLinks[i]->setCruise(speed);
+    }
+    Serial.printf("\n");
   }
+}
+#endif
+
+#if PROFILE_FLASH_LOAD
+// ########################## PROFILING ##########################
+
+// Keeps the flash busy from core 0 : every NVS write stops the flash cache of both
+// cores, the hot path counters then show the worst case of a flash write. Profiling
+// only, it wears the NVS sectors.
+void flashLoadTask(void *param)
+{
+  Preferences preferences;
+  preferences.begin(NVS_NAMESPACE, false);
 
-  else if (state == 5)
+  uint32_t count = 0;
+  TickType_t timeWake = xTaskGetTickCount();
+  while (true)
   {
+    preferences.putUInt("profLoad", count++);
+    vTaskDelayUntil(&timeWake, pdMS_TO_TICKS(PROFILE_FLASH_LOAD_PERIOD));
+  }
+}
+#endif
 
-    Serial.printf("%d / send : SET REG CONTROL_MODE : ", state);
-    SetRegU16(FRAME_REG_CONTROL_MODE, 0x00);
+#if POWER_MANAGEMENT
+// ########################## POWER ##########################
 
-    delay(5);
+// parked once the inputs are released and every motor is stopped, see PowerManager.h
+void updatePower(unsigned long timeNow)
+{
+  bool parked = powerManager.isParked();
 
-    Serial.printf("%d / send : REG_TORQUE_KI : ", state);
-    SetRegU16(FRAME_REG_TORQUE_KI, TORQUE_KI);
+  // the slow run cycle samples the inputs too rarely
+  if (parked)
+    sampleAnalogData();
 
-    delay(5);
+  bool idle = (analogValueThrottle == 0) && (analogValueBrake == 0);
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+    idle = idle && !escLinks[i]->isCruising() && (abs(escLinks[i]->estimateSpeed(micros())) < POWER_PARK_SPEED);
+#if WAVEFORM
+  idle = idle && !waveformPlayer.isPlaying();
+#endif
 
-    Serial.printf("%d / send : REG_TORQUE_KP : ", state);
-    SetRegU16(FRAME_REG_TORQUE_KP, TORQUE_KP);
+  powerManager.update(timeNow, idle);
 
-    delay(5);
+  if (powerManager.isParked() != parked)
+  {
+    for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+      escLinks[i]->setStepDelay(powerManager.isParked() ? POWER_PARKED_STEP_DELAY : DELAY_BETWEEN_STATES);
+  }
+}
+#endif
 
-#if TEST_DYNAMIC_FLUX
-    Serial.printf("%d / send : REG_FLUX_KI : ", state);
-    SetRegU16(FRAME_REG_FLUX_KI, FLUX_KI);
+// ########################## LOOP ##########################
 
-    delay(5);
+void loop(void)
+{
+  unsigned long timeNow = millis();
 
-    Serial.printf("%d / send : REG_FLUX_KP : ", state);
-    SetRegU16(FRAME_REG_FLUX_KP, FLUX_KP);
+#if TELEMETRY_STATS
+  uint32_t timeLoopUs = micros();
+  telemetryStats.add(STATS_LOOP_PERIOD, timeLoopUs - timeLastLoopUs);
+  timeLastLoopUs = timeLoopUs;
+#endif
 
-    delay(5);
+#if LATENCY_FIRST
+  checkInputChange();
+#endif
 
-    Serial.printf("%d / send : REG_FLUX_REF : ", state);
-    SetRegU16(FRAME_REG_FLUX_REF, STARUP_FLUX_REFERENCE);
+#if CRUISE
+  updateCruise(timeNow);
 #endif
-  }
 
-  else if (state == 6)
-  {
-    Serial.printf("%d / send : GET REG FRAME_REG_FLAGS : ", state);
-    GetReg(FRAME_REG_FLAGS);
-  }
-  else if (state == 7)
-  {
+#if POWER_MANAGEMENT
+  updatePower(timeNow);
+#endif
 
-    Serial.printf("%d / send : CMD START : ", state);
-    SendCmd(SERIAL_FRAME_CMD_START);
+#if PROFILE_HOT_PATH
+  hotPathCounters.start();
+#endif
 
-    delay(DELAY_CMD);
-  }
-  else if (state == 8)
-  {
-    Serial.printf("%d / send : GET REG FRAME_REG_FLAGS : ", state);
-    GetReg(FRAME_REG_FLAGS);
-  }
-  else if (state == 9)
+#if WAVEFORM
+  // a new tick of the profile : torque write on the next step of every link
+  if (waveformPlayer.update(micros()))
   {
-    Serial.printf("%d / send : GET REG FRAME_REG_STATUS : ", state);
-    GetReg(FRAME_REG_STATUS);
-  }
-  else if (state == 10)
-  {
-    readAnalogData(state);
-
-    // Send torque commands
-    if (analogValueBrake > 0)
+    for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
     {
-      if (speed > MIN_BRAKE_RPM)
-      {
-        torque = -analogValueBrake * BRAKE_TO_TORQUE_FACTOR;
-      }
-      else
-      {
-        torque = 0;
-      }
+      if (escLinks[i]->isRunning())
+        escLinks[i]->requestTorque();
     }
-    else if (analogValueThrottle > 0)
-    {
-#if KICK_START
-      if (speed >= MIN_KICK_START_RPM)
-      {
-        torque = THROTTLE_MINIMAL_TORQUE + (analogValueThrottle * THROTTLE_TO_TORQUE_FACTOR);
-      }
-#else
-      torque = THROTTLE_MINIMAL_TORQUE + (analogValueThrottle * THROTTLE_TO_TORQUE_FACTOR);
+  }
+  waveformPlayer.dump();
 #endif
-    }
-    else
-    {
-      torque = 0;
-    }
 
-    Serial.printf("%d / send torque = %d : SET REG FRAME_REG_TORQUE : ", state, torque);
-    SetRegS16(FRAME_REG_TORQUE, torque);
-
-#if RAMP_ENABLED
-#define RAMP 400
-    if (iLoop % RAMP < RAMP / 2)
-      torque = iLoop % RAMP;
-    else
-      torque = (RAMP / 2) - ((iLoop % RAMP) - (RAMP / 2));
+  // each link parses its own replies and runs its own session, none of them blocks
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+  {
+#if ESC_BRIDGE
+    // the host drives the first ESC
+    if ((i == 0) && escBridge.isActive())
+      continue;
 #endif
+    escLinks[i]->Receive();
+    escLinks[i]->update(timeNow);
   }
-  else if (state == 11)
-  {
 
-    Serial.printf("%d / send : GET REG FRAME_REG_FLAGS : ", state);
-    GetReg(FRAME_REG_FLAGS);
+#if ESC_BRIDGE
+  if (escBridge.isActive())
+  {
+    sampleAnalogData();
+    escBridge.update(micros(), analogValueBrake > 0);
   }
+#endif
 
-  else if (state == 12)
+#if TELEMETRY_STATS
+  uint32_t rttUs;
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
   {
-    Serial.printf("%d / send : GET REG FRAME_REG_STATUS : ", state);
-    GetReg(FRAME_REG_STATUS);
+    if (escLinks[i]->takeRtt(rttUs))
+      telemetryStats.add(STATS_RTT(i), rttUs);
   }
+#endif
 
-  else if (state == 13)
-  {
+  sendTorques(timeNow);
 
-#if TEST_DYNAMIC_FLUX
-    if (speed > 100)
-    {
-      Serial.printf("%d / send : SET REG FRAME_REG_FLUX_REF : ", state);
-      SetRegU16(FRAME_REG_FLUX_REF, 0);
-    }
+#if PROFILE_HOT_PATH
+  hotPathCounters.stop();
 #endif
-  }
-  else if (state == 14)
+
+#if MEMORY_REPORT
+  if (timeNow - timeMemorySample >= DELAY_MEMORY_SAMPLE)
   {
+    memoryReport.sample();
+    timeMemorySample = timeNow;
+  }
+#endif
+
+  publishTelemetry();
+
+#if RIDE_LOG
+  rideLog.update(timeNow);
+  rideLog.dump();
+#endif
+
+#if TELEMETRY_STATS
+  telemetryStats.update(timeNow);
+#endif
+
+  readConsole();
 
-    Serial.printf("%d / send : GET REG SPEED : ", state);
-    GetReg(FRAME_REG_SPEED_MEASURED);
+#if ESC_BRIDGE
+  // the console UART carries the bridge records
+  if (escBridge.isActive())
+    timeLastStats = timeNow;
+#endif
+
+#if LINK_STATS
+  if (timeNow - timeLastStats > DELAY_LINK_STATS)
+  {
+    for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+      escLinks[i]->printStats(timeNow);
+#if PATCHED_ESP32_FWK
+    printUartStats(0, Serial, timeNow - timeLastStats);
+#endif
+    printTelemetryStats();
+#if BLE_TELEMETRY
+    bleTelemetry.printStats(timeNow - timeLastStats);
+#endif
+#if PROFILE_HOT_PATH
+    hotPathCounters.print("hot path", timeNow - timeLastStats);
+    hotPathCounters.reset();
+#endif
+#if MEMORY_REPORT
+    memoryReport.print(timeNow - timeLastStats);
+    memoryReport.resetStats();
+#endif
+#if POWER_MANAGEMENT
+    powerManager.printStats(timeNow - timeLastStats);
+    powerManager.resetStats();
+#endif
+#if RIDE_LOG
+    rideLog.printStats(timeNow - timeLastStats);
+    rideLog.resetStats();
+#endif
+#if TELEMETRY_STATS
+    telemetryStats.print(STATS_WINDOW_10S);
+#endif
+#if WAVEFORM
+    waveformPlayer.printStats();
+#endif
+    timeLastStats = timeNow;
   }
+#endif
 
-  iLoop++;
+#if POWER_MANAGEMENT
+  uint32_t idleTime = POWER_SLEEP_MAX;
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+  {
+    uint32_t linkIdleTime = escLinks[i]->idleTime(millis());
+    if (linkIdleTime < idleTime)
+      idleTime = linkIdleTime;
+  }
+  powerManager.idle(idleTime);
+#else
+  delay(1);
+#endif
 }
 
 // ########################## SETUP ##########################
@@ -839,6 +717,9 @@ void setup()
 {
   Serial.begin(SERIAL_BAUD);
   Serial.println("SmartESC Serial v2.0");
+#if PATCHED_ESP32_FWK && TRACE_EVENTS
+  Serial.setIsrHook(traceUartIsr);
+#endif
 
   pinMode(PIN_IN_ATHROTTLE, INPUT);
   pinMode(PIN_IN_ABRAKE, INPUT);
@@ -849,9 +730,63 @@ void setup()
   analogValueBrakeMinCalibRaw = analogRead(PIN_IN_ABRAKE);
   analogValueBrakeMinCalibRaw = analogRead(PIN_IN_ABRAKE);
 
-  hwSerCntrl.begin(BAUD_RATE_SMARTESC, SERIAL_8N1, PIN_SERIAL_CNTRL_TO_ESP, PIN_SERIAL_ESP_TO_CNTRL);
-#if PATCHED_ESP32_FWK
-  hwSerCntrl.setUartIrqIdleTrigger(1);
+  escLink.begin(BAUD_RATE_SMARTESC, PIN_SERIAL_CNTRL_TO_ESP, PIN_SERIAL_ESP_TO_CNTRL);
+#if DUAL_ESC
+  escLink2.begin(BAUD_RATE_SMARTESC, PIN_SERIAL2_CNTRL_TO_ESP, PIN_SERIAL2_ESP_TO_CNTRL);
+#endif
+
+#if BAUD_NEGOTIATION
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+    escLinks[i]->negotiateBaudRate();
+#endif
+
+#if LINK_BENCH
+  // before the session starts, the motors stay stopped
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+    linkBench.run(*escLinks[i]);
+#endif
+
+#if BLE_TELEMETRY
+  bleTelemetry.begin();
+#endif
+
+#if POWER_MANAGEMENT
+  powerManager.begin();
+  powerManager.addUart(Serial);
+  for (uint8_t i = 0; i < NB_ESC_LINKS; i++)
+    powerManager.addUart(escLinks[i]->serial);
+#endif
+
+#if RIDE_LOG
+  rideLog.begin(NB_ESC_LINKS);
+#endif
+
+#if TELEMETRY_STATS
+  telemetryStats.begin(NB_ESC_LINKS, millis());
+  timeLastLoopUs = micros();
+#endif
+
+#if PROFILE_HOT_PATH
+  // counters of the loop task core
+  hotPathCounters.begin();
+#endif
+#if PROFILE_FLASH_LOAD
+  TaskHandle_t flashLoadHandle = NULL;
+  xTaskCreatePinnedToCore(flashLoadTask, "flashLoad", 2048, NULL, 1, &flashLoadHandle, 0);
+#endif
+
+#if MEMORY_REPORT
+  // setup() runs in the loop task
+  memoryReport.begin();
+#if BLE_TELEMETRY
+  memoryReport.addTask("bleTelemetry", bleTelemetry.taskHandle);
+#endif
+#if PROFILE_FLASH_LOAD
+  memoryReport.addTask("flashLoad", flashLoadHandle);
+#endif
+#if RIDE_LOG
+  memoryReport.addTask("rideLog", rideLog.taskHandle);
+#endif
 #endif
 }
 
@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+# *******************************************************************
+#  SmartESC BLE telemetry decoder
+#
+#  Decodes the notifications of the telemetry characteristic (format
+#  in src/TelemetryPacker.h) and prints one CSV line per sample.
+#  Input : one notification per line, as hex bytes ("0x" prefix,
+#  spaces, dashes and colons are ignored), e.g. a nRF Connect log.
+#
+#  usage : ble_telemetry.py notifications.txt > telemetry.csv
+#
+#  With --stats, decodes reads of the summary characteristic instead
+#  (StatsReport in src/TelemetryStats.h), one CSV line per channel.
+#
+#  usage : ble_telemetry.py --stats reads.txt > stats.csv
+# *******************************************************************
+
+import re
+import struct
+import sys
+
+FORMAT = 3
+STATS_FORMAT = 1
+STATS_WINDOWS = ["1s", "10s", "ride"]
+STATS_HEADER = struct.Struct("<BBBBIII")
+STATS_CHANNEL = struct.Struct("<I7f")
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if b < 0x80:
+            return value, pos
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def to_int32(value):
+    value &= 0xFFFFFFFF
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def field_names(links):
+    names = ["throttle", "brake"]
+    for i in range(links):
+        names += ["speed%d" % i, "torque%d" % i, "flags%d" % i, "status%d" % i, "uart_errors%d" % i,
+                  "uart_drops%d" % i]
+    names += ["heap_free", "heap_min", "heap_largest", "loop_stack_free"]
+    return names
+
+
+def decode(data):
+    if len(data) < 2 or data[0] >> 4 != FORMAT:
+        raise ValueError("unknown format")
+    links = data[0] & 0x0F
+    count = data[1]
+    nb_fields = 2 + 6 * links + 4
+
+    samples = []
+    pos = 2
+    time_ms = 0
+    fields = [0] * nb_fields
+    for _ in range(count):
+        delta, pos = read_varint(data, pos)
+        time_ms = (time_ms + delta) & 0xFFFFFFFF
+        mask, pos = read_varint(data, pos)
+        for i in range(nb_fields):
+            if mask & (1 << i):
+                delta, pos = read_varint(data, pos)
+                fields[i] = to_int32(fields[i] + unzigzag(delta))
+        samples.append([time_ms] + list(fields))
+    return links, samples
+
+
+def stats_channel_names(links):
+    names = ["loop_us", "throttle", "brake"]
+    for i in range(links):
+        names += ["speed%d" % i, "torque%d" % i, "rtt_us%d" % i]
+    return names
+
+
+def decode_stats(data):
+    fmt, window, nb_channels, links, time_ms, duration_ms, sequence = STATS_HEADER.unpack_from(data)
+    if fmt != STATS_FORMAT or window >= len(STATS_WINDOWS):
+        raise ValueError("unknown format")
+    if len(data) < STATS_HEADER.size + nb_channels * STATS_CHANNEL.size:
+        raise ValueError("short read")
+    rows = []
+    for c, name in enumerate(stats_channel_names(links)):
+        values = STATS_CHANNEL.unpack_from(data, STATS_HEADER.size + c * STATS_CHANNEL.size)
+        rows.append([STATS_WINDOWS[window], time_ms, duration_ms, sequence, name, values[0]] +
+                    ["%.2f" % v for v in values[1:]])
+    return rows
+
+
+def main():
+    stats = len(sys.argv) == 3 and sys.argv[1] == "--stats"
+    if len(sys.argv) != 2 and not stats:
+        print("usage : ble_telemetry.py [--stats] notifications.txt", file=sys.stderr)
+        return 1
+
+    header = None
+    with open(sys.argv[-1]) as f:
+        for line in f:
+            text = re.sub(r"0x|[\s:\-]", "", line.strip())
+            if not text:
+                continue
+            if stats:
+                try:
+                    rows = decode_stats(bytes.fromhex(text))
+                except (ValueError, struct.error) as e:
+                    print("skipped : %s (%s)" % (line.strip(), e), file=sys.stderr)
+                    continue
+                if header is None:
+                    header = ["window", "time_ms", "duration_ms", "sequence", "channel", "count",
+                              "mean", "stddev", "min", "max", "p50", "p95", "p99"]
+                    print(",".join(header))
+                for row in rows:
+                    print(",".join(str(v) for v in row))
+                continue
+            try:
+                links, samples = decode(bytes.fromhex(text))
+            except (ValueError, IndexError) as e:
+                print("skipped : %s (%s)" % (line.strip(), e), file=sys.stderr)
+                continue
+            if header is None:
+                header = ["time_ms"] + field_names(links)
+                print(",".join(header))
+            for sample in samples:
+                print(",".join(str(v) for v in sample))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
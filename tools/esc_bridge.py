@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+# *******************************************************************
+#  SmartESC USB bridge client
+#
+#  Drives the first ESC through the bridge mode of the firmware
+#  (ESC_BRIDGE, protocol in src/EscBridge.h) : enters the bridge with
+#  'b', keeps --depth GET REG requests in flight for --count replies,
+#  prints one CSV line per reply (ESP RX time, host time, frame), then
+#  leaves the bridge and prints its summary.
+#
+#  usage : esc_bridge.py /dev/ttyUSB0 [--reg 2] [--count 100] [--depth 1]
+#
+#  With --decode, decodes a raw capture of the bridge output instead.
+#
+#  usage : esc_bridge.py --decode capture.bin > replies.csv
+#
+#  Needs pyserial for the live mode.
+# *******************************************************************
+
+import argparse
+import sys
+import time
+
+SYNC = 0xB5
+EXIT = 0x04
+RECORD_HEADER = 5
+REG_GET = 0x02
+REPLY_STARTS = (0xF0, 0xFF)
+FRAME_MAX_SIZE = 8
+
+
+def crc(frame):
+    total = sum(frame[:-1])
+    return ((total & 0xFF) + ((total >> 8) & 0xFF)) & 0xFF
+
+
+def encode_get_reg(reg):
+    frame = bytearray([REG_GET, 1, reg, 0])
+    frame[-1] = crc(frame)
+    return bytes(frame)
+
+
+class RecordReader:
+    """Splits the bridge output in (rx_time_us, frame), skips console text."""
+
+    def __init__(self):
+        self.data = bytearray()
+        self.skipped = 0
+
+    def feed(self, data):
+        self.data += data
+        records = []
+        while True:
+            start = self.data.find(SYNC)
+            if start < 0:
+                self.skipped += len(self.data)
+                self.data.clear()
+                return records
+            self.skipped += start
+            del self.data[:start]
+
+            if len(self.data) < RECORD_HEADER + 2:
+                return records
+            frame_start = self.data[RECORD_HEADER]
+            size = self.data[RECORD_HEADER + 1] + 3
+            if frame_start not in REPLY_STARTS or size > FRAME_MAX_SIZE:
+                self.skipped += 1
+                del self.data[:1]
+                continue
+            if len(self.data) < RECORD_HEADER + size:
+                return records
+
+            frame = bytes(self.data[RECORD_HEADER:RECORD_HEADER + size])
+            if crc(frame) != frame[-1]:
+                self.skipped += 1
+                del self.data[:1]
+                continue
+            rx_time = int.from_bytes(self.data[1:RECORD_HEADER], "little")
+            records.append((rx_time, frame))
+            del self.data[:RECORD_HEADER + size]
+
+
+def decode(path):
+    reader = RecordReader()
+    with open(path, "rb") as f:
+        records = reader.feed(f.read())
+    print("rx_time_us,frame")
+    for rx_time, frame in records:
+        print("%d,%s" % (rx_time, frame.hex()))
+    print("%d records / %d bytes skipped" % (len(records), reader.skipped), file=sys.stderr)
+
+
+def run(port, reg, count, depth):
+    import serial
+
+    link = serial.Serial(port, 921600, timeout=0.01)
+    link.reset_input_buffer()
+    link.write(b"b")
+
+    # the firmware prints one line before the records
+    deadline = time.monotonic() + 1.0
+    banner = b""
+    while b"bridge :" not in banner:
+        if time.monotonic() > deadline:
+            sys.exit("no bridge banner, is ESC_BRIDGE enabled ?")
+        banner += link.read(256)
+    banner = banner[banner.index(b"bridge :"):]
+    line_end = banner.find(b"\n")
+    while line_end < 0:
+        banner += link.read(256)
+        line_end = banner.find(b"\n")
+    print(banner[:line_end].decode(errors="replace").strip(), file=sys.stderr)
+
+    reader = RecordReader()
+    reader.feed(banner[line_end + 1:])
+    request = encode_get_reg(reg)
+    sent = []
+    received = 0
+    print("rx_time_us,host_rtt_us,frame")
+    while received < count:
+        while len(sent) < depth and received + len(sent) < count:
+            link.write(request)
+            sent.append(time.monotonic())
+        records = reader.feed(link.read(link.in_waiting or 1))
+        now = time.monotonic()
+        for rx_time, frame in records:
+            print("%d,%d,%s" % (rx_time, (now - sent.pop(0)) * 1e6 if sent else 0, frame.hex()))
+            received += 1
+        # lost replies : the bridge drops them after its reply timeout
+        if sent and now - sent[0] > 0.1:
+            sent.clear()
+            print("timeout", file=sys.stderr)
+
+    link.write(bytes([EXIT]))
+    time.sleep(0.1)
+    summary = link.read(4096).decode(errors="replace")
+    for line in summary.splitlines():
+        if line.startswith("bridge :"):
+            print(line, file=sys.stderr)
+    link.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="SmartESC USB bridge client")
+    parser.add_argument("port", nargs="?")
+    parser.add_argument("--reg", type=int, default=2, help="register to read (default 2, status)")
+    parser.add_argument("--count", type=int, default=100)
+    parser.add_argument("--depth", type=int, default=1, help="requests in flight")
+    parser.add_argument("--decode", metavar="FILE", help="decode a raw capture of the bridge output")
+    args = parser.parse_args()
+
+    if args.decode:
+        decode(args.decode)
+    elif args.port:
+        run(args.port, args.reg, args.count, args.depth)
+    else:
+        parser.error("port or --decode needed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,71 @@
+// *******************************************************************
+//  SmartESC flux map check
+//
+//  Builds src/FluxMap.cpp with FLUX_MAP_TORQUE_SCALE forced to 1 and
+//  checks the table end values of FLUX_MAP_POINTS : at zero torque
+//  they are scaled to FLUX_MAP_TORQUE_MIN %, at full torque (and past
+//  it, both signs) they are the map value. Also checks that no speed
+//  / torque pair gives a flux of the other sign than the map. Exits
+//  with 1 on the first mismatch.
+//
+//  build (from the repository root) :
+//    g++ -std=gnu++11 -O2 -fsanitize=undefined -Itools/link_replay -Isrc -o flux_map_check tools/flux_map/check.cpp
+// *******************************************************************
+
+#include <stdio.h>
+#include "config.h"
+
+#undef FLUX_MAP_TORQUE_SCALE
+#define FLUX_MAP_TORQUE_SCALE 1
+#include "FluxMap.cpp"
+
+// the shim of tools/link_replay declares the virtual clock
+uint64_t hostTimeUs = 0;
+
+static uint32_t failures = 0;
+
+static void expect(int32_t speed, int16_t torque, int32_t expected)
+{
+  int16_t flux = FluxMap::lookup(speed, torque);
+  if (flux != expected)
+  {
+    printf("speed %d / torque %d : flux %d, expected %d\n", speed, torque, flux, expected);
+    failures++;
+  }
+}
+
+int main()
+{
+  const FluxMapPoint &first = fluxMapPoints[0];
+  const FluxMapPoint &last = fluxMapPoints[FLUX_MAP_NB_POINTS - 1];
+  const int16_t torques[] = {FLUX_MAP_FULL_TORQUE, -FLUX_MAP_FULL_TORQUE, 32767, -32767};
+
+  // end values of the table, below the first and above the last speed too
+  const int32_t speeds[][2] = {{first.speed, first.flux}, {first.speed / 2, first.flux},
+                               {last.speed, last.flux}, {last.speed * 2, last.flux}, {-last.speed, last.flux}};
+  for (uint8_t s = 0; s < sizeof(speeds) / sizeof(speeds[0]); s++)
+  {
+    expect(speeds[s][0], 0, speeds[s][1] * FLUX_MAP_TORQUE_MIN / 100);
+    for (uint8_t t = 0; t < sizeof(torques) / sizeof(torques[0]); t++)
+      expect(speeds[s][0], torques[t], speeds[s][1]);
+  }
+
+  // sign of the map kept over the whole speed / torque range
+  for (int32_t speed = 0; speed <= last.speed + 100; speed += 10)
+  {
+    int16_t mapFlux = FluxMap::lookup(speed, FLUX_MAP_FULL_TORQUE);
+    for (int32_t torque = -32767; torque <= 32767; torque += 97)
+    {
+      int16_t flux = FluxMap::lookup(speed, torque);
+      if (((mapFlux <= 0) && (flux > 0)) || ((mapFlux >= 0) && (flux < 0)))
+      {
+        printf("speed %d / torque %d : flux %d, map %d\n", speed, torque, flux, mapFlux);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  printf("flux map : %u failures\n", failures);
+  return failures ? 1 : 0;
+}
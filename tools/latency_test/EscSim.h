@@ -0,0 +1,115 @@
+// *******************************************************************
+//  Host SmartESC responder
+//
+//  Answers the frames EscLink writes to a host HardwareSerial (see
+//  tools/link_replay/Arduino.h) like the SmartESC : CMD START / STOP
+//  drive the motor state, SET REG TORQUE is kept, GET REG returns the
+//  status, the speed (torque / 5) or 0. A reply is injected after the
+//  request and reply wire times at the link rate plus replyDelayUs.
+//  Records the time each torque frame is completely on the wire.
+// *******************************************************************
+
+#ifndef ESC_SIM_H_
+#define ESC_SIM_H_
+
+#include <deque>
+#include <utility>
+#include <vector>
+#include "Arduino.h"
+#include "SmartEscProtocol.h"
+#include "EscRegisters.h"
+
+class EscSim
+{
+public:
+  EscSim(HardwareSerial &serial) : serial(serial) {}
+
+  // parses the frames written since the last call, injects the replies due
+  void update()
+  {
+    std::vector<uint8_t> &tx = serial.tx;
+    while ((tx.size() >= 2) && (tx.size() >= (size_t)tx[1] + 3))
+    {
+      std::vector<uint8_t> frame(tx.begin(), tx.begin() + tx[1] + 3);
+      tx.erase(tx.begin(), tx.begin() + frame.size());
+      timeWireEndUs = (timeWireEndUs > hostTimeUs ? timeWireEndUs : hostTimeUs) + wireUs(frame.size());
+      answer(frame);
+    }
+
+    while (!pending.empty() && (pending.front().first <= hostTimeUs))
+    {
+      serial.inject(pending.front().second.data(), pending.front().second.size());
+      pending.pop_front();
+    }
+  }
+
+  uint32_t replyDelayUs = 300; // ESC processing time
+  uint8_t status = IDLE;
+  int16_t torque = 0;
+
+  uint32_t torqueWrites = 0;
+  uint64_t torqueWireEndUs = 0; // last torque frame
+  uint32_t badFrames = 0;
+
+private:
+  uint32_t wireUs(size_t bytes) const { return bytes * 10 * 1000000ULL / serial.baudRate; }
+
+  void reply(const std::vector<uint8_t> &data)
+  {
+    std::vector<uint8_t> frame;
+    frame.push_back(SERIAL_START_FRAME_ESC_TO_DISPLAY_OK);
+    frame.push_back(data.size());
+    frame.insert(frame.end(), data.begin(), data.end());
+    frame.push_back(0);
+    frame.back() = getCrc(frame.data(), frame.size());
+    pending.push_back(std::make_pair(timeWireEndUs + replyDelayUs + wireUs(frame.size()), frame));
+  }
+
+  void answer(std::vector<uint8_t> &frame)
+  {
+    if (getCrc(frame.data(), frame.size()) != frame.back())
+    {
+      badFrames++;
+      return;
+    }
+
+    if (frame[0] == SERIAL_START_FRAME_DISPLAY_TO_ESC_CMD)
+    {
+      if ((frame[2] == SERIAL_FRAME_CMD_START) && (status == IDLE))
+        status = RUN;
+      else if (frame[2] == SERIAL_FRAME_CMD_STOP)
+        status = IDLE;
+      reply(std::vector<uint8_t>());
+      return;
+    }
+
+    if (frame[0] == SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET)
+    {
+      if (frame[2] == FRAME_REG_TORQUE)
+      {
+        torque = (int16_t)(frame[3] | (frame[4] << 8));
+        torqueWrites++;
+        torqueWireEndUs = timeWireEndUs;
+      }
+      reply(std::vector<uint8_t>());
+      return;
+    }
+
+    const EscRegister *reg = escRegisterFind(frame[2]);
+    int32_t value = 0;
+    if (frame[2] == FRAME_REG_STATUS)
+      value = status;
+    else if (frame[2] == FRAME_REG_SPEED_MEASURED)
+      value = torque / 5;
+    std::vector<uint8_t> data;
+    for (uint8_t i = 0; i < (reg ? reg->width : 1); i++)
+      data.push_back((value >> (8 * i)) & 0xff);
+    reply(data);
+  }
+
+  HardwareSerial &serial;
+  uint64_t timeWireEndUs = 0; // end of the last display frame on the wire
+  std::deque<std::pair<uint64_t, std::vector<uint8_t> > > pending;
+};
+
+#endif
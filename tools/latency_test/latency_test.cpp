@@ -0,0 +1,210 @@
+// *******************************************************************
+//  SmartESC input latency test
+//
+//  Runs src/EscLink.cpp on the host shim of tools/link_replay against
+//  a simulated ESC (EscSim.h) with the LATENCY_FIRST scheduling of
+//  main.cpp : every 1 ms loop pass samples a scripted throttle, a
+//  change of LATENCY_FIRST_THRESHOLD or more requests a torque write,
+//  which preempts the diagnostic polls of the run cycle.
+//
+//  The script holds, steps and ramps the throttle at times that do
+//  not line up with the run cycle. Latency is measured from the first
+//  sample that saw a change to the end of the next torque frame on the
+//  wire, as the ESC sees it. Exits with 1 if any exceeds the bound.
+//
+//  Torque writes keep the order spacing between them : a change right
+//  after a write waits DELAY_BETWEEN_STATES, then the reply of the poll
+//  in flight. The default bound adds a poll round trip and a loop pass
+//  to the spacing, the run cycle alone (-n) is several steps over it.
+//
+//  build (from the repository root) :
+//    g++ -std=gnu++11 -O2 -Itools/link_replay -Isrc -o latency_test tools/latency_test/latency_test.cpp src/EscLink.cpp src/LinkCapture.cpp src/TraceRing.cpp src/LatencyHistogram.cpp src/EscRegisters.cpp src/SpeedEstimator.cpp src/FluxMap.cpp
+//
+//  usage :
+//    latency_test [-b bound] [-t seconds] [-d reply delay] [-n]
+//      -b N   latency bound [us] (default DELAY_BETWEEN_STATES + 2.5 ms)
+//      -t N   scripted run time [s] (default 20)
+//      -d N   ESC processing time [us] (default 300)
+//      -n     no preemption, the torque write waits for its step of the run cycle
+// *******************************************************************
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "EscLink.h"
+#include "EscSim.h"
+
+#define LATENCY_TEST_TICK_US 1000    // firmware loop period (delay(1) in loop())
+#define LATENCY_TEST_BOOT_US 5000000 // [us] start sequence timeout
+#define LATENCY_TEST_MARGIN_US 2500  // [us] poll round trip at 115200 bauds and one loop pass
+
+uint64_t hostTimeUs = 0;
+HardwareSerial Serial(0);
+
+uint32_t xthal_get_ccount()
+{
+  std::chrono::nanoseconds ns = std::chrono::steady_clock::now().time_since_epoch();
+  return (uint32_t)(ns.count() * 240 / 1000);
+}
+
+// throttle of the script at t [us] after the start of the run cycle : holds,
+// steps and 1 ms ramps, segment lengths drawn so they drift over the run cycle
+class ThrottleScript
+{
+public:
+  ThrottleScript() : rng(12345) { next(0); }
+
+  int16_t value(uint64_t t)
+  {
+    while (t >= segmentEndUs)
+      next(segmentEndUs);
+
+    if (!ramp)
+      return target;
+    int32_t value = from + (int32_t)((t - segmentStartUs) / 1000) * (target > from ? 1 : -1);
+    return (int16_t)(target > from ? std::min<int32_t>(value, target) : std::max<int32_t>(value, target));
+  }
+
+private:
+  void next(uint64_t t)
+  {
+    from = target;
+    target = std::uniform_int_distribution<int>(0, 255)(rng);
+    ramp = std::uniform_int_distribution<int>(0, 2)(rng) == 0;
+    segmentStartUs = t;
+    segmentEndUs = t + std::uniform_int_distribution<int>(3000, 97000)(rng);
+  }
+
+  std::mt19937 rng;
+  int16_t from = 0;
+  int16_t target = 0;
+  bool ramp = false;
+  uint64_t segmentStartUs = 0;
+  uint64_t segmentEndUs = 0;
+};
+
+int main(int argc, char **argv)
+{
+  uint32_t boundUs = DELAY_BETWEEN_STATES * 1000 + LATENCY_TEST_MARGIN_US;
+  uint32_t seconds = 20;
+  uint32_t replyDelayUs = 300;
+  bool preempt = true;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-b") == 0) && (i + 1 < argc))
+      boundUs = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc))
+      seconds = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-d") == 0) && (i + 1 < argc))
+      replyDelayUs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-n") == 0)
+      preempt = false;
+    else
+    {
+      fprintf(stderr, "usage : %s [-b bound] [-t seconds] [-d reply delay] [-n]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  Serial.console = true;
+  Serial.quiet = true;
+
+  HardwareSerial escSerial(1);
+  EscLink link(0, escSerial);
+  link.begin(BAUD_RATE_SMARTESC, -1, -1);
+  EscSim esc(escSerial);
+  esc.replyDelayUs = replyDelayUs;
+
+  ThrottleScript script;
+  uint64_t timeScriptUs = 0;
+  int16_t throttleSent = 0;
+  uint64_t timeChangeUs = 0; // first sample that saw a change, 0 if none pending
+  uint64_t timeChangeWrittenUs = 0;
+  uint32_t torqueWrites = 0;
+
+  std::vector<uint32_t> latencies;
+  uint32_t overBound = 0;
+  uint32_t worstUs = 0;
+  uint64_t worstAtUs = 0;
+
+  for (hostTimeUs = LATENCY_TEST_TICK_US;; hostTimeUs += LATENCY_TEST_TICK_US)
+  {
+    esc.update();
+
+    if (timeScriptUs == 0)
+    {
+      if (link.isRunning())
+        timeScriptUs = hostTimeUs;
+      else if (hostTimeUs > LATENCY_TEST_BOOT_US)
+      {
+        fprintf(stderr, "the link never reached the run cycle\n");
+        return 1;
+      }
+    }
+    else if (hostTimeUs - timeScriptUs >= (uint64_t)seconds * 1000000)
+      break;
+
+    // checkInputChange() of main.cpp
+    int16_t throttle = timeScriptUs ? script.value(hostTimeUs - timeScriptUs) : 0;
+    if (abs(throttle - throttleSent) >= LATENCY_FIRST_THRESHOLD)
+    {
+      if (timeChangeUs == 0)
+        timeChangeUs = hostTimeUs;
+      if (preempt && link.isRunning())
+        link.requestTorque();
+    }
+
+    link.Receive();
+    link.update(millis());
+
+    // sendTorque() of main.cpp, the inputs sampled again
+    if (link.isTorquePending())
+    {
+      link.sendTorque(throttle * 10, (uint32_t)(timeChangeUs ? timeChangeUs : hostTimeUs));
+      throttleSent = throttle;
+      timeChangeWrittenUs = timeChangeUs;
+      timeChangeUs = 0;
+    }
+
+    esc.update();
+
+    // a change reached the ESC
+    if (esc.torqueWrites != torqueWrites)
+    {
+      torqueWrites = esc.torqueWrites;
+      if (timeChangeWrittenUs != 0)
+      {
+        uint32_t latencyUs = (uint32_t)(esc.torqueWireEndUs - timeChangeWrittenUs);
+        latencies.push_back(latencyUs);
+        if (latencyUs > boundUs)
+          overBound++;
+        if (latencyUs > worstUs)
+        {
+          worstUs = latencyUs;
+          worstAtUs = timeChangeWrittenUs - timeScriptUs;
+        }
+        timeChangeWrittenUs = 0;
+      }
+    }
+  }
+
+  if (latencies.empty() || esc.badFrames)
+  {
+    fprintf(stderr, "%u changes measured / %u bad frames\n", (unsigned)latencies.size(), esc.badFrames);
+    return 1;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  size_t n = latencies.size();
+  printf("%s / %u torque writes / %u changes : p50 %u / p95 %u / p99 %u / max %u us (at %.3f s) / bound %u us / %u over\n",
+         preempt ? "latency first" : "run cycle only", torqueWrites, (unsigned)n, latencies[n / 2], latencies[n * 95 / 100],
+         latencies[n * 99 / 100], latencies.back(), worstAtUs / 1e6, boundUs, overBound);
+
+  return overBound ? 1 : 0;
+}
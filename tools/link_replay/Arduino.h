@@ -0,0 +1,138 @@
+// *******************************************************************
+//  Host shim of the Arduino core used by the firmware sources
+//
+//  Just enough to build src/EscLink.cpp and src/LinkCapture.cpp on a
+//  PC : a virtual clock, a console on stdout and a HardwareSerial
+//  backed by byte queues.
+// *******************************************************************
+
+#ifndef HOST_ARDUINO_H_
+#define HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <deque>
+#include <vector>
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define SERIAL_8N1 0x800001c
+#define INPUT 0x01
+#define OUTPUT 0x02
+
+typedef uint8_t byte;
+
+// virtual time, advanced by the host program and by delay()
+extern uint64_t hostTimeUs;
+
+inline unsigned long micros() { return (unsigned long)hostTimeUs; }
+inline unsigned long millis() { return (unsigned long)(hostTimeUs / 1000); }
+inline void delay(uint32_t ms) { hostTimeUs += (uint64_t)ms * 1000; }
+inline void delayMicroseconds(uint32_t us) { hostTimeUs += us; }
+inline uint32_t getCpuFrequencyMhz() { return 240; }
+uint32_t xthal_get_ccount(); // host clock scaled to 240 MHz cycles
+
+// single threaded host : critical sections are no-ops
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL(mux)
+#define portENTER_CRITICAL_ISR(mux)
+#define portEXIT_CRITICAL_ISR(mux)
+
+typedef struct {
+    uint32_t isr_count;
+    uint32_t isr_cycles;
+    uint32_t isr_cycles_max;
+    uint32_t rx_time_us;
+    uint32_t rx_bytes;
+    uint32_t tx_bytes;
+    uint32_t frame_errors;
+    uint32_t parity_errors;
+    uint32_t fifo_overflows;
+    uint32_t queue_drops;
+} uart_stats_t;
+
+typedef void (*uart_isr_hook_t)(uint8_t uart_nr);
+
+class HardwareSerial
+{
+public:
+    HardwareSerial(int uart_nr) : uartNr(uart_nr), console(false), quiet(false) { memset(&uartStats, 0, sizeof(uartStats)); }
+
+    void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1) { baudRate = baud; }
+    void updateBaudRate(unsigned long baud) { baudRate = baud; }
+    int available() { return (int)rx.size(); }
+    int read()
+    {
+        if (rx.empty())
+            return -1;
+        uint8_t c = rx.front();
+        rx.pop_front();
+        return c;
+    }
+    int peek() { return rx.empty() ? -1 : rx.front(); }
+    void flush() {}
+    size_t write(uint8_t c) { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        if (console)
+        {
+            if (!quiet)
+                fwrite(buffer, 1, size, stdout);
+        }
+        else
+        {
+            tx.insert(tx.end(), buffer, buffer + size);
+        }
+        uartStats.tx_bytes += size;
+        return size;
+    }
+
+    size_t printf(const char *format, ...)
+    {
+        if (quiet)
+            return 0;
+        va_list arg;
+        va_start(arg, format);
+        int len = vprintf(format, arg);
+        va_end(arg);
+        return len;
+    }
+    size_t print(const char *s) { return printf("%s", s); }
+    size_t println(const char *s = "") { return printf("%s\n", s); }
+
+    void setUartIrqIdleTrigger(uint8_t) {}
+    void setRxTimeout(uint8_t) {}
+    void setRxFifoFull(uint8_t) {}
+    void setRxExpectedLength(uint8_t) {}
+    void setInterruptCore(int8_t) {}
+    void setIsrHook(uart_isr_hook_t) {}
+    uart_stats_t stats() { return uartStats; }
+    void resetStats() { memset(&uartStats, 0, sizeof(uartStats)); }
+
+    // host side : bytes the ESC sent, bytes the firmware wrote
+    void inject(const uint8_t *data, size_t size)
+    {
+        rx.insert(rx.end(), data, data + size);
+        uartStats.rx_bytes += size;
+        uartStats.rx_time_us = micros();
+        uartStats.isr_count++;
+    }
+
+    int uartNr;
+    bool console;
+    bool quiet;
+    unsigned long baudRate = 0;
+    std::deque<uint8_t> rx;
+    std::vector<uint8_t> tx;
+    uart_stats_t uartStats;
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,20 @@
+// *******************************************************************
+//  Host shim of the Arduino Preferences (NVS) library, nothing persists
+// *******************************************************************
+
+#ifndef HOST_PREFERENCES_H_
+#define HOST_PREFERENCES_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Preferences
+{
+public:
+    bool begin(const char *name, bool readOnly = false) { return true; }
+    void end() {}
+    uint32_t getUInt(const char *key, uint32_t defaultValue = 0) { return defaultValue; }
+    size_t putUInt(const char *key, uint32_t value) { return 4; }
+};
+
+#endif
@@ -0,0 +1,81 @@
+// *******************************************************************
+//  SmartESC link capture generator
+//
+//  Runs src/EscLink.cpp against the simulated ESC of
+//  tools/latency_test/EscSim.h (replies after their wire times and a
+//  processing delay) with a torque ramp, then prints the capture ring
+//  like the 'c' console command. A short run keeps the boot in the
+//  ring, a longer one only the end of the run cycle : a mid session
+//  capture, timestamped seconds after boot like a fault dump.
+//
+//  build (from the repository root) :
+//    g++ -std=gnu++11 -O2 -Itools/link_replay -Itools/latency_test -Isrc -o link_gen tools/link_replay/gen.cpp src/EscLink.cpp src/LinkCapture.cpp src/TraceRing.cpp src/LatencyHistogram.cpp src/EscRegisters.cpp src/SpeedEstimator.cpp src/FluxMap.cpp
+//
+//  usage :
+//    link_gen [-t seconds] [-d reply delay] > capture.txt
+//      -t N   run time [s] (default 30)
+//      -d N   ESC processing time [us] (default 300)
+// *******************************************************************
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Arduino.h"
+#include "EscLink.h"
+#include "LinkCapture.h"
+#include "EscSim.h"
+
+#define GEN_TICK_US 1000 // firmware loop period (delay(1) in loop())
+
+uint64_t hostTimeUs = 0;
+HardwareSerial Serial(0);
+
+uint32_t xthal_get_ccount()
+{
+  std::chrono::nanoseconds ns = std::chrono::steady_clock::now().time_since_epoch();
+  return (uint32_t)(ns.count() * 240 / 1000);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t seconds = 30;
+  uint32_t replyDelayUs = 300;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc))
+      seconds = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-d") == 0) && (i + 1 < argc))
+      replyDelayUs = atoi(argv[++i]);
+    else
+    {
+      fprintf(stderr, "usage : %s [-t seconds] [-d reply delay]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // only the capture dump on stdout
+  Serial.console = true;
+  Serial.quiet = true;
+
+  HardwareSerial escSerial(1);
+  EscLink link(0, escSerial);
+  link.begin(BAUD_RATE_SMARTESC, -1, -1);
+  EscSim esc(escSerial);
+  esc.replyDelayUs = replyDelayUs;
+
+  for (hostTimeUs = GEN_TICK_US; hostTimeUs <= (uint64_t)seconds * 1000000; hostTimeUs += GEN_TICK_US)
+  {
+    esc.update();
+    link.Receive();
+    link.update(millis());
+    if (link.isTorquePending())
+      link.sendTorque((hostTimeUs / 1000) % 500);
+    esc.update();
+  }
+
+  Serial.quiet = false;
+  linkCapture.dump("console");
+  return esc.badFrames ? 1 : 0;
+}
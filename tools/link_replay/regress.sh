@@ -0,0 +1,35 @@
+#!/bin/sh
+# *******************************************************************
+#  SmartESC link replay regression
+#
+#  Builds link_gen and link_replay, generates a boot capture (1 s run)
+#  and a mid session capture (30 s run, timestamps 26 s after boot)
+#  against the simulated ESC, and replays both. Exits with 1 if any
+#  build fails or any replay sends a frame the capture does not hold.
+#
+#  usage (from the repository root) :
+#    tools/link_replay/regress.sh [work directory]
+# *******************************************************************
+
+set -e
+
+OUT=${1:-link_replay_output}
+SOURCES="src/EscLink.cpp src/LinkCapture.cpp src/TraceRing.cpp src/LatencyHistogram.cpp src/EscRegisters.cpp src/SpeedEstimator.cpp src/FluxMap.cpp"
+
+mkdir -p "$OUT"
+g++ -std=gnu++11 -O2 -Itools/link_replay -Itools/latency_test -Isrc -o "$OUT/link_gen" tools/link_replay/gen.cpp $SOURCES
+g++ -std=gnu++11 -O2 -Itools/link_replay -Isrc -o "$OUT/link_replay" tools/link_replay/replay.cpp $SOURCES
+
+failed=0
+for run in "boot 1" "mid_session 30"; do
+  set -- $run
+  "$OUT/link_gen" -t "$2" > "$OUT/$1.txt"
+  if "$OUT/link_replay" -q "$OUT/$1.txt" 2> "$OUT/$1.log"; then
+    echo "$1 : ok"
+  else
+    echo "$1 : FAIL, see $OUT/$1.log"
+    failed=1
+  fi
+done
+
+exit $failed
@@ -0,0 +1,349 @@
+// *******************************************************************
+//  SmartESC link capture replay
+//
+//  Feeds a link capture dump (the "CAP ..." lines printed by the
+//  firmware) into the host build of EscLink : captured RX bursts are
+//  injected at their original time, the frames the state machine sends
+//  are compared with the captured TX frames.
+//
+//  A capture taken from boot (first frame CMD STOP) is replayed from
+//  state 0. Any other capture, a fault dump for instance, starts mid
+//  session : each link is resynchronised on the first run cycle that
+//  polls the speed (GET FLAGS, GET STATUS, SET TORQUE, GET FLAGS,
+//  GET STATUS, GET SPEED), with the motor seen as running, which is
+//  where a fresh link enters the run cycle. Its session restarts at
+//  that time, so the reply timeout does not count from boot. Earlier
+//  records are skipped. TX frames are compared up to the last captured
+//  one. regress.sh replays a boot and a mid session capture of gen.cpp.
+//
+//  build (from the repository root) :
+//    g++ -std=gnu++11 -O2 -Itools/link_replay -Isrc -o link_replay tools/link_replay/replay.cpp src/EscLink.cpp src/LinkCapture.cpp src/TraceRing.cpp src/LatencyHistogram.cpp src/EscRegisters.cpp src/SpeedEstimator.cpp src/FluxMap.cpp
+//
+//  usage :
+//    link_replay [-s speed] [-r repeat] [-q] capture.txt
+//      -s 0   as fast as possible (default), 1 original speed, 10 ten times faster
+//      -r N   replay N times, for benchmarks
+//      -q     hide the firmware console output
+// *******************************************************************
+
+#include <chrono>
+#include <thread>
+#include <string>
+#include "Arduino.h"
+#include "EscLink.h"
+
+#define REPLAY_TICK_US 1000 // firmware loop period (delay(1) in loop())
+#define REPLAY_MAX_LINKS 2
+
+uint64_t hostTimeUs = 0;
+HardwareSerial Serial(0);
+
+uint32_t xthal_get_ccount()
+{
+  std::chrono::nanoseconds ns = std::chrono::steady_clock::now().time_since_epoch();
+  return (uint32_t)(ns.count() * 240 / 1000);
+}
+
+struct CaptureRecord
+{
+  uint64_t timeUs;
+  uint8_t link;
+  bool rx;
+  std::vector<uint8_t> data;
+};
+
+static bool loadCapture(const char *fileName, std::vector<CaptureRecord> &records)
+{
+  FILE *f = fopen(fileName, "r");
+  if (f == NULL)
+    return false;
+
+  char line[2048];
+  uint64_t timeBase = 0;
+  uint32_t timePrev = 0;
+
+  while (fgets(line, sizeof(line), f))
+  {
+    char *p = strstr(line, "CAP ");
+    if ((p == NULL) || (strncmp(p, "CAP BEGIN", 9) == 0) || (strncmp(p, "CAP END", 7) == 0))
+      continue;
+
+    unsigned long time;
+    int link;
+    char dir;
+    int consumed;
+    if (sscanf(p, "CAP %lu %d %c%n", &time, &link, &dir, &consumed) != 3)
+      continue;
+
+    // 32 bits us timestamps wrap every 71 minutes
+    if (!records.empty() && ((uint32_t)time < timePrev))
+      timeBase += 1ULL << 32;
+    timePrev = (uint32_t)time;
+
+    CaptureRecord record;
+    record.timeUs = timeBase + (uint32_t)time;
+    record.link = (uint8_t)link;
+    record.rx = (dir == 'R');
+
+    p += consumed;
+    unsigned int b;
+    int n;
+    while (sscanf(p, "%x%n", &b, &n) == 1)
+    {
+      record.data.push_back((uint8_t)b);
+      p += n;
+    }
+
+    if (record.link < REPLAY_MAX_LINKS)
+      records.push_back(record);
+  }
+
+  fclose(f);
+  return true;
+}
+
+// start byte and register / command of a frame
+struct TxFrame
+{
+  size_t offset;
+  uint64_t timeUs;
+  uint8_t type;
+  uint8_t reg;
+};
+
+static void splitFrames(const std::vector<CaptureRecord> &records, uint8_t link, std::vector<TxFrame> &frames)
+{
+  size_t offset = 0;
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    if (records[i].rx || (records[i].link != link))
+      continue;
+
+    // one frame per record, see EscLink::sendFrame()
+    const std::vector<uint8_t> &data = records[i].data;
+    for (size_t j = 0; j + 2 < data.size(); j += data[j + 1] + 3)
+    {
+      TxFrame frame = {offset + j, records[i].timeUs, data[j], data[j + 2]};
+      frames.push_back(frame);
+    }
+    offset += data.size();
+  }
+}
+
+static bool isFrame(const std::vector<TxFrame> &frames, size_t i, uint8_t type, uint8_t reg)
+{
+  return (i < frames.size()) && (frames[i].type == type) && (frames[i].reg == reg);
+}
+
+// first frame of the replay : boot, or state 8 of a run cycle with a speed poll
+static bool findStart(const std::vector<TxFrame> &frames, size_t &start, bool &seedRun)
+{
+  if (isFrame(frames, 0, SERIAL_START_FRAME_DISPLAY_TO_ESC_CMD, SERIAL_FRAME_CMD_STOP))
+  {
+    start = 0;
+    seedRun = false;
+    return true;
+  }
+
+  for (size_t i = 0; i < frames.size(); i++)
+  {
+    if (isFrame(frames, i, SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET, FRAME_REG_FLAGS) &&
+        isFrame(frames, i + 1, SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET, FRAME_REG_STATUS) &&
+        isFrame(frames, i + 2, SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET, FRAME_REG_TORQUE) &&
+        isFrame(frames, i + 3, SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET, FRAME_REG_FLAGS) &&
+        isFrame(frames, i + 4, SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET, FRAME_REG_STATUS) &&
+        isFrame(frames, i + 5, SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_GET, FRAME_REG_SPEED_MEASURED))
+    {
+      start = i;
+      seedRun = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+// torque of the next captured FRAME_REG_TORQUE write of a link
+static int16_t nextCapturedTorque(const std::vector<uint8_t> &tx, size_t from)
+{
+  for (size_t i = from; i + 5 < tx.size(); i++)
+  {
+    if ((tx[i] == SERIAL_START_FRAME_DISPLAY_TO_ESC_REG_SET) && (tx[i + 1] == 3) && (tx[i + 2] == FRAME_REG_TORQUE))
+      return (int16_t)(tx[i + 3] | (tx[i + 4] << 8));
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  double speedFactor = 0;
+  int repeat = 1;
+  const char *fileName = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc))
+      speedFactor = atof(argv[++i]);
+    else if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc))
+      repeat = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-q") == 0)
+      Serial.quiet = true;
+    else
+      fileName = argv[i];
+  }
+  Serial.console = true;
+
+  std::vector<CaptureRecord> records;
+  if ((fileName == NULL) || !loadCapture(fileName, records) || records.empty())
+  {
+    fprintf(stderr, "usage : %s [-s speed] [-r repeat] [-q] capture.txt\n", argv[0]);
+    return 1;
+  }
+
+  // captured TX streams, reference for the replayed firmware
+  std::vector<uint8_t> capturedTx[REPLAY_MAX_LINKS];
+  uint8_t nbLinks = 1;
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    if (!records[i].rx)
+      capturedTx[records[i].link].insert(capturedTx[records[i].link].end(), records[i].data.begin(), records[i].data.end());
+    if (records[i].link + 1 > nbLinks)
+      nbLinks = records[i].link + 1;
+  }
+
+  // where each link starts, the reference is cut there
+  uint64_t linkStartUs[REPLAY_MAX_LINKS];
+  bool seedRun[REPLAY_MAX_LINKS];
+  uint64_t timeStart = UINT64_MAX;
+  for (uint8_t l = 0; l < nbLinks; l++)
+  {
+    std::vector<TxFrame> frames;
+    splitFrames(records, l, frames);
+    size_t start;
+    if (!findStart(frames, start, seedRun[l]))
+    {
+      fprintf(stderr, "M%d : no boot nor run cycle with a speed poll in the capture\n", l);
+      return 1;
+    }
+    capturedTx[l].erase(capturedTx[l].begin(), capturedTx[l].begin() + frames[start].offset);
+    linkStartUs[l] = frames[start].timeUs;
+    if (linkStartUs[l] < timeStart)
+      timeStart = linkStartUs[l];
+    fprintf(stderr, "M%d : replay from %s at %.3f ms (%u frames skipped)\n", l, seedRun[l] ? "the run cycle" : "boot",
+            (linkStartUs[l] - records.front().timeUs) / 1000.0, (unsigned)start);
+  }
+
+  uint64_t rxBytes = 0;
+  uint64_t txCompared = 0;
+  uint64_t txMismatches = 0;
+  uint64_t txAfter = 0;
+  uint64_t loops = 0;
+  uint64_t firstMismatchUs = 0;
+  uint64_t replayUs = 0;
+
+  std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+
+  for (int r = 0; r < repeat; r++)
+  {
+    HardwareSerial *serials[REPLAY_MAX_LINKS];
+    EscLink *links[REPLAY_MAX_LINKS];
+    for (uint8_t l = 0; l < nbLinks; l++)
+    {
+      serials[l] = new HardwareSerial(l + 1);
+      links[l] = new EscLink(l, *serials[l]);
+      links[l]->begin(BAUD_RATE_SMARTESC, -1, -1);
+    }
+
+    uint64_t timeEnd = records.back().timeUs + REPLAY_TICK_US;
+    size_t next = 0;
+    size_t txChecked[REPLAY_MAX_LINKS] = {0, 0};
+    hostTimeUs = timeStart;
+    std::chrono::steady_clock::time_point runStart = std::chrono::steady_clock::now();
+
+    while (hostTimeUs < timeEnd)
+    {
+      // ESC side : captured replies at their original time
+      while ((next < records.size()) && (records[next].timeUs <= hostTimeUs))
+      {
+        if (records[next].rx && (records[next].timeUs >= linkStartUs[records[next].link]))
+        {
+          serials[records[next].link]->inject(records[next].data.data(), records[next].data.size());
+          rxBytes += records[next].data.size();
+        }
+        next++;
+      }
+
+      for (uint8_t l = 0; l < nbLinks; l++)
+      {
+        if (hostTimeUs < linkStartUs[l])
+          continue;
+
+        // the clock jumped to the capture time : reply timeout and step timing from there,
+        // state 0 as after begin(), the capture holds no status poll to restart from
+        if (hostTimeUs - linkStartUs[l] < REPLAY_TICK_US)
+        {
+          links[l]->restartSession(millis());
+          links[l]->state = 0;
+          // mid session capture : state 0 goes straight to the run cycle
+          if (seedRun[l])
+            links[l]->regs.status = RUN;
+        }
+
+        links[l]->Receive();
+        links[l]->update(millis());
+        if (links[l]->isTorquePending())
+          links[l]->sendTorque(nextCapturedTorque(capturedTx[l], txChecked[l]));
+
+        // compare with the captured TX stream
+        std::vector<uint8_t> &tx = serials[l]->tx;
+        for (size_t i = 0; i < tx.size(); i++, txChecked[l]++)
+        {
+          // sent after the end of the capture, nothing to compare with
+          if (txChecked[l] >= capturedTx[l].size())
+          {
+            txAfter++;
+            continue;
+          }
+          txCompared++;
+          if (capturedTx[l][txChecked[l]] != tx[i])
+          {
+            if (txMismatches == 0)
+              firstMismatchUs = hostTimeUs - timeStart;
+            txMismatches++;
+          }
+        }
+        tx.clear();
+      }
+
+      loops++;
+      hostTimeUs += REPLAY_TICK_US;
+
+      if (speedFactor > 0)
+      {
+        std::chrono::microseconds elapsed((uint64_t)((hostTimeUs - timeStart) / speedFactor));
+        std::this_thread::sleep_until(runStart + elapsed);
+      }
+    }
+
+    replayUs += timeEnd - timeStart;
+    for (uint8_t l = 0; l < nbLinks; l++)
+    {
+      delete links[l];
+      delete serials[l];
+    }
+  }
+
+  double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wallStart).count();
+
+  fprintf(stderr, "replay : %u records / %u link(s) / %llu loops x %d\n",
+          (unsigned)records.size(), nbLinks, (unsigned long long)(loops / repeat), repeat);
+  fprintf(stderr, "   rx bytes = %llu / tx bytes compared = %llu / tx mismatches = %llu",
+          (unsigned long long)rxBytes, (unsigned long long)txCompared, (unsigned long long)txMismatches);
+  if (txMismatches)
+    fprintf(stderr, " (first at %.3f ms)", firstMismatchUs / 1000.0);
+  fprintf(stderr, " / tx bytes after the capture = %llu\n", (unsigned long long)(txAfter / repeat));
+  fprintf(stderr, "   capture time = %.1f ms / wall time = %.1f ms (x%.1f) / %.0f rx bytes/s\n",
+          replayUs / 1000.0, wallMs, wallMs > 0 ? replayUs / 1000.0 / wallMs : 0,
+          wallMs > 0 ? rxBytes * 1000.0 / wallMs : 0);
+
+  return txMismatches ? 2 : 0;
+}
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+# *******************************************************************
+#  SmartESC static memory budget
+#
+#  Sums the sections of the firmware ELF per memory (IRAM, DRAM,
+#  flash), checks them against the budgets below and lists the
+#  largest symbols of each, to size the rings and buffers. Fails when
+#  a budget is exceeded.
+#
+#  DRAM : static data and bss only, the heap gets the rest of the
+#  segment. The runtime side (heap, stacks, allocations) is the memory
+#  report of the firmware, src/MemoryReport.h.
+#
+#  Runs after each PlatformIO build (extra_scripts of platformio.ini),
+#  or by hand :
+#    mem_budget.py [-n top] .pio/build/<env>/firmware.elf
+# *******************************************************************
+
+import struct
+import subprocess
+import sys
+
+# [bytes] IRAM : 128 KB segment, DRAM : keep ~80 KB of heap for the BT stack,
+# flash : default app partition
+BUDGETS = [
+    ("IRAM", 120 * 1024, (".iram0.vectors", ".iram0.text")),
+    ("DRAM", 96 * 1024, (".dram0.data", ".dram0.bss", ".noinit")),
+    ("flash", 1280 * 1024, (".flash.text", ".flash.rodata")),
+]
+
+TOP_SYMBOLS = 8
+
+
+def read_elf(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[4] != 1:
+        raise ValueError("not a 32 bits ELF file")
+
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+    headers = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize) for i in range(shnum)]
+
+    def string(table, offset):
+        start = headers[table][4] + offset
+        return data[start:data.index(b"\0", start)].decode()
+
+    sections = [(string(shstrndx, h[0]), h[5]) for h in headers]
+
+    # (size, name, section index) of the data and function symbols
+    symbols = []
+    for h in headers:
+        if h[1] != 2:  # SHT_SYMTAB
+            continue
+        for pos in range(h[4], h[4] + h[5], 16):
+            name, _, size, info, _, shndx = struct.unpack_from("<IIIBBH", data, pos)
+            if size and (info & 0xF) in (1, 2) and shndx < len(sections):
+                symbols.append((size, string(h[6], name), shndx))
+    return sections, symbols
+
+
+def demangle(names):
+    try:
+        out = subprocess.run(["c++filt"], input="\n".join(names), stdout=subprocess.PIPE,
+                             universal_newlines=True, check=True).stdout
+        return out.splitlines()
+    except (OSError, subprocess.CalledProcessError):
+        return names
+
+
+def check(path, top=TOP_SYMBOLS):
+    sections, symbols = read_elf(path)
+    print("memory budget : %s" % path)
+
+    ok = True
+    for memory, budget, names in BUDGETS:
+        indexes = [i for i, (name, _) in enumerate(sections) if name in names]
+        used = sum(sections[i][1] for i in indexes)
+        over = used > budget
+        ok = ok and not over
+        print("   %-5s %7d / %7d bytes (%3d %%)%s" % (memory, used, budget, used * 100 // budget,
+                                                    "  OVER BUDGET" if over else ""))
+
+        largest = sorted((s for s in symbols if s[2] in indexes), reverse=True)[:top]
+        for (size, _, shndx), name in zip(largest, demangle([s[1] for s in largest])):
+            print("      %7d  %-14s %s" % (size, sections[shndx][0], name))
+    return ok
+
+
+def main():
+    args = sys.argv[1:]
+    top = TOP_SYMBOLS
+    if len(args) == 3 and args[0] == "-n":
+        top = int(args[1])
+        args = args[2:]
+    if len(args) != 1:
+        print("usage : mem_budget.py [-n top] firmware.elf", file=sys.stderr)
+        return 1
+    return 0 if check(args[0], top) else 2
+
+
+try:
+    # PlatformIO extra script
+    Import("env")  # noqa: F821
+
+    def post_build(source, target, env):
+        return 0 if check(str(target[0])) else 2
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", post_build)  # noqa: F821
+except NameError:
+    if __name__ == "__main__":
+        sys.exit(main())
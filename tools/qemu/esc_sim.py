@@ -0,0 +1,266 @@
+#!/usr/bin/env python3
+# *******************************************************************
+#  SmartESC simulator
+#
+#  Software ESC for the QEMU harness (run.py) : answers the display
+#  frames of the firmware on a byte stream (the emulated UART1) like
+#  the SmartESC does. Register map and frame format as in
+#  src/EscRegisters.h and src/SmartEscProtocol.h :
+#
+#    display -> ESC : start (1 SET, 2 GET, 3 CMD), size, datas, checksum
+#    ESC -> display : 0xF0 (ok) or 0xFF (error), size, datas, checksum
+#
+#  The motor state machine follows the MCSDK one : CMD START goes
+#  through START to RUN, CMD STOP back to IDLE, FAULT_ACK clears
+#  FAULT_OVER. The speed follows the torque reference through a first
+#  order model. Faults, lost and corrupted replies are injected by the
+#  scenarios.
+#
+#  The emulated UART has no baud rate, so every reply is held for its
+#  wire time at the simulated rate plus the ESC processing time.
+#
+#  usage (standalone, waits for QEMU on the port) :
+#    esc_sim.py [--port 5556] [--baud 115200] [--latency 300]
+# *******************************************************************
+
+import argparse
+import socket
+import sys
+import threading
+import time
+
+REG_SET = 0x01
+REG_GET = 0x02
+CMD = 0x03
+REPLY_OK = 0xF0
+REPLY_ERR = 0xFF
+
+CMD_START = 0x01
+CMD_STOP = 0x02
+CMD_FAULT_ACK = 0x07
+
+REG_FLAGS = 0x01
+REG_STATUS = 0x02
+REG_TORQUE = 0x08
+REG_SPEED_MEASURED = 0x1E
+
+# id : (width, signed), see ESC_REGISTERS in src/EscRegisters.h
+REGISTERS = {
+    0x00: (1, False),
+    0x01: (4, False),
+    0x02: (1, False),
+    0x03: (2, False),
+    0x04: (4, True),
+    0x08: (2, True),
+    0x09: (2, False),
+    0x0A: (2, False),
+    0x0C: (2, True),
+    0x0D: (2, False),
+    0x0E: (2, False),
+    0x1E: (4, True),
+    91: (4, True),
+}
+
+# motor states, see MCI_State_t in src/SmartEscProtocol.h
+IDLE = 0
+START = 4
+RUN = 6
+FAULT_NOW = 10
+FAULT_OVER = 11
+
+START_TIME = 0.05      # [s] START to RUN
+SPEED_PER_TORQUE = 0.2  # [rpm] steady speed per torque unit
+SPEED_TAU = 0.5         # [s] speed time constant
+
+
+def crc(frame):
+    total = sum(frame[:-1])
+    return ((total & 0xFF) + ((total >> 8) & 0xFF)) & 0xFF
+
+
+def encode_reply(start, data=b""):
+    frame = bytearray([start, len(data)]) + bytearray(data) + b"\x00"
+    frame[-1] = crc(frame)
+    return bytes(frame)
+
+
+class EscSimulator:
+    def __init__(self, baud=115200, latency_us=300):
+        self.baud = baud
+        self.latency_us = latency_us
+        self.lock = threading.Lock()
+        self.regs = {reg: 0 for reg in REGISTERS}
+        self.status = IDLE
+        self.time_start = 0.0
+        self.time_speed = time.monotonic()
+        self.speed = 0.0
+
+        # injected by the scenarios
+        self.drop_until = 0.0
+        self.drop_count = 0
+        self.corrupt_count = 0
+
+        # counters for the checks
+        self.frames_rx = 0
+        self.frames_tx = 0
+        self.bad_frames = 0
+        self.dropped = 0
+        self.commands = []
+        self.torque_writes = 0
+
+        self.rx = bytearray()
+
+    # ---------------------------------------------------------------
+    # scenario hooks
+
+    def fault(self):
+        with self.lock:
+            self.status = FAULT_NOW
+            self.regs[REG_FLAGS] = 1 << 4  # MC_START_UP
+
+    def clear_fault(self):
+        with self.lock:
+            if self.status == FAULT_NOW:
+                self.status = FAULT_OVER
+
+    def drop(self, seconds=0.0, count=0):
+        with self.lock:
+            self.drop_until = time.monotonic() + seconds
+            self.drop_count += count
+
+    def corrupt(self, count):
+        with self.lock:
+            self.corrupt_count += count
+
+    # ---------------------------------------------------------------
+    # motor model
+
+    def _update_motor(self, now):
+        if self.status == START and now - self.time_start >= START_TIME:
+            self.status = RUN
+
+        dt = now - self.time_speed
+        self.time_speed = now
+        torque = self.regs[REG_TORQUE] if self.status == RUN else 0
+        target = torque * SPEED_PER_TORQUE
+        self.speed += (target - self.speed) * min(1.0, dt / SPEED_TAU)
+        self.regs[REG_SPEED_MEASURED] = int(self.speed)
+        self.regs[REG_STATUS] = self.status
+
+    # ---------------------------------------------------------------
+    # frames
+
+    def _answer(self, frame, now):
+        start, reg = frame[0], frame[2]
+
+        if start == CMD:
+            self.commands.append(reg)
+            if reg == CMD_START and self.status == IDLE:
+                self.status = START
+                self.time_start = now
+            elif reg == CMD_STOP and self.status not in (FAULT_NOW, FAULT_OVER):
+                self.status = IDLE
+            elif reg == CMD_FAULT_ACK and self.status == FAULT_OVER:
+                self.status = IDLE
+                self.regs[REG_FLAGS] = 0
+            return encode_reply(REPLY_OK)
+
+        if reg not in REGISTERS:
+            return encode_reply(REPLY_ERR)
+        width, signed = REGISTERS[reg]
+
+        if start == REG_SET:
+            if len(frame) != width + 4:
+                return encode_reply(REPLY_ERR)
+            self.regs[reg] = int.from_bytes(frame[3:3 + width], "little", signed=signed)
+            if reg == REG_TORQUE:
+                self.torque_writes += 1
+            return encode_reply(REPLY_OK)
+
+        self._update_motor(now)
+        value = self.regs[reg] & ((1 << (8 * width)) - 1)
+        return encode_reply(REPLY_OK, value.to_bytes(width, "little"))
+
+    def feed(self, data):
+        """Bytes from the firmware, returns the replies due, in order."""
+        replies = []
+        self.rx += data
+        with self.lock:
+            while len(self.rx) >= 2:
+                if self.rx[0] not in (REG_SET, REG_GET, CMD) or self.rx[1] == 0 or self.rx[1] > 5:
+                    self.bad_frames += 1
+                    del self.rx[:1]
+                    continue
+                size = self.rx[1] + 3
+                if len(self.rx) < size:
+                    break
+                frame = bytes(self.rx[:size])
+                del self.rx[:size]
+                if crc(frame) != frame[-1]:
+                    self.bad_frames += 1
+                    continue
+                self.frames_rx += 1
+
+                now = time.monotonic()
+                reply = self._answer(frame, now)
+                if now < self.drop_until or self.drop_count > 0:
+                    if self.drop_count > 0:
+                        self.drop_count -= 1
+                    self.dropped += 1
+                    continue
+                if self.corrupt_count > 0:
+                    self.corrupt_count -= 1
+                    reply = reply[:-1] + bytes([reply[-1] ^ 0x5A])
+                replies.append(reply)
+        return replies
+
+    def reply_delay(self, reply):
+        """[s] processing time, then the wire time at the simulated rate"""
+        return self.latency_us * 1e-6 + len(reply) * 10.0 / self.baud
+
+    def serve(self, sock, stop):
+        """Answers on a connected socket until stop is set or the peer closes."""
+        sock.settimeout(0.05)
+        while not stop.is_set():
+            try:
+                data = sock.recv(256)
+            except socket.timeout:
+                continue
+            except OSError:
+                return
+            if not data:
+                return
+            for reply in self.feed(data):
+                time.sleep(self.reply_delay(reply))
+                try:
+                    sock.sendall(reply)
+                except OSError:
+                    return
+                self.frames_tx += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description="SmartESC simulator")
+    parser.add_argument("--port", type=int, default=5556)
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--latency", type=int, default=300, help="ESC processing time [us]")
+    args = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("127.0.0.1", args.port))
+    server.listen(1)
+    print("esc_sim : waiting on port %d" % args.port, file=sys.stderr)
+    conn, _ = server.accept()
+
+    sim = EscSimulator(args.baud, args.latency)
+    try:
+        sim.serve(conn, threading.Event())
+    except KeyboardInterrupt:
+        pass
+    print("esc_sim : %d frames in / %d replies / %d bad frames" % (sim.frames_rx, sim.frames_tx, sim.bad_frames),
+          file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
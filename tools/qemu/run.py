@@ -0,0 +1,319 @@
+#!/usr/bin/env python3
+# *******************************************************************
+#  SmartESC QEMU harness
+#
+#  Boots the firmware image (env:qemu of platformio.ini, with the
+#  patched UART HAL of patch-esp) under Espressif's QEMU fork, plays
+#  the scenarios of scenarios.py and checks the throughput / latency
+#  figures of the link reports, with an emulation tolerance. Each
+#  scenario boots a fresh copy of the image :
+#
+#    UART0 -> log collector (one timestamped line per console line)
+#    UART1 <-> ESC simulator (esc_sim.py)
+#
+#  Exit code 0 when every check passes, for CI.
+#
+#  usage (from the repository root) :
+#    tools/qemu/run.py [--skip-build] [--patch-framework] [--scenario boot ...]
+#                      [--tolerance 0.3] [--icount N] [--qemu qemu-system-xtensa]
+#                      [--out qemu_output] [--json results.json]
+#
+#  Needs PlatformIO (pio), and qemu-system-xtensa from Espressif's fork
+#  (github.com/espressif/qemu) in the PATH or given with --qemu.
+#  --patch-framework copies patch-esp into the PlatformIO framework
+#  first, as described in patch-esp/README.md.
+# *******************************************************************
+
+import argparse
+import json
+import os
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from esc_sim import EscSimulator, CMD_FAULT_ACK, CMD_START  # noqa: E402
+from scenarios import SCENARIOS, TIMING_METRICS  # noqa: E402
+
+ROOT = os.path.abspath(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", ".."))
+ENV = "qemu"
+FLASH_SIZE = "4MB"
+BOOT_TIMEOUT = 30  # [s] emulated boot up to the first run cycle
+
+RUN_CYCLE = re.compile(r"^M0 run cycle")
+RESTART = re.compile(r"restart at|! ERROR !")
+LINK_REPORT = re.compile(r"^M0 link : (\d+) bauds / tx (\d+) frames/s \(\d+ B/s\) / rx (\d+) frames/s \(\d+ B/s\) / "
+                         r"rtt avg = (\d+) us / max = (\d+) us / errors = (\d+) / timeouts = (\d+)")
+RX_TRIGGER = re.compile(r"^\s+M0 rx trigger")
+ISR_REPORT = re.compile(r"^\s+UART\d isr : (\d+) irq/s / avg = \d+ cycles \((\d+) us\) / max = \d+ cycles \((\d+) us\)")
+
+
+# ########################## IMAGE ##########################
+
+def framework_dir():
+    core = os.environ.get("PLATFORMIO_CORE_DIR", os.path.join(os.path.expanduser("~"), ".platformio"))
+    return os.path.join(core, "packages", "framework-arduinoespressif32")
+
+
+def patch_framework():
+    framework = framework_dir()
+    copies = [("Uart", os.path.join(framework, "cores", "esp32")),
+              ("BLE", os.path.join(framework, "libraries", "BLE", "src"))]
+    for folder, target in copies:
+        source = os.path.join(ROOT, "patch-esp", folder)
+        for name in os.listdir(source):
+            shutil.copy(os.path.join(source, name), target)
+        print("patched %s" % target)
+
+
+def build_image(out_dir):
+    subprocess.check_call(["pio", "run", "-e", ENV], cwd=ROOT)
+
+    build = os.path.join(ROOT, ".pio", "build", ENV)
+    image = os.path.join(out_dir, "flash.bin")
+    subprocess.check_call(["pio", "pkg", "exec", "-p", "tool-esptoolpy", "--", "esptool.py", "--chip", "esp32",
+                           "merge_bin", "--fill-flash-size", FLASH_SIZE, "-o", image,
+                           "--flash_mode", "dio", "--flash_size", FLASH_SIZE,
+                           "0x1000", os.path.join(build, "bootloader.bin"),
+                           "0x8000", os.path.join(build, "partitions.bin"),
+                           "0xe000", os.path.join(framework_dir(), "tools", "partitions", "boot_app0.bin"),
+                           "0x10000", os.path.join(build, "firmware.bin")], cwd=ROOT)
+    return image
+
+
+# ########################## UARTS ##########################
+
+def listen():
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("127.0.0.1", 0))
+    server.listen(1)
+    return server
+
+
+class LogCollector:
+    """Console lines of UART0, host time of their first byte."""
+
+    def __init__(self, path):
+        self.lines = []
+        self.file = open(path, "w")
+        self.time_first = None
+        self.lock = threading.Lock()
+
+    def serve(self, sock, stop):
+        sock.settimeout(0.05)
+        pending = b""
+        time_line = None
+        while not stop.is_set():
+            try:
+                data = sock.recv(4096)
+            except socket.timeout:
+                continue
+            except OSError:
+                break
+            if not data:
+                break
+            now = time.monotonic()
+            if self.time_first is None:
+                self.time_first = now
+            if time_line is None:
+                time_line = now
+            pending += data
+            while b"\n" in pending:
+                line, pending = pending.split(b"\n", 1)
+                text = line.decode(errors="replace").rstrip("\r")
+                with self.lock:
+                    self.lines.append((time_line, text))
+                self.file.write("%10.3f %s\n" % (time_line - self.time_first, text))
+                time_line = now if pending else None
+        self.file.close()
+
+    def find(self, pattern, after=0.0):
+        with self.lock:
+            for t, line in self.lines:
+                if t >= after and pattern.search(line):
+                    return t
+        return None
+
+    def snapshot(self):
+        with self.lock:
+            return list(self.lines)
+
+
+# ########################## SCENARIO ##########################
+
+def metrics(lines, sim, time_first, time_run, time_event):
+    values = {}
+    if time_run is not None:
+        values["boot_s"] = time_run - time_first
+
+    errors = timeouts = 0
+    after_trigger = False
+    for t, line in lines:
+        match = LINK_REPORT.search(line)
+        if match:
+            values["tx_fps"] = int(match.group(2))
+            values["rx_fps"] = int(match.group(3))
+            values["rtt_avg_us"] = int(match.group(4))
+            values["rtt_max_us"] = int(match.group(5))
+            errors += int(match.group(6))
+            timeouts += int(match.group(7))
+            values["errors"] = errors
+            values["timeouts"] = timeouts
+        # the ESC UART report comes right after the rx trigger line
+        if after_trigger:
+            match = ISR_REPORT.search(line)
+            if match:
+                values["esc_irq_s"] = int(match.group(1))
+                values["esc_isr_avg_us"] = int(match.group(2))
+                values["esc_isr_max_us"] = int(match.group(3))
+        after_trigger = bool(RX_TRIGGER.search(line))
+
+    if values.get("rx_fps"):
+        if "esc_irq_s" in values:
+            values["irq_per_frame"] = values["esc_irq_s"] / float(values["rx_fps"])
+
+    # back in the run cycle after the last restart caused by the events
+    if time_event is not None:
+        restarts = [t for t, line in lines if t >= time_event and RESTART.search(line)]
+        values["restarts"] = len(restarts)
+        if restarts:
+            recovered = [t for t, line in lines if t > restarts[-1] and RUN_CYCLE.search(line)]
+            if recovered:
+                values["recovery_s"] = recovered[0] - time_event
+
+    values["sim_bad_frames"] = sim.bad_frames
+    values["sim_frames"] = sim.frames_rx
+    values["sim_dropped"] = sim.dropped
+    values["sim_torque_writes"] = sim.torque_writes
+    values["sim_starts"] = sim.commands.count(CMD_START)
+    values["sim_fault_acks"] = sim.commands.count(CMD_FAULT_ACK)
+    return values
+
+
+def check(values, checks, tolerance):
+    results = []
+    for metric, (low, high) in sorted(checks.items()):
+        value = values.get(metric)
+        if metric in TIMING_METRICS:
+            low = None if low is None else low * (1.0 - tolerance)
+            high = None if high is None else high * (1.0 + tolerance)
+        ok = (value is not None) and (low is None or value >= low) and (high is None or value <= high)
+        results.append({"metric": metric, "value": value, "min": low, "max": high, "ok": ok})
+    return results
+
+
+def run_scenario(scenario, image, args):
+    out = os.path.join(args.out, scenario["name"])
+    os.makedirs(out, exist_ok=True)
+
+    # fresh NVS for every scenario
+    flash = os.path.join(out, "flash.bin")
+    shutil.copy(image, flash)
+
+    console_server = listen()
+    esc_server = listen()
+    stop = threading.Event()
+    collector = LogCollector(os.path.join(out, "console.log"))
+    sim = EscSimulator(args.baud, args.latency)
+
+    command = [args.qemu, "-machine", "esp32", "-display", "none", "-monitor", "none",
+               "-drive", "file=%s,if=mtd,format=raw" % flash,
+               "-global", "driver=timer.esp32.timg,property=wdt_disable,value=true",
+               "-serial", "tcp:127.0.0.1:%d" % console_server.getsockname()[1],
+               "-serial", "tcp:127.0.0.1:%d" % esc_server.getsockname()[1]]
+    if args.icount is not None:
+        command += ["-icount", "shift=%d" % args.icount]
+
+    qemu = subprocess.Popen(command, stdout=open(os.path.join(out, "qemu.log"), "w"), stderr=subprocess.STDOUT)
+    threads = []
+    try:
+        console_server.settimeout(10)
+        esc_server.settimeout(10)
+        console, _ = console_server.accept()
+        esc, _ = esc_server.accept()
+        threads = [threading.Thread(target=collector.serve, args=(console, stop)),
+                   threading.Thread(target=sim.serve, args=(esc, stop))]
+        for thread in threads:
+            thread.start()
+
+        deadline = time.monotonic() + BOOT_TIMEOUT
+        time_run = None
+        while time_run is None and time.monotonic() < deadline and qemu.poll() is None:
+            time.sleep(0.05)
+            time_run = collector.find(RUN_CYCLE)
+
+        time_event = None
+        if time_run is not None:
+            for delay, action, kwargs in scenario["events"]:
+                time.sleep(max(0.0, time_run + delay - time.monotonic()))
+                getattr(sim, action)(**kwargs)
+                time_event = time.monotonic()
+            time.sleep(max(0.0, time_run + scenario["duration"] - time.monotonic()))
+    finally:
+        stop.set()
+        qemu.terminate()
+        try:
+            qemu.wait(5)
+        except subprocess.TimeoutExpired:
+            qemu.kill()
+        for thread in threads:
+            thread.join()
+        console_server.close()
+        esc_server.close()
+
+    values = metrics(collector.snapshot(), sim, collector.time_first or 0.0, time_run, time_event)
+    return values, check(values, scenario["checks"], args.tolerance)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="SmartESC QEMU harness")
+    parser.add_argument("--skip-build", action="store_true", help="use the image of the previous run")
+    parser.add_argument("--patch-framework", action="store_true", help="copy patch-esp into the framework first")
+    parser.add_argument("--scenario", nargs="*", help="scenarios to play (default all)")
+    parser.add_argument("--tolerance", type=float, default=0.3, help="emulation tolerance of the timing checks")
+    parser.add_argument("--icount", type=int, help="QEMU -icount shift, instruction counted time")
+    parser.add_argument("--qemu", default="qemu-system-xtensa")
+    parser.add_argument("--baud", type=int, default=115200, help="simulated ESC link rate")
+    parser.add_argument("--latency", type=int, default=300, help="simulated ESC processing time [us]")
+    parser.add_argument("--out", default="qemu_output")
+    parser.add_argument("--json", help="write the metrics and checks of every scenario")
+    args = parser.parse_args()
+
+    os.makedirs(args.out, exist_ok=True)
+    if args.patch_framework:
+        patch_framework()
+    image = os.path.join(args.out, "flash.bin")
+    if not args.skip_build:
+        image = build_image(args.out)
+    if not os.path.exists(image):
+        sys.exit("no image %s, build it first" % image)
+
+    scenarios = [s for s in SCENARIOS if not args.scenario or s["name"] in args.scenario]
+    report = {}
+    failed = 0
+    for scenario in scenarios:
+        print("%s : %s" % (scenario["name"], scenario["description"]))
+        values, results = run_scenario(scenario, image, args)
+        for result in results:
+            bounds = "[%s, %s]" % ("-" if result["min"] is None else "%g" % result["min"],
+                                   "-" if result["max"] is None else "%g" % result["max"])
+            value = "no data" if result["value"] is None else "%g" % result["value"]
+            print("   %-18s %10s %-20s %s" % (result["metric"], value, bounds, "ok" if result["ok"] else "FAIL"))
+            failed += 0 if result["ok"] else 1
+        report[scenario["name"]] = {"metrics": values, "checks": results}
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+
+    print("%d scenarios / %d failed checks" % (len(scenarios), failed))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
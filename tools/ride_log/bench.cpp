@@ -0,0 +1,293 @@
+// *******************************************************************
+//  SmartESC ride log benchmark
+//
+//  Encodes a synthetic ride (throttle ramps with ADC noise, speed
+//  following the torque, rare flag changes) into ride log blocks and
+//  an index like the firmware, then checks the decode round trip and
+//  time range queries through the index. Reports the encode rate and
+//  the bytes per sample against the raw struct and a fixed record.
+//
+//  With -f, decodes a ride file pulled from the SPIFFS image instead
+//  (/rNNNNN.log) and prints it as CSV.
+//
+//  build (from the repository root) :
+//    g++ -std=gnu++11 -O2 -Isrc -o ride_log_bench tools/ride_log/bench.cpp src/RideLogBlock.cpp
+//
+//  usage :
+//    ride_log_bench [-n samples] [-l links] [-p period]
+//      -n N   samples in the synthetic ride (default 360000, one hour at 10 ms)
+//      -l N   links (default 2)
+//      -p N   sample period [ms] (default 10)
+//    ride_log_bench -f r00012.log > ride.csv
+// *******************************************************************
+
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "RideLogBlock.h"
+
+// throttle, brake, then per link torque, speed, flags, state, status, no padding
+#define FIXED_RECORD_SIZE(links) (4 + 2 + 2 + (links) * (2 + 4 + 4 + 1 + 1))
+
+static uint32_t seed = 12345;
+
+static int32_t noise(int32_t amplitude)
+{
+  seed = seed * 1103515245 + 12345;
+  return (int32_t)((seed >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static void makeRide(std::vector<RideLogSample> &ride, uint32_t count, uint8_t nbLinks, uint32_t periodMs)
+{
+  int32_t speed = 0;
+  ride.resize(count);
+
+  for (uint32_t n = 0; n < count; n++)
+  {
+    RideLogSample &s = ride[n];
+    memset(&s, 0, sizeof(s));
+
+    // 40 s cycles : accelerate, cruise, brake, stop
+    uint32_t phase = (n * periodMs / 1000) % 40;
+    int32_t throttle = (phase < 10) ? 60 * (int32_t)phase : (phase < 25) ? 450 : 0;
+    int32_t brake = ((phase >= 25) && (phase < 32)) ? 300 : 0;
+
+    // control jitter on the sample time, ADC noise on the inputs
+    s.timeMs = n * periodMs + (noise(1) + 1);
+    s.throttle = throttle ? throttle + noise(3) : 0;
+    s.brake = brake ? brake + noise(3) : 0;
+
+    int32_t torque = s.throttle * 3 - s.brake * 4;
+    speed += (torque - speed / 2) / 64;
+    if (speed < 0)
+      speed = 0;
+
+    for (uint8_t i = 0; i < nbLinks; i++)
+    {
+      s.torque[i] = torque;
+      s.speed[i] = speed + noise(2);
+      s.flags[i] = (n / 5000) % 7 == 6 ? 0x40 : 0;
+      s.state[i] = 10;
+      s.status[i] = speed ? 6 : 4;
+    }
+  }
+}
+
+static bool sameSample(const RideLogSample &a, const RideLogSample &b, uint8_t nbLinks)
+{
+  if ((a.timeMs != b.timeMs) || (a.throttle != b.throttle) || (a.brake != b.brake))
+    return false;
+  for (uint8_t i = 0; i < nbLinks; i++)
+  {
+    if ((a.torque[i] != b.torque[i]) || (a.speed[i] != b.speed[i]) || (a.flags[i] != b.flags[i]) ||
+        (a.state[i] != b.state[i]) || (a.status[i] != b.status[i]))
+      return false;
+  }
+  return true;
+}
+
+static void printSample(const RideLogSample &s, uint8_t nbLinks)
+{
+  printf("%u,%d,%d", s.timeMs, s.throttle, s.brake);
+  for (uint8_t i = 0; i < nbLinks; i++)
+    printf(",%d,%d,%u,%d,%d", s.torque[i], s.speed[i], s.flags[i], s.state[i], s.status[i]);
+  printf("\n");
+}
+
+static int decodeFile(const char *fileName)
+{
+  FILE *f = fopen(fileName, "rb");
+  if (!f)
+  {
+    fprintf(stderr, "cannot open %s\n", fileName);
+    return 1;
+  }
+
+  uint8_t block[RIDE_LOG_BLOCK_SIZE];
+  RideLogDecoder decoder;
+  RideLogSample sample;
+  uint32_t blocks = 0;
+  uint32_t samples = 0;
+  bool headerDone = false;
+
+  while (fread(block, 1, RIDE_LOG_BLOCK_SIZE, f) == RIDE_LOG_BLOCK_SIZE)
+  {
+    if (!decoder.begin(block))
+    {
+      fprintf(stderr, "block %u : bad header, stopped\n", blocks);
+      break;
+    }
+    uint8_t nbLinks = decoder.header().nbLinks;
+    if (!headerDone)
+    {
+      printf("time_ms,throttle,brake");
+      for (uint8_t i = 0; i < nbLinks; i++)
+        printf(",torque%d,speed%d,flags%d,state%d,status%d", i, i, i, i, i);
+      printf("\n");
+      headerDone = true;
+    }
+    while (decoder.next(sample))
+    {
+      printSample(sample, nbLinks);
+      samples++;
+    }
+    blocks++;
+  }
+  fclose(f);
+
+  fprintf(stderr, "%s : %u blocks / %u samples\n", fileName, blocks, samples);
+  return 0;
+}
+
+// first and last sample times of the blocks in [fromMs, toMs], through the index like RideLog::dump
+static uint32_t query(const std::vector<uint8_t> &log, const std::vector<RideLogIndexEntry> &index,
+                      uint32_t fromMs, uint32_t toMs, uint32_t &blocksRead)
+{
+  uint32_t low = 0;
+  uint32_t high = index.size();
+  while (low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if (index[mid].lastTimeMs < fromMs)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  RideLogDecoder decoder;
+  RideLogSample sample;
+  uint32_t count = 0;
+  blocksRead = 0;
+  for (uint32_t b = low; (b < index.size()) && (index[b].firstTimeMs <= toMs); b++)
+  {
+    decoder.begin(&log[b * RIDE_LOG_BLOCK_SIZE]);
+    blocksRead++;
+    while (decoder.next(sample))
+    {
+      if ((sample.timeMs >= fromMs) && (sample.timeMs <= toMs))
+        count++;
+    }
+  }
+  return count;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t count = 360000;
+  uint8_t nbLinks = 2;
+  uint32_t periodMs = 10;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-f") == 0) && (i + 1 < argc))
+      return decodeFile(argv[++i]);
+    else if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc))
+      count = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-l") == 0) && (i + 1 < argc))
+      nbLinks = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-p") == 0) && (i + 1 < argc))
+      periodMs = atoi(argv[++i]);
+    else
+    {
+      fprintf(stderr, "usage : %s [-n samples] [-l links] [-p period] | -f ride.log\n", argv[0]);
+      return 1;
+    }
+  }
+  if ((nbLinks < 1) || (nbLinks > RIDE_LOG_LINKS) || (count == 0) || (periodMs == 0))
+  {
+    fprintf(stderr, "1 to %d links, at least one sample\n", RIDE_LOG_LINKS);
+    return 1;
+  }
+
+  std::vector<RideLogSample> ride;
+  makeRide(ride, count, nbLinks, periodMs);
+
+  // encode : full blocks appended to the log, one index entry each
+  std::vector<uint8_t> log;
+  std::vector<RideLogIndexEntry> index;
+  uint8_t block[RIDE_LOG_BLOCK_SIZE];
+  RideLogEncoder encoder;
+  uint32_t encodedBytes = 0;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  encoder.begin(block, 1, nbLinks);
+  for (uint32_t n = 0; n < count; n++)
+  {
+    uint16_t used = encoder.used();
+    if (!encoder.add(ride[n]))
+    {
+      log.insert(log.end(), block, block + RIDE_LOG_BLOCK_SIZE);
+      RideLogIndexEntry entry = {encoder.firstTimeMs(), encoder.lastTimeMs()};
+      index.push_back(entry);
+      encoder.begin(block, 1, nbLinks);
+      used = encoder.used();
+      encoder.add(ride[n]);
+    }
+    encodedBytes += encoder.used() - used;
+  }
+  if (encoder.count())
+  {
+    log.insert(log.end(), block, block + RIDE_LOG_BLOCK_SIZE);
+    RideLogIndexEntry entry = {encoder.firstTimeMs(), encoder.lastTimeMs()};
+    index.push_back(entry);
+  }
+  double encodeUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  // decode everything back
+  RideLogDecoder decoder;
+  RideLogSample sample;
+  uint32_t decoded = 0;
+  uint32_t mismatches = 0;
+  start = std::chrono::steady_clock::now();
+  for (uint32_t b = 0; b < index.size(); b++)
+  {
+    if (!decoder.begin(&log[b * RIDE_LOG_BLOCK_SIZE]))
+    {
+      mismatches++;
+      continue;
+    }
+    while (decoder.next(sample))
+    {
+      if ((decoded >= count) || !sameSample(sample, ride[decoded], nbLinks))
+        mismatches++;
+      decoded++;
+    }
+  }
+  double decodeUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  // range queries : the last minute, and one minute in the middle of the ride
+  uint32_t rideMs = ride[count - 1].timeMs;
+  uint32_t ranges[2][2] = {{rideMs > 60000 ? rideMs - 60000 : 0, rideMs}, {rideMs / 2, rideMs / 2 + 60000}};
+  for (uint8_t r = 0; r < 2; r++)
+  {
+    uint32_t expected = 0;
+    for (uint32_t n = 0; n < count; n++)
+    {
+      if ((ride[n].timeMs >= ranges[r][0]) && (ride[n].timeMs <= ranges[r][1]))
+        expected++;
+    }
+    uint32_t blocksRead;
+    uint32_t found = query(log, index, ranges[r][0], ranges[r][1], blocksRead);
+    printf("query %u - %u ms : %u samples (expected %u) / %u of %zu blocks read\n",
+           ranges[r][0], ranges[r][1], found, expected, blocksRead, index.size());
+    if (found != expected)
+      mismatches++;
+  }
+
+  double rawSize = (double)count * sizeof(RideLogSample);
+  double fixedSize = (double)count * FIXED_RECORD_SIZE(nbLinks);
+  printf("ride : %u samples / %u link(s) / %.1f min\n", count, nbLinks, rideMs / 60000.0);
+  printf("   encoded = %.2f bytes per sample / %.2f with block headers and padding / index = %zu bytes\n",
+         (double)encodedBytes / count, (double)log.size() / count, index.size() * sizeof(RideLogIndexEntry));
+  printf("   raw struct = %zu bytes (x%.1f) / fixed record = %d bytes (x%.1f)\n",
+         sizeof(RideLogSample), rawSize / log.size(), FIXED_RECORD_SIZE(nbLinks), fixedSize / log.size());
+  printf("   flash = %zu bytes, %.1f KB per hour at %u ms\n",
+         log.size(), log.size() / 1024.0 * 3600000.0 / (rideMs ? rideMs : 1), periodMs);
+  printf("   encode = %.0f samples/s (%.2f us per sample) / decode = %.0f samples/s\n",
+         count / encodeUs * 1e6, encodeUs / count, count / decodeUs * 1e6);
+  printf("   round trip : %u decoded / %u mismatches\n", decoded, mismatches);
+
+  return (mismatches || (decoded != count)) ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+// *******************************************************************
+//  SmartESC running statistics benchmark
+//
+//  Feeds RunningStat with synthetic distributions shaped like the
+//  telemetry channels (uniform inputs, normal speed, log-normal round
+//  trip times with rare outliers, bimodal torque) and compares with the
+//  exact values : two pass mean / stddev in double, sorted quantiles.
+//  Quantile errors are given as rank errors (percentile of the exact
+//  distribution the estimate falls on) and relative value errors.
+//  Reports the cost of one sample.
+//
+//  build (from the repository root) :
+//    g++ -std=gnu++11 -O2 -Isrc -o running_stats_bench tools/running_stats/bench.cpp src/RunningStats.cpp
+//
+//  usage :
+//    running_stats_bench [-n samples]
+//      -n N   samples per distribution (default 100000)
+// *******************************************************************
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "RunningStats.h"
+
+static const float levels[RUNNING_STATS_QUANTILES] = {0.50f, 0.95f, 0.99f};
+
+typedef float (*Generator)(std::mt19937 &rng);
+
+static float uniformInput(std::mt19937 &rng)
+{
+  return std::uniform_int_distribution<int>(0, 255)(rng);
+}
+
+static float normalSpeed(std::mt19937 &rng)
+{
+  return std::normal_distribution<float>(450.0f, 25.0f)(rng);
+}
+
+static float roundTrip(std::mt19937 &rng)
+{
+  // log-normal around 1.5 ms, 0.5 % of 20 ms timeouts
+  if (std::uniform_real_distribution<float>(0.0f, 1.0f)(rng) < 0.005f)
+    return 20000.0f;
+  return std::lognormal_distribution<float>(logf(1500.0f), 0.2f)(rng);
+}
+
+static float bimodalTorque(std::mt19937 &rng)
+{
+  if (std::uniform_real_distribution<float>(0.0f, 1.0f)(rng) < 0.3f)
+    return std::normal_distribution<float>(-300.0f, 40.0f)(rng);
+  return std::normal_distribution<float>(800.0f, 60.0f)(rng);
+}
+
+// fraction of the sorted values below x
+static float rank(const std::vector<float> &sorted, float x)
+{
+  return (float)(std::lower_bound(sorted.begin(), sorted.end(), x) - sorted.begin()) / sorted.size();
+}
+
+static bool check(const char *name, Generator generator, uint32_t count)
+{
+  std::mt19937 rng(1234);
+  std::vector<float> values(count);
+  for (uint32_t i = 0; i < count; i++)
+    values[i] = generator(rng);
+
+  RunningStat stat;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < count; i++)
+    stat.add(values[i]);
+  double addNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+
+  double sum = 0;
+  for (uint32_t i = 0; i < count; i++)
+    sum += values[i];
+  double mean = sum / count;
+  double m2 = 0;
+  for (uint32_t i = 0; i < count; i++)
+    m2 += (values[i] - mean) * (values[i] - mean);
+  double stddev = count > 1 ? sqrt(m2 / (count - 1)) : 0;
+
+  std::vector<float> sorted(values);
+  std::sort(sorted.begin(), sorted.end());
+
+  printf("%-8s n = %u / %.0f ns per sample\n", name, count, addNs);
+  printf("   mean %.3f (exact %.3f) / stddev %.3f (exact %.3f) / min %.1f max %.1f (exact %.1f %.1f)\n",
+         stat.mean(), mean, stat.stddev(), stddev, stat.min(), stat.max(), sorted.front(), sorted.back());
+
+  bool ok = (fabs(stat.mean() - mean) <= 1e-3 * (fabs(mean) + stddev)) && (fabs(stat.stddev() - stddev) <= 1e-3 * stddev + 1e-3) &&
+            (stat.min() == sorted.front()) && (stat.max() == sorted.back());
+  for (uint8_t q = 0; q < RUNNING_STATS_QUANTILES; q++)
+  {
+    float exact = sorted[(size_t)(levels[q] * (count - 1) + 0.5f)];
+    float estimate = stat.quantile(q);
+    float rankError = rank(sorted, estimate) - levels[q];
+    printf("   p%-2d %10.1f (exact %10.1f) / rank error %+.4f / value error %+.2f %%\n",
+           (int)(levels[q] * 100 + 0.5f), estimate, exact, rankError,
+           exact != 0 ? 100.0f * (estimate - exact) / fabs(exact) : 0.0f);
+    // P² is an estimate : a few percent of rank is the expected accuracy on smooth distributions
+    if ((count >= 1000) && (fabs(rankError) > 0.02f))
+      ok = false;
+  }
+  printf("   %s\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t count = 100000;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc))
+      count = atoi(argv[++i]);
+    else
+    {
+      fprintf(stderr, "usage : %s [-n samples]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (count < 2)
+  {
+    fprintf(stderr, "at least 2 samples\n");
+    return 1;
+  }
+
+  bool ok = true;
+  ok &= check("input", uniformInput, count);
+  ok &= check("speed", normalSpeed, count);
+  ok &= check("rtt", roundTrip, count);
+  ok &= check("torque", bimodalTorque, count);
+  printf("RunningStat = %zu bytes\n", sizeof(RunningStat));
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,340 @@
+// *******************************************************************
+//  SmartESC telemetry packer check
+//
+//  Packs synthetic snapshots with src/TelemetryPacker.cpp the way
+//  BleTelemetry does (add, on a full batch send, reset and add again,
+//  flush every few samples), decodes every batch on its own like
+//  tools/ble_telemetry.py and compares the samples field by field.
+//  Two runs : ramps (small deltas, long batches) and steps (field
+//  extremes, 32 bits wraps of the counters and of the time). At batch
+//  boundaries, checks that each batch stays within the payload size,
+//  decodes to its exact length from absolute values and that no
+//  sample is lost or repeated. Exits with 1 on the first mismatch.
+//
+//  build (from the repository root) :
+//    g++ -std=gnu++11 -O2 -Isrc -o telemetry_packer_check tools/telemetry_packer/check.cpp src/TelemetryPacker.cpp
+//
+//  usage :
+//    telemetry_packer_check [-n samples] [-f flush]
+//      -n N   samples per run (default 20000)
+//      -f N   samples per batch at most, flush timer (default 10, 200 ms at 20 ms)
+// *******************************************************************
+
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "TelemetryPacker.h"
+#include "Varint.h"
+
+static uint32_t seed = 12345;
+
+static int32_t noise(int32_t amplitude)
+{
+  seed = seed * 1103515245 + 12345;
+  return (int32_t)((seed >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static const char *fieldName(uint8_t field)
+{
+  static const char *linkNames[] = {"speed", "torque", "flags", "status", "uart_errors", "uart_drops"};
+  static const char *tailNames[] = {"heap_free", "heap_min", "heap_largest", "loop_stack_free"};
+  static char name[32];
+
+  if (field < 2)
+    return field ? "brake" : "throttle";
+  if (field < 2 + 6 * TELEMETRY_LINKS)
+  {
+    snprintf(name, sizeof(name), "%s%d", linkNames[(field - 2) % 6], (field - 2) / 6);
+    return name;
+  }
+  return tailNames[field - 2 - 6 * TELEMETRY_LINKS];
+}
+
+// field order of the packer
+static void getFields(const TelemetrySnapshot &s, int32_t *fields)
+{
+  uint8_t n = 0;
+  fields[n++] = s.throttle;
+  fields[n++] = s.brake;
+  for (uint8_t i = 0; i < TELEMETRY_LINKS; i++)
+  {
+    fields[n++] = s.speed[i];
+    fields[n++] = s.torque[i];
+    fields[n++] = (int32_t)s.flags[i];
+    fields[n++] = s.status[i];
+    fields[n++] = (int32_t)s.uartErrors[i];
+    fields[n++] = (int32_t)s.uartDrops[i];
+  }
+  fields[n++] = (int32_t)s.heapFree;
+  fields[n++] = (int32_t)s.heapMin;
+  fields[n++] = (int32_t)s.heapLargest;
+  fields[n++] = (int32_t)s.loopStackFree;
+}
+
+// 20 ms period : throttle and brake ramps, speed following, slow counters and heap
+static void makeRamps(std::vector<TelemetrySnapshot> &run, uint32_t count)
+{
+  int32_t speed = 0;
+  run.resize(count);
+
+  for (uint32_t n = 0; n < count; n++)
+  {
+    TelemetrySnapshot &s = run[n];
+    memset(&s, 0, sizeof(s));
+
+    uint32_t phase = n % 1000;
+    s.timeUs = n * 20000 + 150 + noise(100);
+    s.nbLinks = TELEMETRY_LINKS;
+    s.throttle = (phase < 256) ? phase : (phase < 600) ? 255 : 0;
+    s.brake = ((phase >= 600) && (phase < 856)) ? phase - 600 : 0;
+    speed += (s.throttle * 4 - s.brake * 6 - speed / 8) / 16;
+    if (speed < 0)
+      speed = 0;
+
+    for (uint8_t i = 0; i < TELEMETRY_LINKS; i++)
+    {
+      s.speed[i] = speed + noise(2);
+      s.torque[i] = s.throttle * 64 - s.brake * 64;
+      s.flags[i] = (n / 3000) % 5 == 4 ? 0x40 : 0;
+      s.status[i] = speed ? 6 : 4;
+      s.state[i] = 10;
+      s.uartErrors[i] = n / 2000;
+      s.uartDrops[i] = n / 7000;
+    }
+    s.heapFree = 180000 - (n % 50) * 64;
+    s.heapMin = 150000 - n / 1000;
+    s.heapLargest = 110000 - (n % 50) * 64;
+    s.loopStackFree = 4000;
+  }
+}
+
+// every field jumping between extremes, counters and time wrapping at 32 bits
+static void makeSteps(std::vector<TelemetrySnapshot> &run, uint32_t count)
+{
+  run.resize(count);
+
+  for (uint32_t n = 0; n < count; n++)
+  {
+    TelemetrySnapshot &s = run[n];
+    memset(&s, 0, sizeof(s));
+
+    bool high = (n / 3) % 2;
+    // a few seconds before the 32 bits us wrap, with 1 s gaps
+    s.timeUs = 4294967295u - 3000000 + n * 20000 + ((n % 50 == 49) ? 1000000 : 0);
+    s.nbLinks = TELEMETRY_LINKS;
+    s.throttle = high ? 255 : 0;
+    s.brake = (n % 7 == 0) ? 255 : 0;
+
+    for (uint8_t i = 0; i < TELEMETRY_LINKS; i++)
+    {
+      s.speed[i] = high ? 2147483647 : -2147483647 - 1;
+      s.torque[i] = (n % 5 < 2) ? 32767 : -32768;
+      s.flags[i] = high ? 0xffffffff : 0;
+      s.status[i] = high ? 255 : 0;
+      s.state[i] = 10;
+      s.uartErrors[i] = 4294967295u - 20 + n; // wraps to 0
+      s.uartDrops[i] = (n % 11 == 0) ? 0x80000000 : 0x7fffffff;
+    }
+    s.heapFree = high ? 0xffffffff : 0;
+    s.heapMin = 0x80000000 + noise(100000);
+    s.heapLargest = (uint32_t)noise(1000);
+    s.loopStackFree = (n % 2) ? 0 : 0xffffffff;
+  }
+}
+
+struct Batch
+{
+  std::vector<uint8_t> data;
+  uint32_t first; // index of its first sample in the run
+};
+
+// as BleTelemetry::task, the flush timer counted in samples
+static void pack(const std::vector<TelemetrySnapshot> &run, uint16_t payloadSize, uint32_t flush, std::vector<Batch> &batches)
+{
+  TelemetryPacker packer;
+  uint32_t first = 0;
+
+  packer.setPayloadSize(payloadSize);
+  for (uint32_t n = 0; n < run.size(); n++)
+  {
+    bool full = !packer.add(run[n]);
+    if (full || (packer.count() >= flush) || (n + 1 == run.size()))
+    {
+      Batch batch;
+      batch.data.assign(packer.data(), packer.data() + packer.size());
+      batch.first = first;
+      batches.push_back(batch);
+      first += packer.count();
+
+      packer.reset();
+      if (full)
+      {
+        packer.add(run[n]);
+        if (n + 1 == run.size())
+        {
+          batch.data.assign(packer.data(), packer.data() + packer.size());
+          batch.first = first;
+          batches.push_back(batch);
+          first += packer.count();
+        }
+      }
+    }
+  }
+}
+
+// as tools/ble_telemetry.py decode(), false on a short or oversized batch
+static bool decode(const std::vector<uint8_t> &data, std::vector<uint32_t> &times, std::vector<int32_t> &values)
+{
+  if ((data.size() < TELEMETRY_PACKER_HEADER) || (data[0] != ((TELEMETRY_PACKER_FORMAT << 4) | TELEMETRY_LINKS)))
+    return false;
+
+  const uint8_t *p = &data[TELEMETRY_PACKER_HEADER];
+  const uint8_t *end = &data[0] + data.size();
+  uint32_t timeMs = 0;
+  int32_t fields[TELEMETRY_FIELDS] = {};
+
+  for (uint8_t n = 0; n < data[1]; n++)
+  {
+    uint32_t delta, mask;
+    uint8_t size = getVarint(p, end, delta);
+    if (!size)
+      return false;
+    p += size;
+    timeMs += delta;
+
+    size = getVarint(p, end, mask);
+    if (!size)
+      return false;
+    p += size;
+
+    for (uint8_t i = 0; i < TELEMETRY_FIELDS; i++)
+    {
+      if (mask & (1 << i))
+      {
+        size = getVarint(p, end, delta);
+        if (!size)
+          return false;
+        p += size;
+        fields[i] = (int32_t)((uint32_t)fields[i] + (uint32_t)unzigzag(delta));
+      }
+    }
+    times.push_back(timeMs);
+    values.insert(values.end(), fields, fields + TELEMETRY_FIELDS);
+  }
+
+  // nothing left over
+  return p == end;
+}
+
+static uint32_t check(const char *name, const std::vector<TelemetrySnapshot> &run, uint16_t payloadSize, uint32_t flush)
+{
+  std::vector<Batch> batches;
+  uint32_t next = 0;
+  uint32_t bytes = 0;
+  uint16_t largest = 0;
+
+  pack(run, payloadSize, flush, batches);
+
+  for (uint32_t b = 0; b < batches.size(); b++)
+  {
+    const Batch &batch = batches[b];
+    std::vector<uint32_t> times;
+    std::vector<int32_t> values;
+
+    if (batch.data.size() > payloadSize)
+    {
+      printf("%s / payload %d : batch %u is %u bytes\n", name, payloadSize, b, (uint32_t)batch.data.size());
+      return 1;
+    }
+    if (!decode(batch.data, times, values))
+    {
+      printf("%s / payload %d : batch %u does not decode\n", name, payloadSize, b);
+      return 1;
+    }
+    if ((times.size() == 0) || (batch.first != next))
+    {
+      printf("%s / payload %d : batch %u starts at sample %u, expected %u with %u samples\n", name, payloadSize, b,
+             batch.first, next, (uint32_t)times.size());
+      return 1;
+    }
+
+    for (uint32_t n = 0; n < times.size(); n++)
+    {
+      const TelemetrySnapshot &s = run[next + n];
+      int32_t fields[TELEMETRY_FIELDS];
+      getFields(s, fields);
+
+      if (times[n] != s.timeUs / 1000)
+      {
+        printf("%s / payload %d : sample %u (batch %u + %u) time %u ms, expected %u ms\n", name, payloadSize,
+               next + n, b, n, times[n], s.timeUs / 1000);
+        return 1;
+      }
+      for (uint8_t i = 0; i < TELEMETRY_FIELDS; i++)
+      {
+        if (values[n * TELEMETRY_FIELDS + i] != fields[i])
+        {
+          printf("%s / payload %d : sample %u (batch %u + %u) %s %d, expected %d\n", name, payloadSize, next + n,
+                 b, n, fieldName(i), values[n * TELEMETRY_FIELDS + i], fields[i]);
+          return 1;
+        }
+      }
+    }
+
+    next += times.size();
+    bytes += batch.data.size();
+    if (batch.data.size() > largest)
+      largest = batch.data.size();
+  }
+
+  if (next != run.size())
+  {
+    printf("%s / payload %d : %u samples decoded, expected %u\n", name, payloadSize, next, (uint32_t)run.size());
+    return 1;
+  }
+
+  printf("%-5s / payload %3d : %5u batches / %3d B largest / %d.%02d B per sample\n", name, payloadSize,
+         (uint32_t)batches.size(), largest, bytes / next, bytes * 100 / next % 100);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t count = 20000;
+  uint32_t flush = 10;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc))
+      count = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-f") == 0) && (i + 1 < argc))
+      flush = atoi(argv[++i]);
+    else
+    {
+      fprintf(stderr, "usage : %s [-n samples] [-f flush]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (!count || !flush)
+    return 1;
+
+  std::vector<TelemetrySnapshot> ramps, steps;
+  makeRamps(ramps, count);
+  makeSteps(steps, count);
+
+  // worst case sample, MTU requested by the firmware, usual phone MTUs, max ATT payload
+  const uint16_t payloadSizes[] = {TELEMETRY_PACKER_HEADER + TELEMETRY_PACKER_MAX_SAMPLE, 182, 244, 509};
+  uint32_t failures = 0;
+
+  for (uint8_t p = 0; p < sizeof(payloadSizes) / sizeof(payloadSizes[0]); p++)
+  {
+    failures += check("ramps", ramps, payloadSizes[p], flush);
+    failures += check("steps", steps, payloadSizes[p], flush);
+    // no flush timer : batches end only when full
+    failures += check("ramps", ramps, payloadSizes[p], 0xff);
+  }
+
+  printf("telemetry packer : %u failures\n", failures);
+  return failures ? 1 : 0;
+}
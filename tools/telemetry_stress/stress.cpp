@@ -0,0 +1,167 @@
+// *******************************************************************
+//  SmartESC telemetry seqlock stress test
+//
+//  Runs src/Telemetry.cpp on host threads : one writer publishes
+//  snapshots whose fields are all derived from one counter, several
+//  readers copy them as fast as they can and check that each copy is
+//  self-consistent (every field from the same counter) and that the
+//  counter never goes backwards. Exits with 1 on the first torn or
+//  stale read.
+//
+//  build (from the repository root) :
+//    g++ -std=gnu++11 -O2 -pthread -Itools/link_replay -Isrc -o telemetry_stress tools/telemetry_stress/stress.cpp src/Telemetry.cpp
+//
+//  usage :
+//    telemetry_stress [-r readers] [-t seconds]
+//      -r N   reader threads (default 3)
+//      -t N   run time [s] (default 2)
+// *******************************************************************
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Telemetry.h"
+
+// the shim of tools/link_replay declares the virtual clock
+uint64_t hostTimeUs = 0;
+
+static std::atomic<bool> running(true);
+static std::atomic<uint32_t> torn(0);
+
+// every field a different function of the counter, a mix of two publishes never matches
+static void makeSnapshot(TelemetrySnapshot &snapshot, uint32_t counter)
+{
+  snapshot.timeUs = counter;
+  snapshot.nbLinks = 1 + (counter & 1);
+  for (uint8_t i = 0; i < TELEMETRY_LINKS; i++)
+  {
+    snapshot.speed[i] = (int32_t)(counter * (3 + i));
+    snapshot.flags[i] = ~counter ^ (i << 28);
+    snapshot.torque[i] = (int16_t)(counter + i);
+    snapshot.status[i] = (uint8_t)(counter >> (8 * i));
+    snapshot.state[i] = (int8_t)(counter * 7 + i);
+    snapshot.uartErrors[i] = counter / (2 + i);
+    snapshot.uartDrops[i] = counter ^ (0x5a5a0000u >> i);
+  }
+  snapshot.throttle = (int16_t)(counter & 0xff);
+  snapshot.brake = (int16_t)((counter >> 8) & 0xff);
+  snapshot.heapFree = counter ^ 0xa5a5a5a5;
+  snapshot.heapMin = counter * 2654435761u;
+  snapshot.heapLargest = counter >> 3;
+  snapshot.loopStackFree = counter + 12345;
+}
+
+// field by field : struct padding is not copied reliably
+static bool consistent(const TelemetrySnapshot &snapshot)
+{
+  TelemetrySnapshot expected;
+  makeSnapshot(expected, snapshot.timeUs);
+
+  if ((snapshot.nbLinks != expected.nbLinks) || (snapshot.throttle != expected.throttle) ||
+      (snapshot.brake != expected.brake) || (snapshot.heapFree != expected.heapFree) ||
+      (snapshot.heapMin != expected.heapMin) || (snapshot.heapLargest != expected.heapLargest) ||
+      (snapshot.loopStackFree != expected.loopStackFree))
+    return false;
+  for (uint8_t i = 0; i < TELEMETRY_LINKS; i++)
+  {
+    if ((snapshot.speed[i] != expected.speed[i]) || (snapshot.flags[i] != expected.flags[i]) ||
+        (snapshot.torque[i] != expected.torque[i]) || (snapshot.status[i] != expected.status[i]) ||
+        (snapshot.state[i] != expected.state[i]) || (snapshot.uartErrors[i] != expected.uartErrors[i]) ||
+        (snapshot.uartDrops[i] != expected.uartDrops[i]))
+      return false;
+  }
+  return true;
+}
+
+static void writer()
+{
+  TelemetrySnapshot snapshot;
+  uint32_t counter = 0;
+  while (running)
+  {
+    makeSnapshot(snapshot, ++counter);
+    telemetry.publish(snapshot);
+  }
+}
+
+static void reader(uint8_t id, uint64_t *reads)
+{
+  TelemetrySnapshot snapshot;
+  uint32_t previous = 0;
+  uint64_t count = 0;
+  while (running)
+  {
+    telemetry.read(snapshot);
+    count++;
+
+    if (!consistent(snapshot))
+    {
+      fprintf(stderr, "reader %d : torn read, time %u / speed %d / heap free %08x\n", id, snapshot.timeUs,
+              snapshot.speed[0], snapshot.heapFree);
+      torn++;
+      running = false;
+    }
+    else if (snapshot.timeUs < previous)
+    {
+      fprintf(stderr, "reader %d : counter back from %u to %u\n", id, previous, snapshot.timeUs);
+      torn++;
+      running = false;
+    }
+    previous = snapshot.timeUs;
+  }
+  *reads = count;
+}
+
+int main(int argc, char **argv)
+{
+  int nbReaders = 3;
+  int seconds = 2;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc))
+      nbReaders = atoi(argv[++i]);
+    else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc))
+      seconds = atoi(argv[++i]);
+    else
+    {
+      fprintf(stderr, "usage : %s [-r readers] [-t seconds]\n", argv[0]);
+      return 1;
+    }
+  }
+  if ((nbReaders < 1) || (seconds < 1))
+  {
+    fprintf(stderr, "at least one reader and one second\n");
+    return 1;
+  }
+
+  // the first reads find the zeroed copies : start from a published snapshot
+  TelemetrySnapshot first;
+  makeSnapshot(first, 0);
+  telemetry.publish(first);
+
+  std::vector<uint64_t> reads(nbReaders, 0);
+  std::vector<std::thread> threads;
+  threads.push_back(std::thread(writer));
+  for (int r = 0; r < nbReaders; r++)
+    threads.push_back(std::thread(reader, r, &reads[r]));
+
+  auto timeEnd = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+  while (running && (std::chrono::steady_clock::now() < timeEnd))
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  running = false;
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+
+  uint64_t total = 0;
+  for (int r = 0; r < nbReaders; r++)
+    total += reads[r];
+  printf("%u publishes / %d readers / %llu reads / %u retries / %u torn\n", telemetry.publishCount(), nbReaders,
+         (unsigned long long)total, telemetry.retryCount(), torn.load());
+
+  return torn ? 1 : 0;
+}
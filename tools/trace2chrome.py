@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+# *******************************************************************
+#  SmartESC timing trace converter
+#
+#  Reads a console log holding a trace dump ("TRC ..." lines, sent by
+#  the firmware on 't') and writes a Chrome trace JSON, to be opened in
+#  chrome://tracing or https://ui.perfetto.dev
+#
+#  usage : trace2chrome.py console.log trace.json
+# *******************************************************************
+
+import json
+import sys
+
+# event types, keep in sync with src/TraceRing.h
+TRACE_STATE = 0
+TRACE_TX_START = 1
+TRACE_TX_END = 2
+TRACE_RX_FRAME = 3
+TRACE_ISR = 4
+TRACE_ADC = 5
+TRACE_TORQUE = 6
+
+PID_CONTROL = 0
+PID_ISR = 1
+PID_LINK = 10  # + link number
+
+TID_STATE = 0
+TID_TX = 1
+TID_RX = 2
+
+
+def read_events(path):
+    events = []
+    time_base = 0
+    time_prev = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            pos = line.find("TRC ")
+            if pos < 0:
+                continue
+            fields = line[pos:].split()
+            if len(fields) != 5 or fields[1] in ("BEGIN", "END"):
+                continue
+            time, kind, link, value = (int(x) for x in fields[1:])
+            # 32 bits us timestamps wrap every 71 minutes
+            if time_prev is not None and time < time_prev:
+                time_base += 1 << 32
+            time_prev = time
+            events.append((time_base + time, kind, link, value))
+    return events
+
+
+def metadata(pid, tid, process, thread):
+    return [
+        {"ph": "M", "pid": pid, "name": "process_name", "args": {"name": process}},
+        {"ph": "M", "pid": pid, "tid": tid, "name": "thread_name", "args": {"name": thread}},
+    ]
+
+
+def convert(events):
+    out = []
+    named = set()
+    state_start = {}
+    tx_start = {}
+
+    def track(pid, tid, process, thread):
+        if (pid, tid) not in named:
+            named.add((pid, tid))
+            out.extend(metadata(pid, tid, process, thread))
+
+    for time, kind, link, value in events:
+        pid = PID_LINK + link
+        process = "ESC link %d" % link
+
+        if kind == TRACE_STATE:
+            track(pid, TID_STATE, process, "state machine")
+            if link in state_start:
+                start, state = state_start[link]
+                out.append({"ph": "X", "pid": pid, "tid": TID_STATE, "ts": start, "dur": time - start,
+                            "name": "state %d" % state})
+            state_start[link] = (time, value)
+        elif kind == TRACE_TX_START:
+            tx_start[link] = (time, value)
+        elif kind == TRACE_TX_END:
+            track(pid, TID_TX, process, "tx")
+            if link in tx_start:
+                start, reg = tx_start.pop(link)
+                out.append({"ph": "X", "pid": pid, "tid": TID_TX, "ts": start, "dur": max(time - start, 1),
+                            "name": "tx 0x%02x" % reg, "args": {"reg": reg, "size": value}})
+        elif kind == TRACE_RX_FRAME:
+            track(pid, TID_RX, process, "rx")
+            out.append({"ph": "i", "s": "t", "pid": pid, "tid": TID_RX, "ts": time,
+                        "name": "rx 0x%02x" % value})
+        elif kind == TRACE_ISR:
+            track(PID_ISR, link, "UART interrupts", "UART%d" % link)
+            out.append({"ph": "i", "s": "t", "pid": PID_ISR, "tid": link, "ts": time, "name": "isr"})
+        elif kind == TRACE_ADC:
+            track(PID_CONTROL, 0, "control", "adc")
+            out.append({"ph": "i", "s": "t", "pid": PID_CONTROL, "tid": 0, "ts": time, "name": "adc",
+                        "args": {"throttle": value}})
+        elif kind == TRACE_TORQUE:
+            track(PID_CONTROL, 1, "control", "torque")
+            out.append({"ph": "i", "s": "t", "pid": PID_CONTROL, "tid": 1, "ts": time,
+                        "name": "torque %d" % link, "args": {"torque": value}})
+            out.append({"ph": "C", "pid": PID_CONTROL, "ts": time, "name": "torque %d" % link,
+                        "args": {"torque": value}})
+
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("usage : %s console.log trace.json" % sys.argv[0])
+        return 1
+
+    events = read_events(sys.argv[1])
+    with open(sys.argv[2], "w") as f:
+        json.dump(convert(events), f)
+    print("%d events converted" % len(events))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
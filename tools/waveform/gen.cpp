@@ -0,0 +1,92 @@
+// *******************************************************************
+//  SmartESC waveform table generator
+//
+//  Builds the table the waveform player would play (src/Waveform.h)
+//  and prints it as CSV, to check a profile before the bench : one
+//  line per tick, time and torque. The summary (ticks, min, max, build
+//  time) goes to stderr.
+//
+//  build (from the repository root) :
+//    g++ -std=gnu++11 -O2 -Isrc -o waveform_gen tools/waveform/gen.cpp src/Waveform.cpp
+//
+//  usage :
+//    waveform_gen [-s shape] [-o offset] [-a amplitude] [-p period] [-e end_period] [-d duration] [-t tick]
+//      -s     step, ramp, triangle, sine (default) or chirp
+//      -o -a  torque offset and amplitude (default 2000, 1000)
+//      -p -e  period and chirp end period [ms] (default 2000, 200)
+//      -d -t  duration and tick [ms] (default 10000, 10)
+// *******************************************************************
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Waveform.h"
+
+#define GEN_MAX_TICKS 65535
+
+static int16_t table[GEN_MAX_TICKS];
+
+int main(int argc, char **argv)
+{
+  WaveformProfile profile = {WAVEFORM_SINE, 2000, 1000, 2000, 200, 10000, 10};
+
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    const char *value = argv[i + 1];
+    if (strcmp(argv[i], "-s") == 0)
+    {
+      uint8_t shape;
+      for (shape = 0; (shape < WAVEFORM_SHAPES) && strcmp(value, waveformShapeName(shape)); shape++)
+        ;
+      if (shape == WAVEFORM_SHAPES)
+      {
+        fprintf(stderr, "unknown shape %s\n", value);
+        return 1;
+      }
+      profile.shape = shape;
+    }
+    else if (strcmp(argv[i], "-o") == 0)
+      profile.offset = atoi(value);
+    else if (strcmp(argv[i], "-a") == 0)
+      profile.amplitude = atoi(value);
+    else if (strcmp(argv[i], "-p") == 0)
+      profile.periodMs = atoi(value);
+    else if (strcmp(argv[i], "-e") == 0)
+      profile.endPeriodMs = atoi(value);
+    else if (strcmp(argv[i], "-d") == 0)
+      profile.durationMs = atoi(value);
+    else if (strcmp(argv[i], "-t") == 0)
+      profile.tickMs = atoi(value);
+    else
+    {
+      fprintf(stderr, "usage : %s [-s shape] [-o offset] [-a amplitude] [-p period] [-e end_period] [-d duration] [-t tick]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  uint16_t ticks = buildWaveform(profile, table, GEN_MAX_TICKS);
+  double buildUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  if (ticks == 0)
+  {
+    fprintf(stderr, "empty profile (tick and period must not be 0)\n");
+    return 1;
+  }
+
+  int16_t low = table[0];
+  int16_t high = table[0];
+  printf("time_ms,torque\n");
+  for (uint16_t k = 0; k < ticks; k++)
+  {
+    printf("%u,%d\n", k * profile.tickMs, table[k]);
+    if (table[k] < low)
+      low = table[k];
+    if (table[k] > high)
+      high = table[k];
+  }
+
+  fprintf(stderr, "%s : %u ticks of %u ms / torque %d to %d / built in %.0f us on the host\n",
+          waveformShapeName(profile.shape), ticks, profile.tickMs, low, high, buildUs);
+  return 0;
+}